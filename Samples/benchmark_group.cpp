@@ -0,0 +1,97 @@
+#include "SwiftNetMLP.h"
+#include "SwiftNetMLPGroup.h"
+#include "common.h"
+#include <chrono>
+#include <memory>
+
+
+using namespace sycl;
+using namespace sycl::ext::oneapi::experimental::matrix;
+
+using bf16 = sycl::ext::oneapi::bfloat16;
+
+// Per-object networks: 1k small models evaluated on 256 samples each, one launch per model against a grouped launch
+int main() {
+    queue q = queue();
+
+    const int WIDTH = 64;
+    const int output_width = 64;
+    const int n_hidden_layers = 3;
+    const int n_models = 1000;
+    const int samples_per_model = 256;
+    const int batch_size = n_models * samples_per_model;
+    const int n_runs = 10;
+
+    DeviceMem<bf16> inputs = DeviceMem<bf16>(batch_size * WIDTH, q);
+    DeviceMem<float> output = DeviceMem<float>(batch_size * output_width, q);
+    DeviceMem<float> output_group = DeviceMem<float>(batch_size * output_width, q);
+    inputs.initialize_uniform(q);
+
+    // One network per model, their weights are copied into the group
+    SwiftNetMLPGroup<WIDTH> group = SwiftNetMLPGroup<WIDTH>(q, n_models, WIDTH, output_width, n_hidden_layers, Activation::ReLU, Activation::None, batch_size);
+    std::vector<std::unique_ptr<SwiftNetMLP<WIDTH>>> networks;
+    std::vector<DeviceMem<bf16>> model_inputs(n_models);
+    std::vector<DeviceMem<float>> model_outputs(n_models);
+    for (int m = 0; m < n_models; m++) {
+        networks.emplace_back(new SwiftNetMLP<WIDTH>(q, WIDTH, output_width, n_hidden_layers, Activation::ReLU, Activation::None, samples_per_model));
+        networks[m]->initialize_params();
+        group.set_model(m, *networks[m]);
+
+        model_inputs[m].allocate(samples_per_model * WIDTH, q);
+        model_outputs[m].allocate(samples_per_model * output_width, q);
+        q.memcpy(model_inputs[m].data(), inputs.data() + m * samples_per_model * WIDTH, samples_per_model * WIDTH * sizeof(bf16));
+    }
+    q.wait();
+
+    std::vector<int> segment_models(n_models);
+    std::vector<int> segment_sizes(n_models, samples_per_model);
+    for (int m = 0; m < n_models; m++) {
+        segment_models[m] = m;
+    }
+
+    auto time_ms = [&](auto run) {
+        run();
+        const auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < n_runs; i++) {
+            run();
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() / n_runs;
+    };
+
+    const double per_model_ms = time_ms([&]() {
+        for (int m = 0; m < n_models; m++) {
+            SwiftNetMLP<WIDTH>& network = *networks[m];
+            network.inference(model_inputs[m], network.m_forward, network.m_A_forward, network.m_B_forward, network.m_C_forward, model_outputs[m]);
+        }
+        });
+    const double group_ms = time_ms([&]() {
+        group.inference(inputs, segment_models, segment_sizes, output_group);
+        });
+
+    for (int m = 0; m < n_models; m++) {
+        q.memcpy(output.data() + m * samples_per_model * output_width, model_outputs[m].data(), samples_per_model * output_width * sizeof(float));
+    }
+    q.wait();
+
+    std::vector<float> ref(output.size());
+    std::vector<float> res(output_group.size());
+    output.copy_to_host(ref, q);
+    output_group.copy_to_host(res, q);
+    double max_abs_error = 0.0;
+    for (int i = 0; i < ref.size(); i++) {
+        max_abs_error = std::max(max_abs_error, (double)std::abs(res[i] - ref[i]));
+    }
+
+    std::cout << n_models << " models x " << samples_per_model << " samples" << std::endl;
+    std::cout << "one launch per model: " << per_model_ms << " ms" << std::endl;
+    std::cout << "grouped launch: " << group_ms << " ms (" << per_model_ms / group_ms << "x)" << std::endl;
+    std::cout << "max abs error: " << max_abs_error << std::endl;
+
+    group.free_mem(q);
+    for (int m = 0; m < n_models; m++) {
+        networks[m]->free_mem(q);
+        model_inputs[m].free_mem(q);
+        model_outputs[m].free_mem(q);
+    }
+    return 0;
+}
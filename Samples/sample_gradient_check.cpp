@@ -0,0 +1,123 @@
+#include "SwiftNetMLP.h"
+#include "common.h"
+#include <random>
+
+
+using namespace sycl;
+using namespace sycl::ext::oneapi::experimental::matrix;
+
+using bf16 = sycl::ext::oneapi::bfloat16;
+
+// Compares the weight gradients of the backward pass of a ReLU network to central finite differences of the loss
+int main() {
+    queue q = queue();
+
+    const int batch_size = 256;
+    const int output_width = 64;
+    const int WIDTH = 64;
+    const int n_hidden_layers = 3;
+    const int n_checked = 64;
+    const float step = 1.0f / 32;
+    const double tolerance = 0.1;
+
+    SwiftNetMLP<WIDTH> network = SwiftNetMLP<WIDTH>(q, WIDTH, output_width, n_hidden_layers, Activation::ReLU, Activation::None, batch_size);
+
+    DeviceMem<bf16> inputs = DeviceMem<bf16>(batch_size * WIDTH, q);
+    DeviceMem<float> output = DeviceMem<float>(batch_size * output_width, q);
+    DeviceMem<bf16> grads = DeviceMem<bf16>(batch_size * output_width, q);
+
+    // Weights and inputs of both signs, so that a good part of the ReLUs is inactive
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> distrib(-1.0f, 1.0f);
+
+    const int n_params = network.get_weights_matrices()->size();
+    std::vector<float> weights(n_params);
+    std::vector<bf16> packed(n_params);
+    std::vector<bf16> packedT(n_params);
+    for (int i = 0; i < n_params; i++) {
+        weights[i] = (float)(bf16)(0.25f * distrib(rng));
+    }
+
+    auto set_weights = [&]() {
+        for (int i = 0; i < n_params; i++) {
+            packed[toPackedWeightCoord(i, WIDTH, output_width, n_hidden_layers, false)] = (bf16)weights[i];
+            packedT[toPackedWeightCoord(i, WIDTH, output_width, n_hidden_layers, true)] = (bf16)weights[i];
+        }
+        network.get_weights_matrices()->copy_from_host(packed, q);
+        network.get_weightsT_matrices()->copy_from_host(packedT, q);
+        network.m_master_weights = nullptr;
+        network.m_weights_version++;
+    };
+
+    std::vector<bf16> inputs_host(batch_size * WIDTH);
+    for (auto& x : inputs_host) {
+        x = (bf16)distrib(rng);
+    }
+    inputs.copy_from_host(inputs_host, q);
+
+    // L = 0.5 * sum(output^2), so that dL/doutput = output
+    std::vector<float> output_host(batch_size * output_width);
+    auto loss = [&]() {
+        network.forward_pass(inputs, network.m_forward, network.m_A_forward, network.m_B_forward, network.m_C_forward, output);
+        output.copy_to_host(output_host, q);
+        double l = 0.0;
+        for (float o : output_host) {
+            l += 0.5 * (double)o * o;
+        }
+        return l;
+    };
+
+    set_weights();
+    loss();
+    std::vector<bf16> grads_host(output_host.size());
+    for (int i = 0; i < output_host.size(); i++) {
+        grads_host[i] = (bf16)output_host[i];
+    }
+    grads.copy_from_host(grads_host, q);
+    network.backward_pass(inputs,
+        grads,
+        network.m_out_inter,
+        network.m_deltas_temp,
+        network.m_deltas,
+        network.m_B_backward_last_layer,
+        network.m_C_backward_last_layer,
+        network.m_forward);
+
+    std::vector<float> analytic(n_params);
+    network.get_grads_matrices()->copy_to_host(analytic, q);
+
+    // The weights are checked in every matrix, the first ones go through all the ReLU derivatives
+    double sum_sq_error = 0.0;
+    double sum_sq_ref = 0.0;
+    std::uniform_int_distribution<int> pick(0, WIDTH * WIDTH - 1);
+    for (int i = 0; i < n_checked; i++) {
+        const int matrix = i % (n_hidden_layers + 1);
+        const int idx = matrix * WIDTH * WIDTH + pick(rng) % (matrix < n_hidden_layers ? WIDTH * WIDTH : WIDTH * output_width);
+        const float w = weights[idx];
+
+        // The perturbed weights are rounded to bf16, the actual step is used for the difference quotient
+        weights[idx] = (float)(bf16)(w + step);
+        const float w_plus = weights[idx];
+        set_weights();
+        const double loss_plus = loss();
+
+        weights[idx] = (float)(bf16)(w - step);
+        const float w_minus = weights[idx];
+        set_weights();
+        const double loss_minus = loss();
+
+        weights[idx] = w;
+
+        const double numeric = (loss_plus - loss_minus) / (w_plus - w_minus);
+        const double error = analytic[idx] - numeric;
+        sum_sq_error += error * error;
+        sum_sq_ref += numeric * numeric;
+    }
+    set_weights();
+
+    const double relative_error = std::sqrt(sum_sq_error / std::max(sum_sq_ref, 1e-30));
+    std::cout << "Relative L2 error of the weight gradients: " << relative_error << (relative_error < tolerance ? " (passed)" : " (failed)") << std::endl;
+
+    network.free_mem(q);
+    return relative_error < tolerance ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+#include "SwiftNetMLP.h"
+#include "common.h"
+#include <random>
+
+
+using namespace sycl;
+using namespace sycl::ext::oneapi::experimental::matrix;
+
+using bf16 = sycl::ext::oneapi::bfloat16;
+
+// Compares the inference of a small batch (latency kernel, output layer in oneMKL) to the inference of the same
+// rows by the generic kernels of a larger batch, with an output activation, for a narrow and a wide output layer.
+// The small batch runs the latency kernel, launched once per hidden layer.
+int main() {
+    queue q = queue();
+
+    const int WIDTH = 64;
+    const int n_hidden_layers = 3;
+    const int latency_batch_size = 256;
+    const int generic_batch_size = 1024;
+    const double tolerance = 1e-2;
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> distrib(-1.0f, 1.0f);
+
+    std::vector<bf16> inputs_host(generic_batch_size * WIDTH);
+    for (auto& x : inputs_host) {
+        x = (bf16)distrib(rng);
+    }
+
+    bool passed = true;
+    for (const int output_width : { 16, 64 }) {
+        SwiftNetMLP<WIDTH> latency_network = SwiftNetMLP<WIDTH>(q, WIDTH, output_width, n_hidden_layers, Activation::ReLU, Activation::Sigmoid, latency_batch_size);
+        SwiftNetMLP<WIDTH> generic_network = SwiftNetMLP<WIDTH>(q, WIDTH, output_width, n_hidden_layers, Activation::ReLU, Activation::Sigmoid, generic_batch_size);
+
+        // Same weights for both networks
+        const int n_params = latency_network.get_weights_matrices()->size();
+        std::vector<bf16> packed(n_params);
+        std::vector<bf16> packedT(n_params);
+        for (int i = 0; i < n_params; i++) {
+            const bf16 weight = (bf16)(0.25f * distrib(rng));
+            packed[toPackedWeightCoord(i, WIDTH, output_width, n_hidden_layers, false)] = weight;
+            packedT[toPackedWeightCoord(i, WIDTH, output_width, n_hidden_layers, true)] = weight;
+        }
+        for (SwiftNetMLP<WIDTH>* network : { &latency_network, &generic_network }) {
+            network->get_weights_matrices()->copy_from_host(packed, q);
+            network->get_weightsT_matrices()->copy_from_host(packedT, q);
+            network->m_master_weights = nullptr;
+            network->m_weights_version++;
+        }
+
+        // Narrow outputs are stored with the row stride of the network width
+        const int output_stride = output_width > 16 ? output_width : WIDTH;
+
+        DeviceMem<bf16> latency_inputs = DeviceMem<bf16>(latency_batch_size * WIDTH, q);
+        DeviceMem<bf16> generic_inputs = DeviceMem<bf16>(generic_batch_size * WIDTH, q);
+        DeviceMem<float> latency_output = DeviceMem<float>(latency_batch_size * output_stride, q);
+        DeviceMem<float> generic_output = DeviceMem<float>(generic_batch_size * output_stride, q);
+
+        std::vector<bf16> latency_inputs_host(inputs_host.begin(), inputs_host.begin() + latency_batch_size * WIDTH);
+        latency_inputs.copy_from_host(latency_inputs_host, q);
+        generic_inputs.copy_from_host(inputs_host, q);
+
+        latency_network.inference(latency_inputs, latency_network.m_forward, latency_network.m_A_forward, latency_network.m_B_forward, latency_network.m_C_forward, latency_output);
+        generic_network.inference(generic_inputs, generic_network.m_forward, generic_network.m_A_forward, generic_network.m_B_forward, generic_network.m_C_forward, generic_output);
+
+        std::vector<float> latency_host(latency_output.size());
+        std::vector<float> generic_host(generic_output.size());
+        latency_output.copy_to_host(latency_host, q);
+        generic_output.copy_to_host(generic_host, q);
+
+        double max_error = 0.0;
+        for (int row = 0; row < latency_batch_size; row++) {
+            for (int col = 0; col < output_width; col++) {
+                const int idx = row * output_stride + col;
+                max_error = std::max(max_error, (double)std::abs(latency_host[idx] - generic_host[idx]));
+            }
+        }
+        std::cout << "Output width " << output_width << ", largest difference between the latency and the generic inference: " << max_error << (max_error < tolerance ? " (passed)" : " (failed)") << std::endl;
+        passed = passed && max_error < tolerance;
+
+        latency_inputs.free_mem(q);
+        generic_inputs.free_mem(q);
+        latency_output.free_mem(q);
+        generic_output.free_mem(q);
+        latency_network.free_mem(q);
+        generic_network.free_mem(q);
+    }
+
+    return passed ? 0 : 1;
+}
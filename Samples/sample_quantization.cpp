@@ -0,0 +1,115 @@
+#include "SwiftNetMLP.h"
+#include "trainer.h"
+#include "common.h"
+#include "config.h"
+#include <chrono>
+#include <random>
+
+
+using namespace sycl;
+using namespace sycl::ext::oneapi::experimental::matrix;
+
+using bf16 = sycl::ext::oneapi::bfloat16;
+
+// Post-training quantization of a trained network: compares the int8 inference to the bf16 one
+int main() {
+    const float scale = 1.0f;
+
+    queue q = queue();
+
+    const int batch_size = 8192;
+    const int output_width = 64;
+    const int WIDTH = 64;
+    const int n_train_steps = 100;
+    const int n_runs = 100;
+
+    DeviceMem<bf16> inputs = DeviceMem<bf16>(batch_size * WIDTH, q);
+    DeviceMem<bf16> calibration_inputs = DeviceMem<bf16>(batch_size * WIDTH, q);
+    DeviceMem<float> output = DeviceMem<float>(batch_size * output_width, q);
+    DeviceMem<float> output_int8 = DeviceMem<float>(batch_size * output_width, q);
+    DeviceMem<float> target = DeviceMem<float>(batch_size * output_width, q);
+    DeviceMem<bf16> grads = DeviceMem<bf16>(batch_size * output_width, q);
+    DeviceMem<float> losses = DeviceMem<float>(batch_size * output_width, q);
+
+    nlohmann::json config = {
+{"loss", {
+        {"otype", "L2"}
+}},
+{"optimizer", {
+        {"otype", "sgd"},
+        {"learning_rate", 1e-3},
+        {"l2_reg", 1e-8f}
+}},
+{"network", {
+        {"otype", "SwiftNetMLP"},
+        {"activation", "ReLU"},
+        {"output_activation", "None"},
+        {"n_neurons", WIDTH},
+        {"n_output_dims", output_width},
+        {"n_hidden_layers", 3},
+        {"batch_size", batch_size}
+}},
+    };
+
+    auto model = create_from_config(q, config);
+    auto network = dynamic_cast<SwiftNetMLP<WIDTH>*>(model.network);
+
+    model.trainer.initialize_params();
+    inputs.initialize_uniform(q);
+    output.initialize_constant(0.0f, q);
+    target.initialize_constant(1.0f, q);
+    grads.initialize_constant(bf16(0.0f), q);
+    losses.initialize_constant(0.0f, q);
+
+    for (int i = 0; i < n_train_steps; i++) {
+        model.trainer.training_step(inputs, output, target, grads, losses, scale, WIDTH);
+    }
+
+    // Calibrate the activation scales on another batch than the evaluated one, and quantize the weights once:
+    // both are reused until the weights change
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> distrib(0.0f, 1.0f);
+    std::vector<bf16> calibration_host(calibration_inputs.size());
+    for (auto& x : calibration_host) {
+        x = (bf16)distrib(rng);
+    }
+    calibration_inputs.copy_from_host(calibration_host, q);
+    network->calibrate_int8(calibration_inputs);
+    network->quantize_weights_int8();
+
+    auto time_ms = [&](auto run) {
+        run();
+        const auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < n_runs; i++) {
+            run();
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() / n_runs;
+    };
+
+    const double bf16_ms = time_ms([&]() {
+        network->inference(inputs, network->m_forward, network->m_A_forward, network->m_B_forward, network->m_C_forward, output);
+        });
+    const double int8_ms = time_ms([&]() {
+        network->inference_int8(inputs, network->m_forward, network->m_A_forward, network->m_B_forward, network->m_C_forward, output_int8);
+        });
+
+    std::vector<float> ref(output.size());
+    std::vector<float> res(output_int8.size());
+    output.copy_to_host(ref, q);
+    output_int8.copy_to_host(res, q);
+
+    double max_abs_error = 0.0;
+    double sum_sq_error = 0.0;
+    double sum_sq_ref = 0.0;
+    for (int i = 0; i < ref.size(); i++) {
+        const double error = res[i] - ref[i];
+        max_abs_error = std::max(max_abs_error, std::abs(error));
+        sum_sq_error += error * error;
+        sum_sq_ref += (double)ref[i] * ref[i];
+    }
+
+    std::cout << "bf16 inference: " << bf16_ms << " ms, " << batch_size / bf16_ms * 1e-3 << " M samples/s" << std::endl;
+    std::cout << "int8 inference: " << int8_ms << " ms, " << batch_size / int8_ms * 1e-3 << " M samples/s" << std::endl;
+    std::cout << "max abs error: " << max_abs_error << ", relative L2 error: " << std::sqrt(sum_sq_error / std::max(sum_sq_ref, 1e-30)) << std::endl;
+    return 0;
+}
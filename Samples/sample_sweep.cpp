@@ -0,0 +1,58 @@
+#include "SwiftNetMLPGroup.h"
+#include "batched_trainer.h"
+#include "L2.h"
+#include "common.h"
+
+
+using namespace sycl;
+using namespace sycl::ext::oneapi::experimental::matrix;
+
+using bf16 = sycl::ext::oneapi::bfloat16;
+
+// Learning rate sweep: K models trained together on the same data, each with its own learning rate
+int main() {
+    const float scale = 1.0f;
+
+    queue q = queue();
+
+    const int WIDTH = 64;
+    const int output_width = 64;
+    const int n_hidden_layers = 3;
+    const int batch_size = 1024;
+    const int n_models = 8;
+    const int n_steps = 1000;
+
+    std::vector<float> learning_rates(n_models);
+    std::vector<float> l2_regs(n_models, 1e-8f);
+    for (int m = 0; m < n_models; m++) {
+        learning_rates[m] = 1e-4f * std::pow(2.0f, m);
+    }
+
+    // Every model reads its own batch_size rows
+    DeviceMem<bf16> inputs = DeviceMem<bf16>(n_models * batch_size * WIDTH, q);
+    DeviceMem<float> output = DeviceMem<float>(n_models * batch_size * output_width, q);
+    DeviceMem<float> target = DeviceMem<float>(n_models * batch_size * output_width, q);
+    DeviceMem<bf16> grads = DeviceMem<bf16>(n_models * batch_size * output_width, q);
+    DeviceMem<float> losses = DeviceMem<float>(n_models * batch_size * output_width, q);
+
+    inputs.initialize_constant(bf16(1.0f), q);
+    target.initialize_constant(1.0f, q);
+
+    SwiftNetMLPGroup<WIDTH> group = SwiftNetMLPGroup<WIDTH>(q, n_models, WIDTH, output_width, n_hidden_layers, Activation::ReLU, Activation::None, n_models * batch_size, batch_size);
+    L2Loss loss;
+    BatchedTrainer<WIDTH> trainer = BatchedTrainer<WIDTH>(group, loss, learning_rates, l2_regs);
+    trainer.initialize_params();
+
+    for (int i = 0; i < n_steps; i++) {
+        trainer.training_step(inputs, output, target, grads, losses, scale);
+    }
+
+    std::vector<float> model_losses = trainer.get_model_losses();
+    for (int m = 0; m < n_models; m++) {
+        std::cout << "learning rate " << learning_rates[m] << ": loss " << model_losses[m] << std::endl;
+    }
+
+    trainer.free_mem(q);
+    group.free_mem(q);
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include "trainer.h"
 #include "common.h"
 #include "config.h"
+#include <chrono>
 
 
 using namespace sycl;
@@ -11,6 +12,8 @@ using bf16 = sycl::ext::oneapi::bfloat16;
 
 int main() {
     const float scale = 1e-3f;
+    const float target_loss = 1e-3f;
+    const int n_steps = 1000;
 
     queue q = queue();
 
@@ -30,8 +33,6 @@ int main() {
 }},
 {"optimizer", {
         {"otype", "sgd"},
-        {"output_width", output_width},
-        {"n_hidden_layers", 3},
         {"learning_rate", 1e-3},
         {"l2_reg", 1e-8f}
 }},
@@ -40,6 +41,7 @@ int main() {
         {"activation", "ReLU"},
         {"output_activation", "None"},
         {"n_neurons", WIDTH},
+        {"n_output_dims", output_width},
         {"n_hidden_layers", 3},
         {"batch_size", batch_size}
 }},
@@ -48,19 +50,41 @@ int main() {
     auto model = create_from_config(q, config);
 
     model.trainer.initialize_params();
+    inputs.initialize_constant(bf16(1.0f), q);
     output.initialize_constant(0.0f, q);
     target.initialize_constant(1.0f, q);
     grads.initialize_constant(bf16(0.0f), q);
     losses.initialize_constant(0.0f, q);
 
-    for (int i = 0; i < 1000; i ++){
-    model.trainer.training_step(inputs,
-        output,
-        target,
-        grads,
-        losses,
-        scale,
-        64);
+    // Time to reach the target loss, the mean loss is read back every 10 steps
+    std::vector<float> losses_host(batch_size * output_width);
+    const auto begin = std::chrono::steady_clock::now();
+    int step = 0;
+    float mean_loss = 0.0f;
+
+    for (step = 1; step <= n_steps; step++) {
+        model.trainer.training_step(inputs,
+            output,
+            target,
+            grads,
+            losses,
+            scale,
+            64);
+
+        if (step % 10 == 0) {
+            losses.copy_to_host(losses_host, q);
+            mean_loss = 0.0f;
+            for (float l : losses_host) {
+                mean_loss += l;
+            }
+            mean_loss /= losses_host.size();
+            if (mean_loss < target_loss) {
+                break;
+            }
+        }
     }
+
+    const double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << "Loss " << mean_loss << " after " << std::min(step, n_steps) << " steps in " << elapsed_ms << " ms" << std::endl;
     return 0;
 }
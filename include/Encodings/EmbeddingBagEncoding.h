@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Encoding.h"
+
+// Sum the features of one item over the embeddings of the bag of a row
+extern SYCL_EXTERNAL void embedding_bag_encode_item(const EncodingParams& params, int row, int item, float* features);
+
+// Embedding bag input for sparse categorical features: the input of a row is the sum of the embeddings of its
+// indices, gathered from the table straight into shared memory, so that the input bandwidth and the first layer
+// scale with the number of non zeros instead of the vocabulary. The backward pass scatters the gradients into the
+// rows of the table which were used, and the Adam step only visits those rows.
+// The encoding has no positions: the bags are set with set_bags before the forward pass, which takes empty positions.
+class EmbeddingBagEncoding : public Encoding {
+public:
+	EmbeddingBagEncoding(queue q, int n_embeddings, int n_features, float learning_rate = 1e-2f);
+
+	// Set the bags of the next passes, in CSR layout: the row r sums the embeddings indices[offsets[r]] to
+	// indices[offsets[r + 1] - 1], offsets holds batch_size + 1 values
+	void set_bags(const DeviceMem<int>& indices, const DeviceMem<int>& offsets);
+
+	// Scatter-add the gradients of the encoded features to the used rows of the table, coords and dL_dcoords are unused
+	void backward(queue q, const float* coords, const float* dL_dencoded, int batch_size, int stride, float* dL_dcoords = nullptr) override;
+
+	// Adam step on the rows of the table used since the last step, the gradients of those rows are cleared
+	void step(queue q, float normalization, const float* dynamic_scale = nullptr, const float* skip_flag = nullptr) override;
+
+	void initialize_params() override;
+
+	void free_mem(queue q) override;
+
+private:
+	queue m_q;
+	int m_n_embeddings;
+	float m_learning_rate;
+	int m_n_steps = 0;
+	int m_n_indices = 0;
+
+	DeviceMem<float> m_table;
+	DeviceMem<float> m_table_grads;
+	DeviceMem<float> m_first_moments;
+	DeviceMem<float> m_second_moments;
+
+	// Rows of the table used since the last step: a flag per row, and their list and count. The count stays on the
+	// device, m_max_used_rows bounds it by the indices of the backward passes since the last step
+	DeviceMem<int> m_used;
+	DeviceMem<int> m_used_rows;
+	DeviceMem<int> m_n_used_rows;
+	int m_max_used_rows = 0;
+};
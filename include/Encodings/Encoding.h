@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include "DeviceMem.h"
+
+#define ENCODING_MAX_DIMS 3
+#define ENCODING_MAX_FEATURES 16
+
+enum class EncodingType {
+	None,
+	HashGrid,
+	Frequency,
+	OneBlob,
+	SphericalHarmonics,
+	EmbeddingBag,
+};
+
+// Parameters of an encoding, passed by value to the kernels. An encoding produces n_items groups of
+// n_features_per_item features per position, computed independently (e.g. one level of a hash grid).
+struct EncodingParams {
+	EncodingType type = EncodingType::None;
+	int n_dims = 0;
+	int n_items = 0;
+	int n_features_per_item = 0;
+
+	// Embedding bag
+	const int* indices = nullptr;
+	const int* offsets = nullptr;
+
+	// Hash grid
+	uint32_t table_size = 0;
+	float base_resolution = 16.0f;
+	float log2_per_level_scale = 1.0f;
+
+	// Trainable parameters (hash grid, embedding bag)
+	float* tables = nullptr;
+	float* table_grads = nullptr;
+};
+
+// Compute the features of one item at a position, row being the index of the position in the batch
+extern SYCL_EXTERNAL void encode_item(const EncodingParams& params, const float* coords, int row, int item, float* features);
+
+// Backpropagate the gradients of the features of one item: scatter-add them to the trainable parameters and,
+// when dL_dcoords is given, add the gradients of the position to it
+extern SYCL_EXTERNAL void encode_item_backward(const EncodingParams& params, const float* coords, int row, int item, const float* dL_dfeatures, float* dL_dcoords);
+
+// Input encoding of a network, computed by its forward kernel from raw float positions (or other per-row data)
+// straight into shared memory (see SwiftNetMLP::set_encoding). The encodings without parameters only backpropagate
+// to the positions.
+class Encoding {
+public:
+	virtual ~Encoding() {}
+
+	// Number of floats per position
+	int get_n_dims() const {
+		return m_params.n_dims;
+	}
+
+	// Number of features produced per position
+	int get_n_output_dims() const {
+		return m_params.n_items * m_params.n_features_per_item;
+	}
+
+	EncodingParams get_params() const {
+		return m_params;
+	}
+
+	// Backpropagate the gradients of the encoded features (batch_size rows of stride values): the gradients of the
+	// parameters are summed over the batch, the gradients of the positions are written to dL_dcoords when given
+	virtual void backward(queue q, const float* coords, const float* dL_dencoded, int batch_size, int stride, float* dL_dcoords = nullptr);
+
+	// Step on the parameters, the gradients are multiplied by normalization and divided by *dynamic_scale when given.
+	// Nothing is updated when *skip_flag is non zero.
+	virtual void step(queue q, float normalization, const float* dynamic_scale = nullptr, const float* skip_flag = nullptr) {}
+
+	virtual void initialize_params() {}
+
+	virtual void free_mem(queue q) {}
+
+protected:
+	EncodingParams m_params;
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "Encoding.h"
+
+extern SYCL_EXTERNAL void frequency_encode_item(const EncodingParams& params, const float* coords, int item, float* features);
+extern SYCL_EXTERNAL void frequency_encode_item_backward(const EncodingParams& params, const float* coords, int item, const float* dL_dfeatures, float* dL_dcoords);
+
+// Sinusoidal (positional) encoding: sin(2^k pi x) and cos(2^k pi x) for n_frequencies frequencies of every dimension
+class FrequencyEncoding : public Encoding {
+public:
+	FrequencyEncoding(int n_dims, int n_frequencies);
+};
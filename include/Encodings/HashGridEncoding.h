@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Encoding.h"
+
+#define HASHGRID_MAX_FEATURES 8
+
+// Interpolate the features of one level at a position in [0, 1]^n_dims
+extern SYCL_EXTERNAL void hashgrid_encode_level(const EncodingParams& params, const float* coords, int level, float* features);
+
+// Scatter-add the gradients of the features of one level to the tables and, when dL_dcoords is given, add the
+// gradients of the position through the interpolation weights
+extern SYCL_EXTERNAL void hashgrid_backward_level(const EncodingParams& params, const float* coords, int level, const float* dL_dfeatures, float* dL_dcoords);
+
+// Multiresolution hash encoding: n_levels grids from base_resolution up by per_level_scale, each level holding a table
+// of table_size entries of n_features_per_level trainable features. Coarse levels are indexed densely, the others are
+// hashed. The features are bilinearly (2D) or trilinearly (3D) interpolated between the corners of the cell.
+// The tables are trained with their own Adam step, the gradients of the positions go through the interpolation weights.
+class HashGridEncoding : public Encoding {
+public:
+	HashGridEncoding(queue q, int n_dims, int n_levels, int n_features_per_level, int log2_table_size, float base_resolution, float per_level_scale, float learning_rate = 1e-2f);
+
+	// Adam step on the tables, the gradients are multiplied by normalization and divided by *dynamic_scale when given.
+	// Nothing is updated when *skip_flag is non zero. The table gradients are cleared for the next step.
+	void step(queue q, float normalization, const float* dynamic_scale = nullptr, const float* skip_flag = nullptr) override;
+
+	void initialize_params() override;
+
+	void free_mem(queue q) override;
+
+private:
+	queue m_q;
+	float m_learning_rate;
+	int m_n_steps = 0;
+
+	DeviceMem<float> m_tables;
+	DeviceMem<float> m_table_grads;
+	DeviceMem<float> m_first_moments;
+	DeviceMem<float> m_second_moments;
+};
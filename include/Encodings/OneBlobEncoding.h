@@ -0,0 +1,12 @@
+#pragma once
+
+#include "Encoding.h"
+
+extern SYCL_EXTERNAL void one_blob_encode_item(const EncodingParams& params, const float* coords, int item, float* features);
+extern SYCL_EXTERNAL void one_blob_encode_item_backward(const EncodingParams& params, const float* coords, int item, const float* dL_dfeatures, float* dL_dcoords);
+
+// One-blob encoding: every dimension in [0, 1] is spread over n_bins bins by a Gaussian kernel of width 1 / n_bins
+class OneBlobEncoding : public Encoding {
+public:
+	OneBlobEncoding(int n_dims, int n_bins);
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Encoding.h"
+
+extern SYCL_EXTERNAL void spherical_harmonics_encode_item(const EncodingParams& params, const float* coords, int item, float* features);
+extern SYCL_EXTERNAL void spherical_harmonics_encode_item_backward(const EncodingParams& params, const float* coords, int item, const float* dL_dfeatures, float* dL_dcoords);
+
+// Real spherical harmonics of a direction up to degree 4 (degree^2 features). The direction is given in [0, 1]^3
+// and mapped to [-1, 1]^3.
+class SphericalHarmonicsEncoding : public Encoding {
+public:
+	SphericalHarmonicsEncoding(int degree);
+};
@@ -15,4 +15,15 @@ public:
         DeviceMem<bf16>& grads,
         DeviceMem<float>& values
     ) override;
+
+    void evaluate(
+        queue q,
+        const int dims,
+        const int stride,
+        const float scale,
+        DeviceMem<float>& preds,
+        DeviceMem<float>& targets,
+        DeviceMem<sycl::half>& grads,
+        DeviceMem<float>& values
+    ) override;
 };
@@ -4,36 +4,43 @@
 
 using bf16 = sycl::ext::oneapi::bfloat16;
 
-// Base class for neural network
+class Encoding;
+
+// Compute precision of the inference of a bf16 network. A network is trained in its element type (bf16, or fp16 with
+// SwiftNetMLP<WIDTH, sycl::half>) with fp32 master weights
+enum class Precision {
+	BFloat16,
+	Half,
+	Float,
+	TF32,
+};
+
+// Base class for neural network, T is the element type of its weights and activations (bf16 or sycl::half)
+template <typename T = bf16>
 class Network {
 public:
 
 	// Perform forward pass through the network
-	virtual void forward_pass(const DeviceMem<bf16>& input, float* forward, float* A, float* B, float* C, DeviceMem<float>& output) = 0;
+	virtual void forward_pass(const DeviceMem<T>& input, T* forward, T* A, T* B, float* C, DeviceMem<float>& output) = 0;
+
+	// Perform forward pass through the network on positions encoded by its input encoding
+	virtual void forward_pass_encoded(const DeviceMem<float>& coords, DeviceMem<float>& output) {
+		throw std::runtime_error{"The network does not support input encodings."};
+	}
 
 	// Perform inference through the network
-	virtual void inference(const DeviceMem<bf16>& input, float* forward, float* A, float* B, float* C, DeviceMem<float>& output) = 0;
+	virtual void inference(const DeviceMem<T>& input, T* forward, T* A, T* B, float* C, DeviceMem<float>& output) = 0;
 
 	// Perform backward pass through the network
 	virtual void backward_pass(
-		const DeviceMem<bf16>& input,
-		DeviceMem<bf16>& grads,
-		float* out_inter,
+		const DeviceMem<T>& input,
+		DeviceMem<T>& grads,
+		T* out_inter,
 		float* delta_temp,
-		DeviceMem<bf16> loss,
-		float* A,
-		float* B,
-		float* C,
-		float* A_backward_last_layer,
-		float* B_backward_last_layer,
+		DeviceMem<T> loss,
+		T* B_backward_last_layer,
 		float* C_backward_last_layer,
-		float* D_backward_last_layer,
-		float* E_backward_last_layer,
-		float* F_backward_last_layer,
-		float* A_dgemm,
-		float* B_dgemm,
-		float* C_dgemm,
-		float* forward
+		T* forward
 	) = 0;
 
 	// Initialize network parameters
@@ -42,44 +49,45 @@ public:
 	// Free memory allocated by the network
 	virtual void free_mem(queue q) = 0;
 
+	// Get the batch size of one forward and backward pass
+	virtual int get_batch_size() = 0;
+
 	// Get the SYCL queue associated with the network
 	queue get_queue() {
 		return m_q;
 	}
 
 	// Data members
-	float* m_forward;
-	int m_shmem_size;
+	T* m_forward;
 	size_t m_alignment;
 
-	bf16* m_act_mem;
-	float* m_act_mem_temp;
-
-	float* m_A_forward;
-	float* m_B_forward;
+	T* m_A_forward;
+	T* m_B_forward;
 	float* m_C_forward;
 
-	float* m_out_inter;
+	T* m_out_inter;
 	float* m_deltas_temp;
-	DeviceMem<bf16> m_deltas;
+	DeviceMem<T> m_deltas;
 
-	float* m_A_backward;
-	float* m_B_backward;
-	float* m_C_backward;
-
-	float* m_A_backward_last_layer;
-	float* m_B_backward_last_layer;
+	T* m_B_backward_last_layer;
 	float* m_C_backward_last_layer;
-	float* m_D_backward_last_layer;
-	float* m_E_backward_last_layer;
-	float* m_F_backward_last_layer;
-
-	float* m_A_dgemm;
-	float* m_B_dgemm;
-	float* m_C_dgemm;
 
 	queue m_q;
-	DeviceMem<bf16> m_grads_matrices;
-	DeviceMem<bf16> m_weights_matrices;
-	DeviceMem<bf16> m_weightsT_matrices;
+	// Weight gradients, accumulated in fp32
+	DeviceMem<float> m_grads_matrices;
+	DeviceMem<T> m_weights_matrices;
+	DeviceMem<T> m_weightsT_matrices;
+
+	// Incremented each time the weights change, layouts derived from the weights are only rebuilt when it moved
+	uint64_t m_weights_version = 0;
+
+	// fp32 master weights of the optimizer (unpacked layout) when they are up to date, used for the fp16 and fp32 inference
+	const float* m_master_weights = nullptr;
+
+	// Packed moving average of the weights, read by inference when m_inference_uses_ema is set
+	DeviceMem<T> m_weights_matrices_inferences;
+	bool m_inference_uses_ema = false;
+
+	// Input encoding computed in the forward kernel, trained with the network when set
+	Encoding* m_encoding = nullptr;
 };
@@ -7,6 +7,7 @@
 #include "activation.h"
 #include "Network.h"
 #include "DeviceMem.h"
+#include "Encoding.h"
 
 #include "sgd.h"
 #include "trainer.h"
@@ -16,46 +17,77 @@
 
 using bf16 = sycl::ext::oneapi::bfloat16;
 
-template <int WIDTH>
-class SwiftNetMLP : public Network {
+// Fused MLP of element type T: bf16, or sycl::half for the fp16 training. The forward and backward kernels specialized on
+// the depth are only instantiated in bf16, fp16 networks run the generic ones
+template <int WIDTH, typename T = bf16>
+class SwiftNetMLP : public Network<T> {
 public:
-    SwiftNetMLP(queue q, int input_width, int output_width, int n_hidden_layers, Activation activation, Activation output_activation, int batch_size);
+    using Network<T>::m_forward;
+    using Network<T>::m_alignment;
+    using Network<T>::m_A_forward;
+    using Network<T>::m_B_forward;
+    using Network<T>::m_C_forward;
+    using Network<T>::m_out_inter;
+    using Network<T>::m_deltas_temp;
+    using Network<T>::m_deltas;
+    using Network<T>::m_B_backward_last_layer;
+    using Network<T>::m_C_backward_last_layer;
+    using Network<T>::m_q;
+    using Network<T>::m_grads_matrices;
+    using Network<T>::m_weights_matrices;
+    using Network<T>::m_weightsT_matrices;
+    using Network<T>::m_weights_version;
+    using Network<T>::m_master_weights;
+    using Network<T>::m_weights_matrices_inferences;
+    using Network<T>::m_inference_uses_ema;
+    using Network<T>::m_encoding;
+
+    SwiftNetMLP(queue q, int input_width, int output_width, int n_hidden_layers, Activation activation, Activation output_activation, int batch_size, int checkpoint_interval = 1, Precision precision = Precision::BFloat16);
     ~SwiftNetMLP();
-    void forward_pass(const DeviceMem<bf16>& input, float* forward, float* A, float* B, float* C, DeviceMem<float>& output) override;
+    void forward_pass(const DeviceMem<T>& input, T* forward, T* A, T* B, float* C, DeviceMem<float>& output) override;
 
-    void inference(const DeviceMem<bf16>& input, float* forward, float* A, float* B, float* C, DeviceMem<float>& output) override;
+    void inference(const DeviceMem<T>& input, T* forward, T* A, T* B, float* C, DeviceMem<float>& output) override;
+
+    // Encode the positions given to forward_pass_encoded and inference_encoded with encoding, fused with the first layer
+    void set_encoding(Encoding* encoding);
+
+    void forward_pass_encoded(const DeviceMem<float>& coords, DeviceMem<float>& output) override;
+
+    void inference_encoded(const DeviceMem<float>& coords, DeviceMem<float>& output);
+
+    // Compute the gradients of the loss with respect to the input (or the encoded positions) in the backward pass
+    void set_input_gradients(bool enabled);
+
+    DeviceMem<float>* get_input_gradients();
+
+    // Post-training quantization of the input and hidden layers, used by inference_int8
+    void quantize_weights_int8();
+
+    // Calibrate the per-layer int8 activation scales on a representative batch, needed by inference_int8
+    void calibrate_int8(const DeviceMem<T>& input);
+
+    void inference_int8(const DeviceMem<T>& input, T* forward, T* A, T* B, float* C, DeviceMem<float>& output);
+
+    // Inference in the fp16 or fp32 compute precision selected at construction
+    void inference_precision(const DeviceMem<T>& input, DeviceMem<float>& output);
 
     void backward_pass(
-        const DeviceMem<bf16>& input,
-        DeviceMem<bf16>& grads,
-        float* out_inter,
+        const DeviceMem<T>& input,
+        DeviceMem<T>& grads,
+        T* out_inter,
         float* delta_temp, 
-        DeviceMem<bf16> loss,
-        float* A,
-        float* B,
-        float* C,
-        float* A_backward_last_layer,
-        float* B_backward_last_layer,
+        DeviceMem<T> loss,
+        T* B_backward_last_layer,
         float* C_backward_last_layer,
-        float* D_backward_last_layer,
-        float* E_backward_last_layer,
-        float* F_backward_last_layer,
-        float* A_dgemm,
-        float* B_dgemm,
-        float* C_dgemm,
-        float* forward
+        T* forward
     ) override;
 
-    void dgemm_last_layer_backward(DeviceMem<bf16>& grads,
-        float* forward,
-        DeviceMem<bf16>& loss,
+    void dgemm_last_layer_backward(DeviceMem<T>& grads,
+        T* forward,
+        DeviceMem<T>& loss,
         int batch_size,
-        float* A,
-        float* B,
-        float* C,
-        float* D,
-        float* E,
-        float* F);
+        T* B,
+        float* C);
     //void set_params(float* params, float* inference_params, float* gradients);
     void save_to_file(std::string filename);
     void load_from_file(std::string filename);
@@ -65,11 +97,15 @@ public:
 
 
 
-    DeviceMem<bf16>* get_grads_matrices();
+    DeviceMem<float>* get_grads_matrices();
+
+    DeviceMem<T>* get_weights_matrices();
 
-    DeviceMem<bf16>* get_weights_matrices();
+    DeviceMem<T>* get_weightsT_matrices();
 
-    DeviceMem<bf16>* get_weightsT_matrices();
+    long long get_checkpointing_bytes_saved();
+
+    int get_batch_size() override;
 
 
 private:
@@ -81,11 +117,57 @@ private:
     int m_padded_output_width;
     int m_batch_size;
 
+    // Activation checkpointing: only every m_checkpoint_interval-th layer is stored by the forward pass
+    int m_checkpoint_interval;
+    int m_n_stored_layers;
+    T* m_forward_segment;
+
     Activation m_activation;
     Activation m_output_activation;
 
-
-    DeviceMem<bf16> m_weights_matrices_inferences;
+    void forward_pass_impl(T* input, const float* coords, T* forward, T* A, T* B, float* C, DeviceMem<float>& output);
+    void inference_impl(T* input, const float* coords, T* forward, T* A, T* B, float* C, DeviceMem<float>& output);
+
+    // Whether the last forward pass was encoded and its positions, gradients of the input and of the positions
+    bool m_encoded_forward = false;
+    const float* m_encoding_coords = nullptr;
+    bool m_input_gradients = false;
+    DeviceMem<float> m_dL_dinput;
+    DeviceMem<float> m_dL_dcoords;
+
+    // Counter of the batch chunks taken by the work-groups of the persistent kernels
+    DeviceMem<int> m_chunk_counter;
+
+    // Whether the inference runs the small-batch latency kernel, the batch is too large for it otherwise
+    bool m_latency_inference = false;
+
+    // A layout derived from the packed weights (e.g. the unpacked output matrix) and what it was built from
+    struct DerivedLayout {
+        uint64_t version = 0;
+        const void* source = nullptr;
+        const void* data = nullptr;
+    };
+    bool is_stale(DerivedLayout& layout, const void* source, const void* data);
+
+    DerivedLayout m_output_weights_layout;
+    DerivedLayout m_output_weightsT_layout;
+
+    // Int8 weights with one scale per output channel, and one activation scale per layer input
+    DeviceMem<int8_t> m_weights_int8;
+    DeviceMem<float> m_weights_int8_scales;
+    DerivedLayout m_weights_int8_layout;
+    DeviceMem<float> m_act_int8_scales;
+    uint64_t m_act_int8_scales_version = UINT64_MAX;
+
+    // Compute precision of the inference and the weights and activations it needs
+    Precision m_precision;
+    void update_precision_weights();
+    DeviceMem<sycl::half> m_weights_half;
+    DeviceMem<sycl::half> m_output_weights_half;
+    DeviceMem<float> m_weights_float;
+    DerivedLayout m_precision_weights_layout;
+    DeviceMem<sycl::half> m_act_half;
+    DeviceMem<float> m_act_float;
 
     int m_total_n_params;
 };
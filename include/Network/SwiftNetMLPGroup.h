@@ -0,0 +1,98 @@
+#ifndef SWIFTNET_GROUP_H
+#define SWIFTNET_GROUP_H
+
+#include <iostream>
+#include <vector>
+#include <CL/sycl.hpp>
+#include "activation.h"
+#include "DeviceMem.h"
+#include "SwiftNetMLP.h"
+
+using bf16 = sycl::ext::oneapi::bfloat16;
+
+// A group of same-shaped MLPs (e.g. one per scene asset) evaluated together in a single launch.
+// The packed weights of the models are stored one after the other. The inputs are sorted by model into segments
+// whose sizes are multiples of segment_alignment(), each work-group reads the weights of the model of its segment.
+// With a training batch size, the models can also be trained together (see BatchedTrainer): model m then reads the
+// rows [m * training_batch_size, (m + 1) * training_batch_size) of the input.
+template <int WIDTH>
+class SwiftNetMLPGroup {
+public:
+    SwiftNetMLPGroup(queue q, int n_models, int input_width, int output_width, int n_hidden_layers, Activation activation, Activation output_activation, int max_batch_size, int training_batch_size = 0);
+    ~SwiftNetMLPGroup();
+
+    // Copy the weights of a trained network into the slot of a model
+    void set_model(int model, SwiftNetMLP<WIDTH>& network);
+
+    void initialize_params();
+
+    // Evaluate the segments: segment i holds segment_sizes[i] consecutive rows of input, evaluated by model segment_models[i]
+    void inference(const DeviceMem<bf16>& input, const std::vector<int>& segment_models, const std::vector<int>& segment_sizes, DeviceMem<float>& output);
+
+    // Number of rows the segment sizes must be a multiple of
+    static int segment_alignment();
+
+    // Forward pass of every model on its training rows, the activations are kept for the backward pass
+    void forward_pass(const DeviceMem<bf16>& input, DeviceMem<float>& output);
+
+    // Backward pass of every model, the weight gradients are summed over the training rows of each model
+    void backward_pass(DeviceMem<bf16>& loss_grads, const DeviceMem<float>& output);
+
+    DeviceMem<bf16>* get_weights_matrices();
+
+    DeviceMem<bf16>* get_weightsT_matrices();
+
+    DeviceMem<float>* get_grads_matrices();
+
+    int get_n_params_per_model();
+
+    int get_n_models();
+
+    int get_n_hidden_layers();
+
+    int get_output_width();
+
+    int get_training_batch_size();
+
+    queue get_queue();
+
+    // Incremented whenever the weights change
+    uint64_t m_weights_version = 0;
+
+    void free_mem(queue q);
+
+private:
+    queue m_q;
+    int m_n_models;
+    int m_n_hidden_layers;
+    int m_output_width;
+    int m_max_batch_size;
+    int m_n_params;
+
+    Activation m_activation;
+    Activation m_output_activation;
+
+    DeviceMem<bf16> m_weights_matrices;
+
+    // Model of every chunk of BATCH_CHUNK rows, -1 for the chunks past the last segment
+    DeviceMem<int> m_chunk_models;
+    std::vector<int> m_chunk_models_host;
+
+    void launch_forward(const bf16* input, const int* chunk_models, int n_chunks, float* output, bf16* forward);
+    void update_transposed_weights();
+
+    // Training: the stored activations (input and hidden layers) and the deltas of the hidden layers, all models stacked
+    int m_training_batch_size;
+    DeviceMem<int> m_training_chunk_models;
+    DeviceMem<bf16> m_weightsT_matrices;
+    DeviceMem<float> m_grads_matrices;
+    DeviceMem<bf16> m_forward;
+    DeviceMem<bf16> m_out_inter;
+    DeviceMem<float> m_deltas_last_layer;
+
+    // Unpacked output matrices of the models and the weights version they were built from
+    DeviceMem<bf16> m_output_weights;
+    uint64_t m_output_weights_version = 0;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef SWIFTNET_VAR_WIDTH_H
+#define SWIFTNET_VAR_WIDTH_H
+
+#include <iostream>
+#include <vector>
+#include <CL/sycl.hpp>
+#include "activation.h"
+#include "DeviceMem.h"
+
+using bf16 = sycl::ext::oneapi::bfloat16;
+
+// Number of parameters of the matrices between consecutive widths
+template <int... WIDTHS>
+constexpr int var_width_n_hidden_params() {
+    constexpr int widths[] = { WIDTHS... };
+    int n_params = 0;
+    for (int i = 0; i + 1 < (int)sizeof...(WIDTHS); i++) {
+        n_params += widths[i] * widths[i + 1];
+    }
+    return n_params;
+}
+
+// Runtime interface of the networks with per-layer widths, see create_var_width_network
+class VarWidthNetwork {
+public:
+    virtual ~VarWidthNetwork() {}
+
+    // Set the weights from fp32 matrices, one after the other: row i of a matrix holds the weights from input i
+    virtual void set_weights(const std::vector<float>& weights) = 0;
+
+    virtual void initialize_params() = 0;
+
+    virtual void inference(const DeviceMem<bf16>& input, DeviceMem<float>& output, int batch_size) = 0;
+
+    // Widths of the input and the hidden layers
+    virtual std::vector<int> get_widths() const = 0;
+
+    virtual int get_n_params() const = 0;
+
+    virtual void free_mem(queue q) = 0;
+};
+
+// Inference network whose input and hidden layers have their own widths (e.g. a tapering 128 -> 64 -> 32 serving
+// model), given as WIDTHS, input width first. The fused kernel keeps the activations in shared memory across the
+// layers, whose shapes are compile-time constants, instead of padding every layer to the widest one.
+template <int... WIDTHS>
+class SwiftNetMLPVarWidth : public VarWidthNetwork {
+    static_assert(sizeof...(WIDTHS) >= 2, "The network needs an input and a hidden layer.");
+    static_assert(((WIDTHS % 16 == 0) && ...), "Widths must be multiples of 16.");
+
+public:
+    SwiftNetMLPVarWidth(queue q, int output_width, Activation activation, Activation output_activation);
+    ~SwiftNetMLPVarWidth();
+
+    void set_weights(const std::vector<float>& weights) override;
+
+    void initialize_params() override;
+
+    // Evaluate batch_size rows (a multiple of the batch chunk of the kernel, 16 on dg2 and 32 on pvc) of the input
+    void inference(const DeviceMem<bf16>& input, DeviceMem<float>& output, int batch_size) override;
+
+    std::vector<int> get_widths() const override;
+
+    int get_n_params() const override;
+
+    void free_mem(queue q) override;
+
+    static constexpr int N_HIDDEN_PARAMS = var_width_n_hidden_params<WIDTHS...>();
+
+private:
+    queue m_q;
+    int m_output_width;
+    Activation m_activation;
+    Activation m_output_activation;
+
+    // Packed bf16 matrices, the output matrix last
+    DeviceMem<bf16> m_weights_matrices;
+};
+
+// Create the network of the given widths (input width first) among the instantiated shapes
+VarWidthNetwork* create_var_width_network(queue q, const std::vector<int>& widths, int output_width, Activation activation, Activation output_activation);
+
+#endif
@@ -3,17 +3,47 @@
 #include "common.h"
 #include <vector>
 //#include "L2.h"
+// Storage precision of the Adam moments, they are always updated in fp32
+enum class MomentsPrecision {
+    Float,
+    BFloat16,
+    Int8Blockwise,
+};
+
 class AdamOptimizer : public Optimizer {
 public:
 
-    void step(queue q, float loss_scale, DeviceMem<bf16>& weights, DeviceMem<bf16>& weightsT, DeviceMem<bf16>& gradients, int WIDTH) override;
+    AdamOptimizer(int output_rows, int n_hidden_layers, float learning_rate, float l2_reg, MomentsPrecision moments_precision = MomentsPrecision::Float);
+
+    void step(queue q, float loss_scale, DeviceMem<bf16>& weights, DeviceMem<bf16>& weightsT, DeviceMem<float>& gradients, int WIDTH) override;
+
+    void step(queue q, float loss_scale, DeviceMem<sycl::half>& weights, DeviceMem<sycl::half>& weightsT, DeviceMem<float>& gradients, int WIDTH) override;
 
     void set_learning_rate(const float learning_rate);
 
+    float get_state_bytes_per_param() const;
+
 private:
+    template <typename T>
+    void step_impl(queue q, float loss_scale, DeviceMem<T>& weights, DeviceMem<T>& weightsT, DeviceMem<float>& gradients, int WIDTH);
+
+    void allocate_moments(queue q, int n_elements);
+
+    MomentsPrecision m_moments_precision;
+    int m_n_moments = 0;
+
     DeviceMem<float> m_first_moments;
     DeviceMem<float> m_second_moments;
 
+    DeviceMem<bf16> m_first_moments_bf16;
+    DeviceMem<bf16> m_second_moments_bf16;
+
+    // 8-bit moments with one fp32 scale factor per block
+    DeviceMem<int8_t> m_first_moments_int8;
+    DeviceMem<uint8_t> m_second_moments_uint8;
+    DeviceMem<float> m_first_moments_scales;
+    DeviceMem<float> m_second_moments_scales;
+
     int m_output_rows;
     int m_n_hidden_layers;
     float m_learning_rate = 1e-3f;
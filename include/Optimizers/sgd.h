@@ -8,11 +8,16 @@ public:
 
     SGDOptimizer(int output_rows, int n_hidden_layers, float learning_rate, float l2_reg);
 
-    void step(queue q, float loss_scale, DeviceMem<bf16>& weights, DeviceMem<bf16>& weightsT, DeviceMem<bf16>& gradients, int WIDTH) override;
+    void step(queue q, float loss_scale, DeviceMem<bf16>& weights, DeviceMem<bf16>& weightsT, DeviceMem<float>& gradients, int WIDTH) override;
+
+    void step(queue q, float loss_scale, DeviceMem<sycl::half>& weights, DeviceMem<sycl::half>& weightsT, DeviceMem<float>& gradients, int WIDTH) override;
 
     void set_learning_rate(const float learning_rate);
 
 private:
+    template <typename T>
+    void step_impl(queue q, float loss_scale, DeviceMem<T>& weights, DeviceMem<T>& weightsT, DeviceMem<float>& gradients, int WIDTH);
+
 
     int m_output_rows;
     int m_n_hidden_layers;
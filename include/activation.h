@@ -111,7 +111,8 @@ void elt_activation_bwd(Activation activation, outT& elt, fwdT fwd) {
 	switch (activation) {
 
 	case Activation::ReLU:
-		if (fwd < (fwdT)0.0f) {
+		// fwd holds the activated value, which is exactly 0 wherever the pre-activation was negative
+		if (fwd <= (fwdT)0.0f) {
 			elt = (outT)0.0f;
 		}
 		return;
@@ -158,7 +159,7 @@ void elt_activation_bwd(Activation activation, outT& elt, fwdT fwd, resT& res) {
 	switch (activation) {
 
 	case Activation::ReLU:
-		if (fwd < (fwdT)0.0f) {
+		if (fwd <= (fwdT)0.0f) {
 			res = (resT)0.0f;
 		}
 		else {
@@ -211,6 +212,42 @@ void matrix_activation(Activation activation, multi_ptr<T, access::address_space
 	}
 }
 
+// Activation known at compile time, for the kernels specialized on it: no switch is left in the element loops
+template<Activation ACTIVATION>
+struct ActivationFunctor {
+	template<typename T>
+	static float forward(T elt) {
+		const float x = (float)elt;
+		if constexpr (ACTIVATION == Activation::ReLU) {
+			return x < 0.0f ? 0.0f : x;
+		}
+		else if constexpr (ACTIVATION == Activation::LeakyReLU) {
+			return x >= 0.0f ? x : 0.01f * x;
+		}
+		else if constexpr (ACTIVATION == Activation::Exponential) {
+			return expf(x);
+		}
+		else if constexpr (ACTIVATION == Activation::Sine) {
+			return sinf(x - floor(x / (2 * PI)) * 2 * PI);
+		}
+		else if constexpr (ACTIVATION == Activation::Sigmoid) {
+			return 1.0f / (1.0f + expf(-x));
+		}
+		else if constexpr (ACTIVATION == Activation::Squareplus) {
+			return 0.5f * (x + sqrtf(x * x + 4.0f));
+		}
+		else if constexpr (ACTIVATION == Activation::Softplus) {
+			return logf(1.0f + expf(x));
+		}
+		else if constexpr (ACTIVATION == Activation::Tanh) {
+			return tanhf(x);
+		}
+		else {
+			return x;
+		}
+	}
+};
+
 template<typename outT, typename fwdT, typename resT, int SG_SZ>
 void matrix_activation_backward(Activation activation, multi_ptr<outT, access::address_space::local_space, (access::decorated)2> out, device_ptr<fwdT> fwd, multi_ptr<resT, access::address_space::local_space, (access::decorated)2> res, int offset, int stride) {
 
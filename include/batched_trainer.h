@@ -0,0 +1,325 @@
+#pragma once
+
+#include "DeviceMem.h"
+#include "loss.h"
+#include "SwiftNetMLPGroup.h"
+#include "common.h"
+#include <algorithm>
+
+// Optimizer applied to all the models of a BatchedTrainer
+enum class BatchedOptimizer {
+	SGD,
+	Adam,
+};
+
+// Trains the K models of a SwiftNetMLPGroup together (e.g. a hyperparameter sweep).
+// Each model has its own hyperparameters (learning rate, L2 regularization and the Adam betas and epsilon), held in a
+// small device array, its own fp32 master weights and Adam moments, and its own dynamic loss scale. Every training
+// step launches the forward, backward and optimizer kernels once for all the models.
+template <int WIDTH>
+class BatchedTrainer {
+public:
+
+	/**
+	 * Create a batched trainer.
+	 *
+	 * @param group The models to train, with a training batch size.
+	 * @param loss The loss function.
+	 * @param learning_rates Learning rate of every model.
+	 * @param l2_regs L2 regularization of every model.
+	 * @param optimizer Optimizer of the models, the Adam betas and epsilon are set with set_adam_hyperparameters.
+	 */
+	BatchedTrainer(SwiftNetMLPGroup<WIDTH>& group, Loss& loss, const std::vector<float>& learning_rates, const std::vector<float>& l2_regs, BatchedOptimizer optimizer = BatchedOptimizer::SGD) {
+		if (group.get_training_batch_size() == 0) {
+			throw std::runtime_error{"The group has no training batch size."};
+		}
+		m_group = &group;
+		m_loss = &loss;
+		m_optimizer = optimizer;
+
+		queue q = m_group->get_queue();
+		const int n_models = m_group->get_n_models();
+		const int n_params = n_models * m_group->get_n_params_per_model();
+		m_hyperparameters.allocate(N_HYPERPARAMETERS * n_models, q);
+		m_hyperparameters_host.assign(N_HYPERPARAMETERS * n_models, 0.0f);
+		m_master_weights.allocate(n_params, q);
+		m_model_losses.allocate(n_models, q);
+
+		if (m_optimizer == BatchedOptimizer::Adam) {
+			m_first_moments.allocate(n_params, q);
+			m_second_moments.allocate(n_params, q);
+			m_first_moments.initialize_constant(0.0f, q);
+			m_second_moments.initialize_constant(0.0f, q);
+		}
+
+		set_adam_hyperparameters(std::vector<float>(n_models, 0.9f), std::vector<float>(n_models, 0.99f), std::vector<float>(n_models, 1e-8f));
+		set_hyperparameters(learning_rates, l2_regs);
+	}
+
+	// Set the learning rate and the L2 regularization of every model
+	void set_hyperparameters(const std::vector<float>& learning_rates, const std::vector<float>& l2_regs) {
+		const int n_models = m_group->get_n_models();
+		if (learning_rates.size() != n_models || l2_regs.size() != n_models) {
+			throw std::runtime_error{"Every model needs a learning rate and an L2 regularization."};
+		}
+		std::copy(learning_rates.begin(), learning_rates.end(), m_hyperparameters_host.begin() + LEARNING_RATE * n_models);
+		std::copy(l2_regs.begin(), l2_regs.end(), m_hyperparameters_host.begin() + L2_REG * n_models);
+		m_hyperparameters.copy_from_host(m_hyperparameters_host, m_group->get_queue());
+	}
+
+	// Set the decays of the Adam moments and the epsilon of every model (0.9, 0.99 and 1e-8 by default)
+	void set_adam_hyperparameters(const std::vector<float>& beta1s, const std::vector<float>& beta2s, const std::vector<float>& epsilons) {
+		const int n_models = m_group->get_n_models();
+		if (beta1s.size() != n_models || beta2s.size() != n_models || epsilons.size() != n_models) {
+			throw std::runtime_error{"Every model needs a beta1, a beta2 and an epsilon."};
+		}
+		std::copy(beta1s.begin(), beta1s.end(), m_hyperparameters_host.begin() + BETA1 * n_models);
+		std::copy(beta2s.begin(), beta2s.end(), m_hyperparameters_host.begin() + BETA2 * n_models);
+		std::copy(epsilons.begin(), epsilons.end(), m_hyperparameters_host.begin() + EPSILON * n_models);
+		m_hyperparameters.copy_from_host(m_hyperparameters_host, m_group->get_queue());
+	}
+
+	/**
+	 * Enable the dynamic loss scaling, with one scale per model.
+	 * The loss gradients of a model are multiplied by its scale, on top of the scale given to training_step. When a
+	 * weight gradient of a model is not finite, the step of that model is skipped and its scale is multiplied by
+	 * backoff_factor, after growth_interval clean steps it is multiplied by growth_factor. The other models are updated.
+	 *
+	 * @param initial_scale Initial dynamic loss scale of every model.
+	 * @param growth_interval Number of clean steps before a scale grows.
+	 * @param growth_factor Factor applied to a scale when it grows.
+	 * @param backoff_factor Factor applied to a scale after a non-finite gradient.
+	 */
+	void enable_dynamic_loss_scaling(float initial_scale, int growth_interval, float growth_factor = 2.0f, float backoff_factor = 0.5f) {
+		queue q = m_group->get_queue();
+		const int n_models = m_group->get_n_models();
+		std::vector<float> state(N_LOSS_SCALER_STATES * n_models, 0.0f);
+		for (int m = 0; m < n_models; m++) {
+			state[m * N_LOSS_SCALER_STATES + SCALE] = initial_scale;
+		}
+
+		if (m_loss_scaler.size() == 0) {
+			m_loss_scaler.allocate(state.size(), q);
+		}
+		m_loss_scaler.copy_from_host(state, q);
+
+		m_dynamic_loss_scaling = true;
+		m_loss_scale_growth_interval = growth_interval;
+		m_loss_scale_growth_factor = growth_factor;
+		m_loss_scale_backoff_factor = backoff_factor;
+	}
+
+	// Get the current dynamic loss scale of every model (reads them back from the device)
+	std::vector<float> get_loss_scales() {
+		const int n_models = m_group->get_n_models();
+		std::vector<float> scales(n_models, 1.0f);
+		if (!m_dynamic_loss_scaling) {
+			return scales;
+		}
+		std::vector<float> state(m_loss_scaler.size());
+		m_loss_scaler.copy_to_host(state, m_group->get_queue());
+		for (int m = 0; m < n_models; m++) {
+			scales[m] = state[m * N_LOSS_SCALER_STATES + SCALE];
+		}
+		return scales;
+	}
+
+	void training_step(DeviceMem<bf16>& input,
+		DeviceMem<float>& output,
+		DeviceMem<float>& target,
+		DeviceMem<bf16>& grads,
+		DeviceMem<float>& losses,
+		const float scale) {
+		queue q = m_group->get_queue();
+		const int n_models = m_group->get_n_models();
+		const int n_params = m_group->get_n_params_per_model();
+		const int output_width = m_group->get_output_width();
+		const int n_hidden_layers = m_group->get_n_hidden_layers();
+		const int batch_size = m_group->get_training_batch_size();
+
+		m_group->forward_pass(input, output);
+
+		m_loss->evaluate(q, output_width, output_width, scale, output, target, grads, losses);
+
+		float* p_losses = losses.data();
+		float* p_model_losses = m_model_losses.data();
+		const int model_length = batch_size * output_width;
+		float* p_scaler = m_dynamic_loss_scaling ? m_loss_scaler.data() : nullptr;
+
+		// Apply the dynamic loss scale of every model on top of the static one, it is read on the device
+		if (m_dynamic_loss_scaling) {
+			bf16* p_loss_grads = grads.data();
+			q.parallel_for<>(range<1>(grads.size()), [=](id<1> idx) {
+				const int model = idx / model_length;
+				p_loss_grads[idx] = (bf16)((float)p_loss_grads[idx] * p_scaler[model * N_LOSS_SCALER_STATES + SCALE]);
+				}).wait();
+		}
+
+		// Mean loss of every model, one work-group per model
+		q.parallel_for<>(nd_range<1>(n_models * 64, 64), [=](nd_item<1> item) {
+			const int model = item.get_group(0);
+			float sum = 0.0f;
+			for (int i = item.get_local_id(0); i < model_length; i += 64) {
+				sum += p_losses[model * model_length + i];
+			}
+			sum = sycl::reduce_over_group(item.get_group(), sum, sycl::plus<float>());
+			if (item.get_local_id(0) == 0) {
+				p_model_losses[model] = sum / model_length;
+			}
+			}).wait();
+
+		m_group->backward_pass(grads, output);
+
+		if (m_master_weights_version != m_group->m_weights_version) {
+			update_master_weights(q);
+		}
+		float* master_weights = m_master_weights.data();
+		bf16* weights = m_group->get_weights_matrices()->data();
+		bf16* weightsT = m_group->get_weightsT_matrices()->data();
+		const float* gradients = m_group->get_grads_matrices()->data();
+		const float* hyperparameters = m_hyperparameters.data();
+		const float normalization = 1.0f / (batch_size * scale);
+
+		// Flag the models with a non-finite weight gradient, their step is skipped
+		if (m_dynamic_loss_scaling) {
+			q.parallel_for<>(range<1>(n_models * n_params), [=](id<1> idx) {
+				const int model = idx / n_params;
+				if (!sycl::isfinite(gradients[idx])) {
+					sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> flag(p_scaler[model * N_LOSS_SCALER_STATES + FOUND_NON_FINITE]);
+					flag.store(1.0f);
+				}
+				}).wait();
+		}
+
+		// Fused optimizer step of all the models, the gradients are normalized by the batch size and the loss scales
+		const bool adam = m_optimizer == BatchedOptimizer::Adam;
+		float* first_moments = m_first_moments.data();
+		float* second_moments = m_second_moments.data();
+
+		q.parallel_for<>(range<1>(n_models * n_params), [=](id<1> idx) {
+			const int model = idx / n_params;
+			const int offset = model * n_params;
+			const int unpacked_idx = idx % n_params;
+
+			float model_normalization = normalization;
+			if (p_scaler) {
+				if (p_scaler[model * N_LOSS_SCALER_STATES + FOUND_NON_FINITE] != 0.0f) {
+					return;
+				}
+				model_normalization /= p_scaler[model * N_LOSS_SCALER_STATES + SCALE];
+			}
+
+			float weight = master_weights[idx];
+			const float gradient = gradients[idx] * model_normalization + hyperparameters[L2_REG * n_models + model] * weight;
+			if (adam) {
+				const float beta1 = hyperparameters[BETA1 * n_models + model];
+				const float beta2 = hyperparameters[BETA2 * n_models + model];
+				const float first_moment = beta1 * first_moments[idx] + (1.0f - beta1) * gradient;
+				const float second_moment = beta2 * second_moments[idx] + (1.0f - beta2) * gradient * gradient;
+				first_moments[idx] = first_moment;
+				second_moments[idx] = second_moment;
+				weight -= hyperparameters[LEARNING_RATE * n_models + model] * first_moment / (sycl::sqrt(second_moment) + hyperparameters[EPSILON * n_models + model]);
+			}
+			else {
+				weight -= hyperparameters[LEARNING_RATE * n_models + model] * gradient;
+			}
+
+			master_weights[idx] = weight;
+			weights[offset + toPackedWeightCoord(unpacked_idx, WIDTH, output_width, n_hidden_layers, false)] = (bf16)weight;
+			weightsT[offset + toPackedWeightCoord(unpacked_idx, WIDTH, output_width, n_hidden_layers, true)] = (bf16)weight;
+			}).wait();
+		m_master_weights_version = ++m_group->m_weights_version;
+
+		if (m_dynamic_loss_scaling) {
+			update_loss_scales(q);
+		}
+	}
+
+	// Get the mean loss of every model at the last training step
+	std::vector<float> get_model_losses() {
+		std::vector<float> model_losses(m_model_losses.size());
+		m_model_losses.copy_to_host(model_losses, m_group->get_queue());
+		return model_losses;
+	}
+
+	void initialize_params() {
+		m_group->initialize_params();
+	}
+
+	void free_mem(queue q) {
+		m_hyperparameters.free_mem(q);
+		m_master_weights.free_mem(q);
+		m_model_losses.free_mem(q);
+		if (m_first_moments.size() > 0) {
+			m_first_moments.free_mem(q);
+			m_second_moments.free_mem(q);
+		}
+		if (m_loss_scaler.size() > 0) {
+			m_loss_scaler.free_mem(q);
+		}
+	}
+
+	SwiftNetMLPGroup<WIDTH>* m_group;
+	Loss* m_loss;
+
+private:
+	// Unpack the bf16 weights of the models into the master weights, after they have been set or initialized outside of a step
+	void update_master_weights(queue q) {
+		float* master_weights = m_master_weights.data();
+		const bf16* weights = m_group->get_weights_matrices()->data();
+		const int n_params = m_group->get_n_params_per_model();
+		const int output_width = m_group->get_output_width();
+		const int n_hidden_layers = m_group->get_n_hidden_layers();
+
+		q.parallel_for<>(range<1>(m_master_weights.size()), [=](id<1> idx) {
+			const int offset = (idx / n_params) * n_params;
+			master_weights[idx] = (float)weights[offset + toPackedWeightCoord(idx % n_params, WIDTH, output_width, n_hidden_layers, false)];
+			}).wait();
+		m_master_weights_version = m_group->m_weights_version;
+	}
+
+	// Update the dynamic loss scale of every model after a step and clear their non-finite flags
+	void update_loss_scales(queue q) {
+		float* p_scaler = m_loss_scaler.data();
+		const float growth_interval = (float)m_loss_scale_growth_interval;
+		const float growth_factor = m_loss_scale_growth_factor;
+		const float backoff_factor = m_loss_scale_backoff_factor;
+
+		q.parallel_for<>(range<1>(m_group->get_n_models()), [=](id<1> idx) {
+			const int model = idx;
+			float* state = p_scaler + model * N_LOSS_SCALER_STATES;
+			if (state[FOUND_NON_FINITE] != 0.0f) {
+				state[SCALE] *= backoff_factor;
+				state[N_CLEAN_STEPS] = 0.0f;
+				state[FOUND_NON_FINITE] = 0.0f;
+			}
+			else if (++state[N_CLEAN_STEPS] >= growth_interval) {
+				state[SCALE] *= growth_factor;
+				state[N_CLEAN_STEPS] = 0.0f;
+			}
+			}).wait();
+	}
+
+	BatchedOptimizer m_optimizer;
+
+	// Hyperparameters of the models, each one is stored for all the models before the next one
+	enum Hyperparameter { LEARNING_RATE = 0, L2_REG = 1, BETA1 = 2, BETA2 = 3, EPSILON = 4, N_HYPERPARAMETERS = 5 };
+	DeviceMem<float> m_hyperparameters;
+	std::vector<float> m_hyperparameters_host;
+
+	DeviceMem<float> m_master_weights;
+	uint64_t m_master_weights_version = UINT64_MAX;
+	DeviceMem<float> m_model_losses;
+
+	// fp32 Adam moments of all the models, in the unpacked layout of the gradients
+	DeviceMem<float> m_first_moments;
+	DeviceMem<float> m_second_moments;
+
+	// Dynamic loss scaling, the state of every model lives on the device
+	enum LossScalerState { SCALE = 0, N_CLEAN_STEPS = 1, FOUND_NON_FINITE = 2, N_LOSS_SCALER_STATES = 3 };
+	bool m_dynamic_loss_scaling = false;
+	int m_loss_scale_growth_interval = 2000;
+	float m_loss_scale_growth_factor = 2.0f;
+	float m_loss_scale_backoff_factor = 0.5f;
+	DeviceMem<float> m_loss_scaler;
+};
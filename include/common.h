@@ -32,3 +32,35 @@ extern SYCL_EXTERNAL int fromPackedLayoutCoord(int idx, int rows, int cols);
  * @return True if the strings are equal, false otherwise
  */
 extern SYCL_EXTERNAL bool isequalstring(const std::string& str1, const std::string& str2);
+
+/**
+ * @brief Check if a layer is kept in the forward activation storage when checkpointing
+ *
+ * @param layer Index of the layer (0 is the input, i is the output of the i-th weight matrix)
+ * @param checkpoint_interval Number of layers between two stored layers
+ * @param n_hidden_matrices Number of hidden matrices of the network
+ * @return True if the layer is stored, false if it is recomputed in the backward pass
+ */
+extern SYCL_EXTERNAL bool isCheckpointLayer(int layer, int checkpoint_interval, int n_hidden_matrices);
+
+/**
+ * @brief Get the slot of a stored layer in the forward activation storage when checkpointing
+ *
+ * @param layer Index of the layer (0 is the input, i is the output of the i-th weight matrix)
+ * @param checkpoint_interval Number of layers between two stored layers
+ * @param n_hidden_matrices Number of hidden matrices of the network
+ * @return Index of the layer in the forward activation storage
+ */
+extern SYCL_EXTERNAL int checkpointSlot(int layer, int checkpoint_interval, int n_hidden_matrices);
+
+/**
+ * @brief Get the position of a weight in the packed weights from its position in the unpacked weights
+ *
+ * @param idx Index in the unpacked weights (matrices one after the other in row-major order, like the gradients)
+ * @param width Width of the layers
+ * @param output_width Width of the output layer
+ * @param n_hidden_layers Number of width x width matrices before the output matrix
+ * @param transposed True for the packed transposed weights
+ * @return Index in the packed (transposed) weights
+ */
+extern SYCL_EXTERNAL int toPackedWeightCoord(int idx, int width, int output_width, int n_hidden_layers, bool transposed);
@@ -13,6 +13,11 @@
 #include "cross_entropy.h"
 #include "adam.h"
 #include "sgd.h"
+#include "HashGridEncoding.h"
+#include "FrequencyEncoding.h"
+#include "OneBlobEncoding.h"
+#include "SphericalHarmonicsEncoding.h"
+#include "EmbeddingBagEncoding.h"
 #include "json.hpp"
 
 using json = nlohmann::json;
@@ -39,16 +44,35 @@ Activation string_to_activation(const std::string& activation_name) {
 	throw std::runtime_error{"Invalid activation name:}"};
 }
 
+Precision string_to_precision(const std::string& precision_name) {
+	if (isequalstring(precision_name, "bf16")) {
+		return Precision::BFloat16;
+	}
+	else if (isequalstring(precision_name, "fp16")) {
+		return Precision::Half;
+	}
+	else if (isequalstring(precision_name, "fp32")) {
+		return Precision::Float;
+	}
+	else if (isequalstring(precision_name, "tf32")) {
+		return Precision::TF32;
+	}
+	throw std::runtime_error{"Invalid precision name: " + precision_name};
+}
+
+// Model trained in the element type T, bf16 or sycl::half for the fp16 training
+template <typename T = bf16>
 struct TrainableModel {
 	queue m_q;
 	Loss* loss;
 	Optimizer* optimizer;
-	Network* network;
-	Trainer trainer;
+	Network<T>* network;
+	Trainer<T> trainer;
 };
 
 
-TrainableModel create_from_config(
+template <typename T = bf16>
+TrainableModel<T> create_from_config(
 	queue q,
 	json config
 ) {
@@ -57,9 +81,13 @@ TrainableModel create_from_config(
 	std::string optimizer_type = config.value("optimizer", json::object()).value("otype", "sgd");
 	const int WIDTH = config.value("network", json::object()).value("n_neurons", 64);
 
+	// The optimizer rebuilds the packed weights of the network, it takes their shape from the network config
+	const int n_output_dims = config.value("network", json::object()).value("n_output_dims", WIDTH);
+	const int n_hidden_layers = config.value("network", json::object()).value("n_hidden_layers", 2);
+
 	Loss* loss;
 	Optimizer* optimizer;
-	Network* network;
+	Network<T>* network;
 
 	if (isequalstring(loss_type, "L2")) {
 		loss = new L2Loss();
@@ -81,24 +109,77 @@ TrainableModel create_from_config(
 	}
 
 	if (isequalstring(optimizer_type, "Adam")) {
-		optimizer = new AdamOptimizer();
+		std::string moments_precision = config.value("optimizer", json::object()).value("moments_precision", "float");
+		MomentsPrecision precision = MomentsPrecision::Float;
+		if (isequalstring(moments_precision, "bf16")) {
+			precision = MomentsPrecision::BFloat16;
+		}
+		else if (isequalstring(moments_precision, "int8")) {
+			precision = MomentsPrecision::Int8Blockwise;
+		}
+		else if (!isequalstring(moments_precision, "float")) {
+			throw std::runtime_error{"Invalid Adam moments precision: " + moments_precision};
+		}
+		optimizer = new AdamOptimizer(n_output_dims, n_hidden_layers, config.value("optimizer", json::object()).value("learning_rate", 1e-3f), config.value("optimizer", json::object()).value("l2_reg", 1e-8f), precision);
 	}
 
 	else if (isequalstring(optimizer_type, "SGD")) {
-		optimizer = new SGDOptimizer(config.value("optimizer", json::object()).value("output_width", 64), config.value("optimizer", json::object()).value("n_hidden_layer", 2), config.value("optimizer", json::object()).value("learning_rate", 1e-3f), config.value("optimizer", json::object()).value("l2_reg", 1e-8f));
+		optimizer = new SGDOptimizer(n_output_dims, n_hidden_layers, config.value("optimizer", json::object()).value("learning_rate", 1e-3f), config.value("optimizer", json::object()).value("l2_reg", 1e-8f));
 	}
 	else {
 		throw std::runtime_error{"Invalid optimizer type: "};
 	}
 
+	// The model is trained in its element type, the precision of the config has to match it (bf16 or fp16).
+	// The network is then built without an inference-only precision
+	const Precision training_precision = std::is_same<T, bf16>::value ? Precision::BFloat16 : Precision::Half;
+	if (string_to_precision(config.value("network", json::object()).value("precision", std::is_same<T, bf16>::value ? "bf16" : "fp16")) != training_precision) {
+		throw std::runtime_error{"The precision of the config does not match the element type of the model, construct the SwiftNetMLP directly for an fp32 inference."};
+	}
+
 	switch (WIDTH) {
-	case  64:  network = new SwiftNetMLP<64>(q, config.value("network", json::object()).value("n_input_dims", 64), config.value("network", json::object()).value("n_output_dims", 64), config.value("network", json::object()).value("n_hidden_layers", 2), string_to_activation(config.value("network", json::object()).value("activation", "ReLU")), string_to_activation(config.value("network", json::object()).value("output_activation", "None")), config.value("network", json::object()).value("batch_size", 8192));
+	case  64:  network = new SwiftNetMLP<64, T>(q, config.value("network", json::object()).value("n_input_dims", 64), n_output_dims, n_hidden_layers, string_to_activation(config.value("network", json::object()).value("activation", "ReLU")), string_to_activation(config.value("network", json::object()).value("output_activation", "None")), config.value("network", json::object()).value("batch_size", 8192), config.value("network", json::object()).value("checkpoint_interval", 1), Precision::BFloat16);
 		break;
-	case 128:  network = new SwiftNetMLP<128>(q, config.value("network", json::object()).value("n_input_dims", 128), config.value("network", json::object()).value("n_output_dims", 128), config.value("network", json::object()).value("n_hidden_layers", 2), string_to_activation(config.value("network", json::object()).value("activation", "ReLU")), string_to_activation(config.value("network", json::object()).value("output_activation", "None")), config.value("network", json::object()).value("batch_size", 8192));
+	case 128:  network = new SwiftNetMLP<128, T>(q, config.value("network", json::object()).value("n_input_dims", 128), n_output_dims, n_hidden_layers, string_to_activation(config.value("network", json::object()).value("activation", "ReLU")), string_to_activation(config.value("network", json::object()).value("output_activation", "None")), config.value("network", json::object()).value("batch_size", 8192), config.value("network", json::object()).value("checkpoint_interval", 1), Precision::BFloat16);
 		break;
 	default: throw std::runtime_error{"SwiftNetMLP only supports 64, and 128 neurons, but got ..."};
 	}
-	auto trainer = Trainer(*network, *loss, *optimizer);
+
+	// Input encoding computed in the forward kernel, trained with the network through training_step on positions
+	if (config.contains("encoding")) {
+		json encoding_config = config.value("encoding", json::object());
+		std::string encoding_type = encoding_config.value("otype", "HashGrid");
+		Encoding* encoding;
+		if (isequalstring(encoding_type, "HashGrid")) {
+			encoding = new HashGridEncoding(q, encoding_config.value("n_dims_to_encode", 3), encoding_config.value("n_levels", 16), encoding_config.value("n_features_per_level", 2), encoding_config.value("log2_hashmap_size", 19), encoding_config.value("base_resolution", 16.0f), encoding_config.value("per_level_scale", 2.0f), encoding_config.value("learning_rate", 1e-2f));
+		}
+		else if (isequalstring(encoding_type, "Frequency")) {
+			encoding = new FrequencyEncoding(encoding_config.value("n_dims_to_encode", 3), encoding_config.value("n_frequencies", 8));
+		}
+		else if (isequalstring(encoding_type, "OneBlob")) {
+			encoding = new OneBlobEncoding(encoding_config.value("n_dims_to_encode", 3), encoding_config.value("n_bins", 16));
+		}
+		else if (isequalstring(encoding_type, "SphericalHarmonics")) {
+			encoding = new SphericalHarmonicsEncoding(encoding_config.value("degree", 4));
+		}
+		else if (isequalstring(encoding_type, "EmbeddingBag")) {
+			encoding = new EmbeddingBagEncoding(q, encoding_config.value("n_embeddings", 1 << 16), encoding_config.value("n_features", 64), encoding_config.value("learning_rate", 1e-2f));
+		}
+		else {
+			throw std::runtime_error{"Invalid encoding type: " + encoding_type};
+		}
+		switch (WIDTH) {
+		case  64: static_cast<SwiftNetMLP<64, T>*>(network)->set_encoding(encoding); break;
+		case 128: static_cast<SwiftNetMLP<128, T>*>(network)->set_encoding(encoding); break;
+		}
+	}
+	auto trainer = Trainer<T>(*network, *loss, *optimizer, config.value("trainer", json::object()).value("n_micro_batches", 1));
+	if (config.value("trainer", json::object()).contains("ema_decay")) {
+		trainer.enable_weights_ema(config.value("trainer", json::object()).value("ema_decay", 0.99f));
+	}
+	if (config.value("trainer", json::object()).value("dynamic_loss_scaling", false)) {
+		trainer.enable_dynamic_loss_scaling(config.value("trainer", json::object()).value("initial_loss_scale", 65536.0f), config.value("trainer", json::object()).value("loss_scale_growth_interval", 2000));
+	}
 	return { m_q, loss, optimizer,network,  trainer };
 
 }
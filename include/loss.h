@@ -20,4 +20,16 @@ public:
 		DeviceMem<float>& values
 	) = 0;
 
+	// Same for the fp16 training, the gradients are written in the element type of the network
+	virtual void evaluate(
+		queue q,
+		const int dims,
+		const int stride,
+		const float scale,
+		DeviceMem<float>& pred,
+		DeviceMem<float>& target,
+		DeviceMem<sycl::half>& grads,
+		DeviceMem<float>& values
+	) = 0;
+
 };
@@ -5,10 +5,66 @@
 
 using bf16 = sycl::ext::oneapi::bfloat16;
 
+// Update the fp32 exponential moving average of a weight and write its packed copy, in the element type of the weights
+template <typename T>
+inline void ema_step(int idx, float weight, float decay, float* master_ema_weights, T* ema_weights, int packed_idx) {
+	const float ema_weight = decay * master_ema_weights[idx] + (1.0f - decay) * weight;
+	master_ema_weights[idx] = ema_weight;
+	ema_weights[packed_idx] = (T)ema_weight;
+}
+
 class Optimizer {
 public:
 	virtual ~Optimizer() {}
 
-	virtual void step(queue q, float loss_scale, DeviceMem<bf16>& weights, DeviceMem<bf16>& weightsT, DeviceMem<bf16>& gradients, int WIDTH)= 0;
+	virtual void step(queue q, float loss_scale, DeviceMem<bf16>& weights, DeviceMem<bf16>& weightsT, DeviceMem<float>& gradients, int WIDTH)= 0;
+
+	// Step of a network trained in fp16, the packed copies of the master weights are written in half
+	virtual void step(queue q, float loss_scale, DeviceMem<sycl::half>& weights, DeviceMem<sycl::half>& weightsT, DeviceMem<float>& gradients, int WIDTH) = 0;
+
+	// Reload the master weights from the packed weights at the next step, the trainer calls it when the weights changed outside of the steps
+	void reset_master_weights() {
+		m_master_weights_valid = false;
+	}
+
+	// Set a device flag which makes the steps skip the update when it is non zero (non-finite gradients)
+	void set_skip_flag(const float* skip_flag) {
+		m_skip_flag = skip_flag;
+	}
+
+	// Keep an exponential moving average of the weights, updated in the same pass as the weights and written packed to ema_weights
+	// Get the fp32 master weights (or their moving average), in the unpacked layout of the gradients
+	const float* get_master_weights(bool ema) const {
+		return ema ? m_master_ema_weights.data() : m_master_weights.data();
+	}
+
+	template <typename T>
+	void set_ema_weights(DeviceMem<T>* ema_weights, float decay) {
+		m_ema_weights = ema_weights;
+		m_ema_decay = decay;
+		m_master_weights_valid = false;
+	}
+
+protected:
+	// Copy the packed bf16 or fp16 weights into the master weights if they have been reset
+	template <typename T>
+	void update_master_weights(queue q, DeviceMem<T>& weights, int WIDTH, int output_width, int n_hidden_layers);
+
+	// Packed moving average given to set_ema_weights, its element type is the one of the weights given to the steps
+	template <typename T>
+	T* get_ema_weights() const {
+		return m_ema_weights ? static_cast<DeviceMem<T>*>(m_ema_weights)->data() : nullptr;
+	}
+
+	// fp32 master weights, in the unpacked layout of the gradients. The bf16 or fp16 weights are copies regenerated by each step
+	DeviceMem<float> m_master_weights;
+	bool m_master_weights_valid = false;
+
+	const float* m_skip_flag = nullptr;
 
+	// fp32 moving average of the weights (unpacked layout) and its packed copy read by the inference (a DeviceMem of the
+	// element type of the network)
+	DeviceMem<float> m_master_ema_weights;
+	void* m_ema_weights = nullptr;
+	float m_ema_decay = 0.99f;
 };
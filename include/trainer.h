@@ -4,67 +4,251 @@
 #include "loss.h"
 #include "Network.h"
 #include "optimizer.h"
+#include "Encoding.h"
 #include "L2.h"
 
+// Trainer of a network of element type T (bf16 or sycl::half), the loss gradients and the packed weights are in T
+template <typename T = bf16>
 class Trainer {
 public:
 
-	Trainer(Network& network, Loss& loss, Optimizer& optim) {
+	/**
+	 * Create a trainer.
+	 * With n_micro_batches > 1, each training step is one micro-batch: the weight gradients are accumulated
+	 * in fp32 and the optimizer step is applied once every n_micro_batches steps, on the gradients
+	 * normalized by the effective batch size. The micro-batches reuse the buffers of the network.
+	 *
+	 * @param network The network to train.
+	 * @param loss The loss function.
+	 * @param optim The optimizer.
+	 * @param n_micro_batches Number of micro-batches per optimizer step.
+	 */
+	Trainer(Network<T>& network, Loss& loss, Optimizer& optim, int n_micro_batches = 1) {
+		if (n_micro_batches < 1) {
+			throw std::runtime_error{"The number of micro-batches must be at least 1."};
+		}
 		m_network = &network;
 		m_loss = &loss;
 		m_optim = &optim;
+		m_n_micro_batches = n_micro_batches;
+		m_n_accumulated = 0;
+
+		if (m_n_micro_batches > 1) {
+			m_grads_accumulated.allocate(m_network->m_grads_matrices.size(), m_network->get_queue());
+			m_grads_accumulated.initialize_constant(0.0f, m_network->get_queue());
+		}
 	}
 
-	void training_step(DeviceMem<bf16>& input,
+	void training_step(DeviceMem<T>& input,
 		DeviceMem<float>& output,
 		DeviceMem<float>& target,
-		DeviceMem<bf16>& grads,
+		DeviceMem<T>& grads,
 		DeviceMem<float>& losses,
 		const float scale,
 		const int WIDTH) {
 		//const int input_size = input.size();
 		//const int batch_size = std::pow(2, 19);
 
-		auto p = m_network->m_forward;
-		m_network->get_queue().parallel_for<>(range<1>(input.size()), [=](id<1> idx) {
-			p[idx] = input.data()[idx];
-			});
+		// The inputs are the first stored activations of the backward pass
+		m_network->get_queue().memcpy(m_network->m_forward, input.data(), input.size() * sizeof(T)).wait();
 
 		m_network->forward_pass(input, m_network->m_forward, m_network->m_A_forward, m_network->m_B_forward, m_network->m_C_forward, output);
 
+		backward_and_update(input, output, target, grads, losses, scale, WIDTH);
+	}
+
+	// Training step on positions, encoded by the input encoding of the network in the forward kernel
+	void training_step(DeviceMem<float>& coords,
+		DeviceMem<float>& output,
+		DeviceMem<float>& target,
+		DeviceMem<T>& grads,
+		DeviceMem<float>& losses,
+		const float scale,
+		const int WIDTH) {
+		m_network->forward_pass_encoded(coords, output);
+
+		// The backward pass reads the encoded input stored by the forward pass
+		backward_and_update(DeviceMem<T>(), output, target, grads, losses, scale, WIDTH);
+	}
+
+	/**
+	 * Enable the dynamic loss scaling.
+	 * The loss gradients are multiplied by a scale kept on the device, on top of the scale given to training_step.
+	 * When a weight gradient is not finite the step is skipped and the scale is multiplied by backoff_factor,
+	 * after growth_interval clean steps it is multiplied by growth_factor. The host never waits for the check.
+	 *
+	 * @param initial_scale Initial dynamic loss scale.
+	 * @param growth_interval Number of clean steps before the scale grows.
+	 * @param growth_factor Factor applied to the scale when it grows.
+	 * @param backoff_factor Factor applied to the scale after a non-finite gradient.
+	 */
+	void enable_dynamic_loss_scaling(float initial_scale, int growth_interval, float growth_factor = 2.0f, float backoff_factor = 0.5f) {
+		queue q = m_network->get_queue();
+		std::vector<float> state = { initial_scale, 0.0f, 0.0f };
+
+		if (m_loss_scaler.size() == 0) {
+			m_loss_scaler.allocate(state.size(), q);
+		}
+		m_loss_scaler.copy_from_host(state, q);
+
+		m_dynamic_loss_scaling = true;
+		m_loss_scale_growth_interval = growth_interval;
+		m_loss_scale_growth_factor = growth_factor;
+		m_loss_scale_backoff_factor = backoff_factor;
+		m_optim->set_skip_flag(m_loss_scaler.data() + FOUND_NON_FINITE);
+	}
+
+	/**
+	 * Keep an exponential moving average of the weights for inference.
+	 * The optimizer updates it in the same pass as the weights, and the inference of the network reads it in place.
+	 *
+	 * @param decay Decay of the moving average.
+	 */
+	void enable_weights_ema(float decay) {
+		m_optim->set_ema_weights(&m_network->m_weights_matrices_inferences, decay);
+		m_network->m_inference_uses_ema = true;
+	}
+
+	// Get the current dynamic loss scale (reads it back from the device)
+	float get_loss_scale() {
+		if (!m_dynamic_loss_scaling) {
+			return 1.0f;
+		}
+		std::vector<float> state(m_loss_scaler.size());
+		m_loss_scaler.copy_to_host(state, m_network->get_queue());
+		return state[SCALE];
+	}
+
+	Network<T>* m_network;
+	Loss* m_loss;
+	Optimizer* m_optim;
+
+	void initialize_params() {
+		m_network->initialize_params();
+	}
+
+private:
+	// Loss, backward pass and optimizer step after the forward pass of a training step
+	void backward_and_update(const DeviceMem<T>& input,
+		DeviceMem<float>& output,
+		DeviceMem<float>& target,
+		DeviceMem<T>& grads,
+		DeviceMem<float>& losses,
+		const float scale,
+		const int WIDTH) {
 		m_loss->evaluate(m_network->get_queue(), WIDTH, WIDTH, scale, output, target, grads, losses);
 
+		queue q = m_network->get_queue();
+		float* p_scaler = m_dynamic_loss_scaling ? m_loss_scaler.data() : nullptr;
+
+		// Apply the dynamic loss scale on top of the static one, it is read on the device
+		if (m_dynamic_loss_scaling) {
+			T* p_loss_grads = grads.data();
+			q.parallel_for<>(range<1>(grads.size()), [=](id<1> idx) {
+				p_loss_grads[idx] = (T)((float)p_loss_grads[idx] * p_scaler[SCALE]);
+				}).wait();
+		}
+
 		m_network->backward_pass(input,
 			grads,
 			m_network->m_out_inter,
 			m_network->m_deltas_temp,
 			m_network->m_deltas,
-			m_network->m_A_backward,
-			m_network->m_B_backward,
-			m_network->m_C_backward,
-			m_network->m_A_backward_last_layer,
 			m_network->m_B_backward_last_layer,
 			m_network->m_C_backward_last_layer,
-			m_network->m_D_backward_last_layer,
-			m_network->m_E_backward_last_layer,
-			m_network->m_F_backward_last_layer,
-			m_network->m_A_dgemm,
-			m_network->m_B_dgemm,
-			m_network->m_C_dgemm,
 			m_network->m_forward);
 
-		m_optim->step(m_network->get_queue(), scale, m_network->m_weights_matrices, m_network->m_weightsT_matrices, m_network->m_grads_matrices, WIDTH);
+		float* p_grads = m_network->m_grads_matrices.data();
+		float* p_summed = p_grads;
+		const int n_grads = m_network->m_grads_matrices.size();
+		float batch_size = (float)m_network->get_batch_size();
+
+		if (m_n_micro_batches > 1) {
+			// Accumulate the summed gradients of the micro-batch
+			float* p_acc = m_grads_accumulated.data();
+			q.parallel_for<>(range<1>(n_grads), [=](id<1> idx) {
+				p_acc[idx] += p_grads[idx];
+				}).wait();
+
+			if (++m_n_accumulated < m_n_micro_batches) {
+				return;
+			}
 
+			// Normalize once by the effective batch size
+			p_summed = p_acc;
+			batch_size *= m_n_micro_batches;
+			m_n_accumulated = 0;
+		}
 
+		// Normalize gradients, remove the dynamic loss scale and flag the non-finite values in one pass
+		const bool reset_summed = (p_summed != p_grads);
+		q.parallel_for<>(range<1>(n_grads), [=](id<1> idx) {
+			float gradient = p_summed[idx] / batch_size;
+			if (reset_summed) {
+				p_summed[idx] = 0.0f;
+			}
+			if (p_scaler) {
+				gradient /= p_scaler[SCALE];
+				if (!sycl::isfinite(gradient)) {
+					sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> flag(p_scaler[FOUND_NON_FINITE]);
+					flag.store(1.0f);
+				}
+			}
+			p_grads[idx] = gradient;
+			}).wait();
+
+		// The master weights are reloaded when the weights changed outside of the steps (initialization, load_from_file)
+		if (m_master_weights_version != m_network->m_weights_version) {
+			m_optim->reset_master_weights();
+		}
+
+		// The optimizer skips the step by itself when a non-finite gradient was flagged
+		m_optim->step(q, scale, m_network->m_weights_matrices, m_network->m_weightsT_matrices, m_network->m_grads_matrices, WIDTH);
+		m_master_weights_version = ++m_network->m_weights_version;
+		m_network->m_master_weights = m_optim->get_master_weights(m_network->m_inference_uses_ema);
+
+		// The parameters of the input encoding are trained with their own step, skipped along with the network's
+		if (m_network->m_encoding) {
+			m_network->m_encoding->step(q, 1.0f / (batch_size * scale), p_scaler ? p_scaler + SCALE : nullptr, p_scaler ? p_scaler + FOUND_NON_FINITE : nullptr);
+		}
+
+		if (m_dynamic_loss_scaling) {
+			update_loss_scale(q);
+		}
 	}
-	Network* m_network;
-	Loss* m_loss;
-	Optimizer* m_optim;
 
-	void initialize_params() {
-		m_network->initialize_params();
+	// Update the dynamic loss scale on the device after a step and clear the non-finite flag
+	void update_loss_scale(queue q) {
+		float* p_scaler = m_loss_scaler.data();
+		const float growth_interval = (float)m_loss_scale_growth_interval;
+		const float growth_factor = m_loss_scale_growth_factor;
+		const float backoff_factor = m_loss_scale_backoff_factor;
+
+		q.single_task<>([=]() {
+			if (p_scaler[FOUND_NON_FINITE] != 0.0f) {
+				p_scaler[SCALE] *= backoff_factor;
+				p_scaler[N_CLEAN_STEPS] = 0.0f;
+				p_scaler[FOUND_NON_FINITE] = 0.0f;
+			}
+			else if (++p_scaler[N_CLEAN_STEPS] >= growth_interval) {
+				p_scaler[SCALE] *= growth_factor;
+				p_scaler[N_CLEAN_STEPS] = 0.0f;
+			}
+			}).wait();
 	}
 
-private:
+	int m_n_micro_batches;
+	int m_n_accumulated;
+	DeviceMem<float> m_grads_accumulated;
+
+	// Weights version of the network when the optimizer last wrote it, the master weights are stale when it moved
+	uint64_t m_master_weights_version = UINT64_MAX;
 
+	// Dynamic loss scaling, its state lives on the device
+	enum LossScalerState { SCALE = 0, N_CLEAN_STEPS = 1, FOUND_NON_FINITE = 2 };
+	bool m_dynamic_loss_scaling = false;
+	int m_loss_scale_growth_interval = 2000;
+	float m_loss_scale_growth_factor = 2.0f;
+	float m_loss_scale_backoff_factor = 0.5f;
+	DeviceMem<float> m_loss_scaler;
 };
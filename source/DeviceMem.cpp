@@ -466,3 +466,7 @@ void DeviceMem<T>::intitialize_he_normal(int input_width, queue q) {
 
 template class DeviceMem<float>;
 template class DeviceMem<bf16>;
+template class DeviceMem<int8_t>;
+template class DeviceMem<uint8_t>;
+template class DeviceMem<sycl::half>;
+template class DeviceMem<int>;
@@ -0,0 +1,193 @@
+#include "EmbeddingBagEncoding.h"
+
+/**
+ * Sum the features of one item over the embeddings of the bag of a row.
+ *
+ * @param params   Parameters of the encoding.
+ * @param row      Index of the row in the batch.
+ * @param item     Item of the encoding, the features item * n_features_per_item onwards of the embeddings.
+ * @param features The n_features_per_item summed features.
+ */
+void embedding_bag_encode_item(const EncodingParams& params, int row, int item, float* features) {
+	const int n_features = params.n_items * params.n_features_per_item;
+	const int begin = params.offsets[row];
+	const int end = params.offsets[row + 1];
+
+	for (int f = 0; f < params.n_features_per_item; f++) {
+		features[f] = 0.0f;
+	}
+	for (int i = begin; i < end; i++) {
+		const float* embedding = params.tables + (size_t)params.indices[i] * n_features + item * params.n_features_per_item;
+		for (int f = 0; f < params.n_features_per_item; f++) {
+			features[f] += embedding[f];
+		}
+	}
+}
+
+/**
+ * Constructor of an embedding bag encoding.
+ *
+ * @param q             SYCL queue for command submission.
+ * @param n_embeddings  Number of rows of the table (vocabulary size).
+ * @param n_features    Number of features of an embedding.
+ * @param learning_rate Learning rate of the Adam step on the table.
+ */
+EmbeddingBagEncoding::EmbeddingBagEncoding(queue q, int n_embeddings, int n_features, float learning_rate) {
+	m_q = q;
+	m_n_embeddings = n_embeddings;
+	m_learning_rate = learning_rate;
+
+	// The features of an embedding are summed by items of up to ENCODING_MAX_FEATURES
+	int n_features_per_item = ENCODING_MAX_FEATURES;
+	while (n_features % n_features_per_item != 0) {
+		n_features_per_item /= 2;
+	}
+	m_params.type = EncodingType::EmbeddingBag;
+	m_params.n_dims = 0;
+	m_params.n_items = n_features / n_features_per_item;
+	m_params.n_features_per_item = n_features_per_item;
+
+	m_table.allocate(n_embeddings * n_features, q);
+	m_table_grads.allocate(n_embeddings * n_features, q);
+	m_first_moments.allocate(n_embeddings * n_features, q);
+	m_second_moments.allocate(n_embeddings * n_features, q);
+	m_used.allocate(n_embeddings, q);
+	m_used_rows.allocate(n_embeddings, q);
+	m_n_used_rows.allocate(1, q);
+	m_params.tables = m_table.data();
+	m_params.table_grads = m_table_grads.data();
+
+	initialize_params();
+}
+
+void EmbeddingBagEncoding::set_bags(const DeviceMem<int>& indices, const DeviceMem<int>& offsets) {
+	m_params.indices = indices.data();
+	m_params.offsets = offsets.data();
+	m_n_indices = indices.size();
+}
+
+// Initialize the table with small uniform values and restart the Adam moments
+void EmbeddingBagEncoding::initialize_params() {
+	m_table.initialize_uniform(m_q, 1e-2);
+	m_table_grads.initialize_constant(0.0f, m_q);
+	m_first_moments.initialize_constant(0.0f, m_q);
+	m_second_moments.initialize_constant(0.0f, m_q);
+	m_used.initialize_constant(0, m_q);
+	m_n_used_rows.initialize_constant(0, m_q);
+	m_max_used_rows = 0;
+	m_n_steps = 0;
+}
+
+/**
+ * Scatter-add the gradients of the encoded features to the rows of the table of the bags, one work item per
+ * (row, feature). The rows used for the first time since the last step are appended to the list of used rows,
+ * which holds every row of the table: the backward passes of several micro-batches can run before a step.
+ *
+ * @param q           SYCL queue for command submission.
+ * @param coords      Unused, the encoding has no positions.
+ * @param dL_dencoded Gradients of the encoded features, the first get_n_output_dims() values of each row are read.
+ * @param batch_size  Number of rows.
+ * @param stride      Number of values per row of dL_dencoded.
+ * @param dL_dcoords  Unused, the encoding has no positions.
+ */
+void EmbeddingBagEncoding::backward(queue q, const float* coords, const float* dL_dencoded, int batch_size, int stride, float* dL_dcoords) {
+	const int n_features = get_n_output_dims();
+	const int* indices = m_params.indices;
+	const int* offsets = m_params.offsets;
+	float* table_grads = m_table_grads.data();
+	int* used = m_used.data();
+	int* used_rows = m_used_rows.data();
+	int* n_used_rows = m_n_used_rows.data();
+
+	// At most one new used row per index
+	m_max_used_rows = std::min(m_max_used_rows + m_n_indices, m_n_embeddings);
+
+	q.parallel_for<>(range<1>(batch_size * n_features), [=](id<1> idx) {
+		const int row = idx / n_features;
+		const int f = idx % n_features;
+		const float gradient = dL_dencoded[row * stride + f];
+
+		for (int i = offsets[row]; i < offsets[row + 1]; i++) {
+			const int embedding = indices[i];
+			sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> grad(table_grads[(size_t)embedding * n_features + f]);
+			grad.fetch_add(gradient);
+
+			if (f == 0) {
+				sycl::atomic_ref<int, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> flag(used[embedding]);
+				if (flag.exchange(1) == 0) {
+					sycl::atomic_ref<int, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> count(*n_used_rows);
+					used_rows[count.fetch_add(1)] = embedding;
+				}
+			}
+		}
+		}).wait();
+}
+
+/**
+ * Lazy Adam step on the used rows of the table: the moments of the other rows are left as they are.
+ *
+ * @param q             SYCL queue for command submission.
+ * @param normalization Factor applied to the summed gradients (inverse of the batch size and the loss scale).
+ * @param dynamic_scale Device pointer to the dynamic loss scale, or nullptr.
+ * @param skip_flag     Device flag which skips the step when it is non zero, or nullptr.
+ */
+void EmbeddingBagEncoding::step(queue q, float normalization, const float* dynamic_scale, const float* skip_flag) {
+	const float beta1 = 0.9f;
+	const float beta2 = 0.999f;
+	const float epsilon = 1e-8f;
+
+	m_n_steps++;
+	const float learning_rate = m_learning_rate * std::sqrt(1.0f - std::pow(beta2, (float)m_n_steps)) / (1.0f - std::pow(beta1, (float)m_n_steps));
+
+	const int n_features = get_n_output_dims();
+	float* table = m_table.data();
+	float* table_grads = m_table_grads.data();
+	float* first_moments = m_first_moments.data();
+	float* second_moments = m_second_moments.data();
+	int* used = m_used.data();
+	const int* used_rows = m_used_rows.data();
+	const int* n_used_rows = m_n_used_rows.data();
+
+	// The number of used rows stays on the device, the step is launched for the largest possible number
+	if (m_max_used_rows == 0) {
+		return;
+	}
+	q.parallel_for<>(range<1>(m_max_used_rows * n_features), [=](id<1> idx) {
+		if (idx / n_features >= *n_used_rows) {
+			return;
+		}
+		const int embedding = used_rows[idx / n_features];
+		const size_t p = (size_t)embedding * n_features + idx % n_features;
+		if (idx % n_features == 0) {
+			used[embedding] = 0;
+		}
+
+		float gradient = table_grads[p] * normalization;
+		table_grads[p] = 0.0f;
+		if (skip_flag != nullptr && *skip_flag != 0.0f) {
+			return;
+		}
+		if (dynamic_scale != nullptr) {
+			gradient /= *dynamic_scale;
+		}
+
+		const float first_moment = beta1 * first_moments[p] + (1.0f - beta1) * gradient;
+		const float second_moment = beta2 * second_moments[p] + (1.0f - beta2) * gradient * gradient;
+		first_moments[p] = first_moment;
+		second_moments[p] = second_moment;
+		table[p] -= learning_rate * first_moment / (sycl::sqrt(second_moment) + epsilon);
+		}).wait();
+
+	m_n_used_rows.initialize_constant(0, q);
+	m_max_used_rows = 0;
+}
+
+void EmbeddingBagEncoding::free_mem(queue q) {
+	m_table.free_mem(q);
+	m_table_grads.free_mem(q);
+	m_first_moments.free_mem(q);
+	m_second_moments.free_mem(q);
+	m_used.free_mem(q);
+	m_used_rows.free_mem(q);
+	m_n_used_rows.free_mem(q);
+}
@@ -0,0 +1,72 @@
+#include "Encoding.h"
+#include "HashGridEncoding.h"
+#include "FrequencyEncoding.h"
+#include "OneBlobEncoding.h"
+#include "SphericalHarmonicsEncoding.h"
+#include "EmbeddingBagEncoding.h"
+
+/**
+ * Compute the features of one item of an encoding at a position, dispatched on the type of the encoding.
+ *
+ * @param params   Parameters of the encoding.
+ * @param coords   Position, n_dims floats.
+ * @param row      Index of the position in the batch.
+ * @param item     Item of the encoding, in [0, n_items).
+ * @param features The n_features_per_item features of the item.
+ */
+void encode_item(const EncodingParams& params, const float* coords, int row, int item, float* features) {
+	switch (params.type) {
+	case EncodingType::HashGrid: hashgrid_encode_level(params, coords, item, features); break;
+	case EncodingType::Frequency: frequency_encode_item(params, coords, item, features); break;
+	case EncodingType::OneBlob: one_blob_encode_item(params, coords, item, features); break;
+	case EncodingType::SphericalHarmonics: spherical_harmonics_encode_item(params, coords, item, features); break;
+	case EncodingType::EmbeddingBag: embedding_bag_encode_item(params, row, item, features); break;
+	default: break;
+	}
+}
+
+/**
+ * Backpropagate the gradients of the features of one item of an encoding, dispatched on the type of the encoding.
+ *
+ * @param params       Parameters of the encoding.
+ * @param coords       Position, n_dims floats.
+ * @param row          Index of the position in the batch.
+ * @param item         Item of the encoding, in [0, n_items).
+ * @param dL_dfeatures Gradients of the n_features_per_item features of the item.
+ * @param dL_dcoords   Gradients of the position, added atomically, or nullptr.
+ */
+void encode_item_backward(const EncodingParams& params, const float* coords, int row, int item, const float* dL_dfeatures, float* dL_dcoords) {
+	switch (params.type) {
+	case EncodingType::HashGrid: hashgrid_backward_level(params, coords, item, dL_dfeatures, dL_dcoords); break;
+	case EncodingType::Frequency: frequency_encode_item_backward(params, coords, item, dL_dfeatures, dL_dcoords); break;
+	case EncodingType::OneBlob: one_blob_encode_item_backward(params, coords, item, dL_dfeatures, dL_dcoords); break;
+	case EncodingType::SphericalHarmonics: spherical_harmonics_encode_item_backward(params, coords, item, dL_dfeatures, dL_dcoords); break;
+	default: break;
+	}
+}
+
+/**
+ * Backpropagate the gradients of the encoded features of a batch, one work item per (row, item) pair.
+ *
+ * @param q           SYCL queue for command submission.
+ * @param coords      Positions of the batch, n_dims floats per row.
+ * @param dL_dencoded Gradients of the encoded features, the first get_n_output_dims() values of each row are read.
+ * @param batch_size  Number of rows.
+ * @param stride      Number of values per row of dL_dencoded.
+ * @param dL_dcoords  Gradients of the positions, n_dims floats per row, or nullptr.
+ */
+void Encoding::backward(queue q, const float* coords, const float* dL_dencoded, int batch_size, int stride, float* dL_dcoords) {
+	const EncodingParams params = m_params;
+	const int n_items = m_params.n_items;
+
+	// The items of a row add to the same gradients of the position
+	if (dL_dcoords) {
+		q.memset(dL_dcoords, 0, batch_size * params.n_dims * sizeof(float)).wait();
+	}
+
+	q.parallel_for<>(range<1>(batch_size * n_items), [=](id<1> idx) {
+		const int row = idx / n_items;
+		const int item = idx % n_items;
+		encode_item_backward(params, coords + row * params.n_dims, row, item, dL_dencoded + row * stride + item * params.n_features_per_item, dL_dcoords ? dL_dcoords + row * params.n_dims : nullptr);
+		}).wait();
+}
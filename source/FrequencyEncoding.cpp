@@ -0,0 +1,54 @@
+#include "FrequencyEncoding.h"
+
+/**
+ * Compute sin(2^k pi x) and cos(2^k pi x) for one frequency k of one dimension x.
+ *
+ * @param params   Parameters of the encoding.
+ * @param coords   Position, n_dims floats.
+ * @param item     Dimension * n_frequencies + frequency.
+ * @param features The sine and the cosine.
+ */
+void frequency_encode_item(const EncodingParams& params, const float* coords, int item, float* features) {
+	const int n_frequencies = params.n_items / params.n_dims;
+	const float x = coords[item / n_frequencies] * sycl::exp2((float)(item % n_frequencies)) * (float)M_PI;
+	features[0] = sycl::sin(x);
+	features[1] = sycl::cos(x);
+}
+
+/**
+ * Add the gradient of one dimension through its sine and cosine at one frequency.
+ *
+ * @param params       Parameters of the encoding.
+ * @param coords       Position, n_dims floats.
+ * @param item         Dimension * n_frequencies + frequency.
+ * @param dL_dfeatures Gradients of the sine and the cosine.
+ * @param dL_dcoords   Gradients of the position, or nullptr.
+ */
+void frequency_encode_item_backward(const EncodingParams& params, const float* coords, int item, const float* dL_dfeatures, float* dL_dcoords) {
+	if (!dL_dcoords) {
+		return;
+	}
+	const int n_frequencies = params.n_items / params.n_dims;
+	const int dim = item / n_frequencies;
+	const float frequency = sycl::exp2((float)(item % n_frequencies)) * (float)M_PI;
+	const float x = coords[dim] * frequency;
+
+	sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> grad(dL_dcoords[dim]);
+	grad.fetch_add(frequency * (dL_dfeatures[0] * sycl::cos(x) - dL_dfeatures[1] * sycl::sin(x)));
+}
+
+/**
+ * Constructor of a frequency encoding.
+ *
+ * @param n_dims        Number of dimensions of the positions.
+ * @param n_frequencies Number of frequencies per dimension, the encoding has n_dims * n_frequencies * 2 features.
+ */
+FrequencyEncoding::FrequencyEncoding(int n_dims, int n_frequencies) {
+	if (n_dims < 1 || n_dims > ENCODING_MAX_DIMS) {
+		throw std::runtime_error{"The frequency encoding supports 1 to 3 dimensions."};
+	}
+	m_params.type = EncodingType::Frequency;
+	m_params.n_dims = n_dims;
+	m_params.n_items = n_dims * n_frequencies;
+	m_params.n_features_per_item = 2;
+}
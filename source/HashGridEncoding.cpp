@@ -0,0 +1,271 @@
+#include "HashGridEncoding.h"
+
+/**
+ * Get the index in the table of a level of a grid point.
+ * The coarse levels whose grid fits in the table are indexed densely, the others are hashed by XOR-ing the
+ * coordinates multiplied by large primes.
+ *
+ * @param params     Parameters of the encoding.
+ * @param pos        Integer coordinates of the grid point.
+ * @param resolution Number of cells per dimension of the level.
+ * @return           Index of the grid point in the table of the level.
+ */
+uint32_t hashgrid_index(const EncodingParams& params, const uint32_t* pos, uint32_t resolution) {
+	const uint32_t primes[ENCODING_MAX_DIMS] = { 1u, 2654435761u, 805459861u };
+
+	uint32_t stride = 1;
+	uint32_t index = 0;
+	for (int d = 0; d < params.n_dims && stride <= params.table_size; d++) {
+		index += pos[d] * stride;
+		stride *= resolution + 1;
+	}
+	if (stride <= params.table_size) {
+		return index;
+	}
+
+	index = 0;
+	for (int d = 0; d < params.n_dims; d++) {
+		index ^= pos[d] * primes[d];
+	}
+	return index % params.table_size;
+}
+
+/**
+ * Get the scale from a position in [0, 1] to the grid coordinates of a level.
+ *
+ * @param params     Parameters of the encoding.
+ * @param level      Level of the grid.
+ * @return           Derivative of the grid coordinates with respect to the position.
+ */
+float hashgrid_scale(const EncodingParams& params, int level) {
+	return sycl::exp2(level * params.log2_per_level_scale) * params.base_resolution - 1.0f;
+}
+
+/**
+ * Get the cell of a position in a level and its interpolation weights.
+ *
+ * @param params     Parameters of the encoding.
+ * @param coords     Position in [0, 1]^n_dims.
+ * @param level      Level of the grid.
+ * @param pos_grid   Integer coordinates of the lower corner of the cell.
+ * @param pos_frac   Position inside the cell.
+ * @return           Number of cells per dimension of the level.
+ */
+uint32_t hashgrid_cell(const EncodingParams& params, const float* coords, int level, uint32_t* pos_grid, float* pos_frac) {
+	const float scale = hashgrid_scale(params, level);
+	const uint32_t resolution = (uint32_t)sycl::ceil(scale) + 1;
+
+	for (int d = 0; d < params.n_dims; d++) {
+		const float pos = coords[d] * scale + 0.5f;
+		const float pos_floor = sycl::floor(pos);
+		pos_grid[d] = (uint32_t)pos_floor;
+		pos_frac[d] = pos - pos_floor;
+	}
+	return resolution;
+}
+
+/**
+ * Interpolate the features of one level at a position.
+ *
+ * @param params   Parameters of the encoding.
+ * @param coords   Position in [0, 1]^n_dims.
+ * @param level    Level of the grid.
+ * @param features The n_features_per_level interpolated features.
+ */
+void hashgrid_encode_level(const EncodingParams& params, const float* coords, int level, float* features) {
+	uint32_t pos_grid[ENCODING_MAX_DIMS];
+	float pos_frac[ENCODING_MAX_DIMS];
+	const uint32_t resolution = hashgrid_cell(params, coords, level, pos_grid, pos_frac);
+	const float* table = params.tables + (size_t)level * params.table_size * params.n_features_per_item;
+
+	for (int f = 0; f < params.n_features_per_item; f++) {
+		features[f] = 0.0f;
+	}
+
+	// Every corner of the cell contributes with the product of the distances to the opposite faces
+	for (int corner = 0; corner < (1 << params.n_dims); corner++) {
+		float weight = 1.0f;
+		uint32_t pos[ENCODING_MAX_DIMS];
+		for (int d = 0; d < params.n_dims; d++) {
+			if (corner & (1 << d)) {
+				weight *= pos_frac[d];
+				pos[d] = pos_grid[d] + 1;
+			}
+			else {
+				weight *= 1.0f - pos_frac[d];
+				pos[d] = pos_grid[d];
+			}
+		}
+
+		const uint32_t index = hashgrid_index(params, pos, resolution);
+		for (int f = 0; f < params.n_features_per_item; f++) {
+			features[f] += weight * table[index * params.n_features_per_item + f];
+		}
+	}
+}
+
+/**
+ * Scatter-add the gradients of the features of one level to the table gradients, with the interpolation weights.
+ * Several positions share table entries, the additions are atomic.
+ * The gradient of the position goes through the interpolation weights: moving along a dimension shifts the weight
+ * from the corners on the lower face of the cell to the ones on the upper face.
+ *
+ * @param params       Parameters of the encoding.
+ * @param coords       Position in [0, 1]^n_dims.
+ * @param level        Level of the grid.
+ * @param dL_dfeatures Gradients of the n_features_per_level features of the level.
+ * @param dL_dcoords   Gradients of the position, added atomically, or nullptr.
+ */
+void hashgrid_backward_level(const EncodingParams& params, const float* coords, int level, const float* dL_dfeatures, float* dL_dcoords) {
+	uint32_t pos_grid[ENCODING_MAX_DIMS];
+	float pos_frac[ENCODING_MAX_DIMS];
+	const uint32_t resolution = hashgrid_cell(params, coords, level, pos_grid, pos_frac);
+	const float* table = params.tables + (size_t)level * params.table_size * params.n_features_per_item;
+	float* table_grads = params.table_grads + (size_t)level * params.table_size * params.n_features_per_item;
+
+	float dL_dpos[ENCODING_MAX_DIMS] = {};
+
+	for (int corner = 0; corner < (1 << params.n_dims); corner++) {
+		float weight = 1.0f;
+		float weights[ENCODING_MAX_DIMS];
+		uint32_t pos[ENCODING_MAX_DIMS];
+		for (int d = 0; d < params.n_dims; d++) {
+			if (corner & (1 << d)) {
+				weights[d] = pos_frac[d];
+				pos[d] = pos_grid[d] + 1;
+			}
+			else {
+				weights[d] = 1.0f - pos_frac[d];
+				pos[d] = pos_grid[d];
+			}
+			weight *= weights[d];
+		}
+
+		const uint32_t index = hashgrid_index(params, pos, resolution);
+		float dL_dweight = 0.0f;
+		for (int f = 0; f < params.n_features_per_item; f++) {
+			sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> grad(table_grads[index * params.n_features_per_item + f]);
+			grad.fetch_add(weight * dL_dfeatures[f]);
+			dL_dweight += dL_dfeatures[f] * table[index * params.n_features_per_item + f];
+		}
+
+		if (dL_dcoords) {
+			for (int d = 0; d < params.n_dims; d++) {
+				float dweight = (corner & (1 << d)) ? dL_dweight : -dL_dweight;
+				for (int other = 0; other < params.n_dims; other++) {
+					if (other != d) {
+						dweight *= weights[other];
+					}
+				}
+				dL_dpos[d] += dweight;
+			}
+		}
+	}
+
+	if (!dL_dcoords) {
+		return;
+	}
+	const float scale = hashgrid_scale(params, level);
+	for (int d = 0; d < params.n_dims; d++) {
+		sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> grad(dL_dcoords[d]);
+		grad.fetch_add(scale * dL_dpos[d]);
+	}
+}
+
+/**
+ * Constructor of a hash grid encoding.
+ *
+ * @param q                    SYCL queue for command submission.
+ * @param n_dims               Number of dimensions of the positions (2 or 3).
+ * @param n_levels             Number of levels.
+ * @param n_features_per_level Number of features per level (at most HASHGRID_MAX_FEATURES).
+ * @param log2_table_size      Log2 of the number of entries of the table of a level.
+ * @param base_resolution      Resolution of the coarsest level.
+ * @param per_level_scale      Scale of the resolution between two levels.
+ * @param learning_rate        Learning rate of the Adam step on the tables.
+ */
+HashGridEncoding::HashGridEncoding(queue q, int n_dims, int n_levels, int n_features_per_level, int log2_table_size, float base_resolution, float per_level_scale, float learning_rate) {
+	if (n_dims < 1 || n_dims > ENCODING_MAX_DIMS) {
+		throw std::runtime_error{"The hash grid encoding supports 1 to 3 dimensions."};
+	}
+	if (n_features_per_level < 1 || n_features_per_level > HASHGRID_MAX_FEATURES) {
+		throw std::runtime_error{"Invalid number of features per level."};
+	}
+
+	m_q = q;
+	m_learning_rate = learning_rate;
+	m_params.type = EncodingType::HashGrid;
+	m_params.n_dims = n_dims;
+	m_params.n_items = n_levels;
+	m_params.n_features_per_item = n_features_per_level;
+	m_params.table_size = 1u << log2_table_size;
+	m_params.base_resolution = base_resolution;
+	m_params.log2_per_level_scale = std::log2(per_level_scale);
+
+	const int n_params = n_levels * m_params.table_size * n_features_per_level;
+	m_tables.allocate(n_params, q);
+	m_table_grads.allocate(n_params, q);
+	m_first_moments.allocate(n_params, q);
+	m_second_moments.allocate(n_params, q);
+	m_params.tables = m_tables.data();
+	m_params.table_grads = m_table_grads.data();
+
+	initialize_params();
+}
+
+// Initialize the tables with small uniform values and restart the Adam moments
+void HashGridEncoding::initialize_params() {
+	m_tables.initialize_uniform(m_q, 1e-4);
+	m_table_grads.initialize_constant(0.0f, m_q);
+	m_first_moments.initialize_constant(0.0f, m_q);
+	m_second_moments.initialize_constant(0.0f, m_q);
+	m_n_steps = 0;
+}
+
+/**
+ * Adam step on the tables.
+ * The entries which received no gradient since the last step keep their moments, so that the rarely visited
+ * entries of the hashed levels are not decayed.
+ *
+ * @param q             SYCL queue for command submission.
+ * @param normalization Factor applied to the summed gradients (inverse of the batch size and the loss scale).
+ * @param dynamic_scale Device pointer to the dynamic loss scale, or nullptr.
+ * @param skip_flag     Device flag which skips the step when it is non zero, or nullptr.
+ */
+void HashGridEncoding::step(queue q, float normalization, const float* dynamic_scale, const float* skip_flag) {
+	const float beta1 = 0.9f;
+	const float beta2 = 0.99f;
+	const float epsilon = 1e-15f;
+
+	m_n_steps++;
+	const float learning_rate = m_learning_rate * std::sqrt(1.0f - std::pow(beta2, (float)m_n_steps)) / (1.0f - std::pow(beta1, (float)m_n_steps));
+
+	float* tables = m_tables.data();
+	float* table_grads = m_table_grads.data();
+	float* first_moments = m_first_moments.data();
+	float* second_moments = m_second_moments.data();
+
+	q.parallel_for<>(range<1>(m_tables.size()), [=](id<1> idx) {
+		float gradient = table_grads[idx] * normalization;
+		table_grads[idx] = 0.0f;
+		if (gradient == 0.0f || (skip_flag != nullptr && *skip_flag != 0.0f)) {
+			return;
+		}
+		if (dynamic_scale != nullptr) {
+			gradient /= *dynamic_scale;
+		}
+
+		const float first_moment = beta1 * first_moments[idx] + (1.0f - beta1) * gradient;
+		const float second_moment = beta2 * second_moments[idx] + (1.0f - beta2) * gradient * gradient;
+		first_moments[idx] = first_moment;
+		second_moments[idx] = second_moment;
+		tables[idx] -= learning_rate * first_moment / (sycl::sqrt(second_moment) + epsilon);
+		}).wait();
+}
+
+void HashGridEncoding::free_mem(queue q) {
+	m_tables.free_mem(q);
+	m_table_grads.free_mem(q);
+	m_first_moments.free_mem(q);
+	m_second_moments.free_mem(q);
+}
@@ -11,9 +11,10 @@
  * @param scale Scaling factor for gradients.
  * @param preds Pointer to predicted values.
  * @param targets Pointer to target values.
- * @param grads Pointer to gradient values (bf16 type).
+ * @param grads Pointer to gradient values (bf16 or half).
  * @param values Pointer to store loss values.
  */
+template <typename T>
 void L1_loss(
 	id<1> idx,
 	const int n_elements,
@@ -22,7 +23,7 @@ void L1_loss(
 	const float scale,
 	float* preds,
 	float* targets,
-	bf16* grads,
+	T* grads,
 	float* values) {
 
 	// Calculate intra and inter indices
@@ -40,7 +41,7 @@ void L1_loss(
 	values[idx] = fabsf(difference) / N_total_elements;
 
 	// Calculate and store gradient value
-	grads[idx] = bf16(scale * copysignf(1.0f, difference) / N_total_elements);
+	grads[idx] = T(scale * copysignf(1.0f, difference) / N_total_elements);
 }
 
 
@@ -53,17 +54,18 @@ void L1_loss(
  * @param scale Scaling factor for gradients.
  * @param preds Predicted values (DeviceMem<float>).
  * @param targets Target values (DeviceMem<float>).
- * @param grads Gradient values (DeviceMem<bf16>).
+ * @param grads Gradient values (DeviceMem<bf16> or DeviceMem<sycl::half>).
  * @param values Array to store loss values (DeviceMem<float>).
  */
-void L1Loss::evaluate(
+template <typename T>
+void evaluate_L1_loss(
 	queue q,
 	const int dims,
 	const int stride,
 	const float scale,
 	DeviceMem<float>& preds,
 	DeviceMem<float>& targets,
-	DeviceMem<bf16>& grads,
+	DeviceMem<T>& grads,
 	DeviceMem<float>& values
 ) {
 	// Get the total number of elements
@@ -82,3 +84,11 @@ void L1Loss::evaluate(
 			values.data());
 	}).wait();
 }
+
+void L1Loss::evaluate(queue q, const int dims, const int stride, const float scale, DeviceMem<float>& preds, DeviceMem<float>& targets, DeviceMem<bf16>& grads, DeviceMem<float>& values) {
+	evaluate_L1_loss(q, dims, stride, scale, preds, targets, grads, values);
+}
+
+void L1Loss::evaluate(queue q, const int dims, const int stride, const float scale, DeviceMem<float>& preds, DeviceMem<float>& targets, DeviceMem<sycl::half>& grads, DeviceMem<float>& values) {
+	evaluate_L1_loss(q, dims, stride, scale, preds, targets, grads, values);
+}
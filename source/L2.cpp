@@ -6,7 +6,7 @@
  * This function computes the L2 loss and gradients between predicted values
  * and target values for each element in the input. It calculates the squared
  * difference between predicted and target values, and computes gradients using
- * the bf16 type.
+ * the type of the gradients.
  *
  * @param idx          The current index being processed.
  * @param n_elements   The number of elements in the batch.
@@ -15,9 +15,10 @@
  * @param scale        A scaling factor for normalization (unused).
  * @param preds        An array of predicted values.
  * @param targets      An array of target values.
- * @param grads        An array to store gradients.
+ * @param grads        An array to store gradients (bf16 or half).
  * @param values       An array to store squared differences.
  */
+template <typename T>
 void L2_loss(
     id<1> idx,
     const int n_elements,
@@ -26,7 +27,7 @@ void L2_loss(
     const float scale,
     float* preds,
     float* targets,
-    bf16* grads,
+    T* grads,
     float* values
 ) {
     // Calculate intra and inter indices
@@ -43,8 +44,8 @@ void L2_loss(
     const float difference = (preds[idx] - targets[target_idx]);
     values[idx] = difference * difference;
 
-    // Compute gradient using bf16 type
-    grads[idx] = bf16(((bf16)preds[idx] - (bf16)targets[target_idx]));
+    // Compute gradient in the type of the gradients
+    grads[idx] = T(((T)preds[idx] - (T)targets[target_idx]));
 }
 
 
@@ -60,17 +61,18 @@ void L2_loss(
      * @param scale      A scaling factor for normalization (unused).
      * @param preds      The predicted values for each element.
      * @param targets    The target values for each element.
-     * @param grads      An array to store gradients.
+     * @param grads      An array to store gradients (bf16 or half).
      * @param values     An array to store squared differences.
      */
-    void L2Loss::evaluate(
+    template <typename T>
+    void evaluate_L2_loss(
         queue q,
         const int dims,
         const int stride,
         const float scale,
         DeviceMem<float>& preds,
         DeviceMem<float>& targets,
-        DeviceMem<bf16>& grads,
+        DeviceMem<T>& grads,
         DeviceMem<float>& values
     ) {
         // Get the total number of elements
@@ -90,3 +92,11 @@ void L2_loss(
             );
         }).wait();
     }
+
+    void L2Loss::evaluate(queue q, const int dims, const int stride, const float scale, DeviceMem<float>& preds, DeviceMem<float>& targets, DeviceMem<bf16>& grads, DeviceMem<float>& values) {
+        evaluate_L2_loss(q, dims, stride, scale, preds, targets, grads, values);
+    }
+
+    void L2Loss::evaluate(queue q, const int dims, const int stride, const float scale, DeviceMem<float>& preds, DeviceMem<float>& targets, DeviceMem<sycl::half>& grads, DeviceMem<float>& values) {
+        evaluate_L2_loss(q, dims, stride, scale, preds, targets, grads, values);
+    }
@@ -0,0 +1,63 @@
+#include "OneBlobEncoding.h"
+
+/**
+ * Spread one dimension in [0, 1] over the bins, feature b being exp(-(x - c_b)^2 / (2 sigma^2)) with c_b the center
+ * of the bin and sigma = 1 / n_bins.
+ *
+ * @param params   Parameters of the encoding.
+ * @param coords   Position, n_dims floats.
+ * @param item     Dimension.
+ * @param features The n_bins features of the dimension.
+ */
+void one_blob_encode_item(const EncodingParams& params, const float* coords, int item, float* features) {
+	const int n_bins = params.n_features_per_item;
+	const float x = coords[item];
+	for (int b = 0; b < n_bins; b++) {
+		const float dist = (x - (b + 0.5f) / n_bins) * n_bins;
+		features[b] = sycl::exp(-0.5f * dist * dist);
+	}
+}
+
+/**
+ * Add the gradient of one dimension through its bins.
+ *
+ * @param params       Parameters of the encoding.
+ * @param coords       Position, n_dims floats.
+ * @param item         Dimension.
+ * @param dL_dfeatures Gradients of the n_bins features of the dimension.
+ * @param dL_dcoords   Gradients of the position, or nullptr.
+ */
+void one_blob_encode_item_backward(const EncodingParams& params, const float* coords, int item, const float* dL_dfeatures, float* dL_dcoords) {
+	if (!dL_dcoords) {
+		return;
+	}
+	const int n_bins = params.n_features_per_item;
+	const float x = coords[item];
+	float gradient = 0.0f;
+	for (int b = 0; b < n_bins; b++) {
+		const float dist = (x - (b + 0.5f) / n_bins) * n_bins;
+		gradient -= dL_dfeatures[b] * sycl::exp(-0.5f * dist * dist) * dist * n_bins;
+	}
+
+	// A single item per dimension, the gradient is not shared
+	dL_dcoords[item] += gradient;
+}
+
+/**
+ * Constructor of a one-blob encoding.
+ *
+ * @param n_dims Number of dimensions of the positions.
+ * @param n_bins Number of bins per dimension (at most ENCODING_MAX_FEATURES).
+ */
+OneBlobEncoding::OneBlobEncoding(int n_dims, int n_bins) {
+	if (n_dims < 1 || n_dims > ENCODING_MAX_DIMS) {
+		throw std::runtime_error{"The one-blob encoding supports 1 to 3 dimensions."};
+	}
+	if (n_bins < 1 || n_bins > ENCODING_MAX_FEATURES) {
+		throw std::runtime_error{"Invalid number of bins."};
+	}
+	m_params.type = EncodingType::OneBlob;
+	m_params.n_dims = n_dims;
+	m_params.n_items = n_dims;
+	m_params.n_features_per_item = n_bins;
+}
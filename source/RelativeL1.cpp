@@ -11,9 +11,10 @@
  * @param scale Scaling factor for gradients.
  * @param preds Pointer to predicted values.
  * @param targets Pointer to target values.
- * @param grads Pointer to gradient values (bf16 type).
+ * @param grads Pointer to gradient values (bf16 or half).
  * @param values Pointer to store loss values.
  */
+template <typename T>
 void Relative_L1_loss(id<1> idx,
 	const int n_elements,
 	const int dims,
@@ -21,7 +22,7 @@ void Relative_L1_loss(id<1> idx,
 	const float scale,
 	float* preds,
 	float* targets,
-	bf16* grads,
+	T* grads,
 	float* values) {
 
 	const int intra_idx = idx % stride;
@@ -36,7 +37,7 @@ void Relative_L1_loss(id<1> idx,
 
 	values[idx] = fabsf(difference) / norm / N_total_elements;
 
-	grads[idx] = bf16(scale * copysignf(1.0f, difference) / norm / N_total_elements);
+	grads[idx] = T(scale * copysignf(1.0f, difference) / norm / N_total_elements);
 }
 
 
@@ -49,17 +50,18 @@ void Relative_L1_loss(id<1> idx,
  * @param scale Scaling factor for gradients.
  * @param preds Predicted values (DeviceMem<float>).
  * @param targets Target values (DeviceMem<float>).
- * @param grads Gradient values (DeviceMem<bf16>).
+ * @param grads Gradient values (DeviceMem<bf16> or DeviceMem<sycl::half>).
  * @param values Array to store loss values (DeviceMem<float>).
  */
-void RelativeL1Loss::evaluate(
+template <typename T>
+void evaluate_Relative_L1_loss(
 	queue q,
 	const int dims,
 	const int stride,
 	const float scale,
 	DeviceMem<float>& preds,
 	DeviceMem<float>& targets,
-	DeviceMem<bf16>& grads,
+	DeviceMem<T>& grads,
 	DeviceMem<float>& values
 ) {
 	// Get the total number of elements
@@ -78,3 +80,11 @@ void RelativeL1Loss::evaluate(
 			values.data());
 	}).wait();
 }
+
+void RelativeL1Loss::evaluate(queue q, const int dims, const int stride, const float scale, DeviceMem<float>& preds, DeviceMem<float>& targets, DeviceMem<bf16>& grads, DeviceMem<float>& values) {
+	evaluate_Relative_L1_loss(q, dims, stride, scale, preds, targets, grads, values);
+}
+
+void RelativeL1Loss::evaluate(queue q, const int dims, const int stride, const float scale, DeviceMem<float>& preds, DeviceMem<float>& targets, DeviceMem<sycl::half>& grads, DeviceMem<float>& values) {
+	evaluate_Relative_L1_loss(q, dims, stride, scale, preds, targets, grads, values);
+}
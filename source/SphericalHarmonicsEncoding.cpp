@@ -0,0 +1,98 @@
+#include "SphericalHarmonicsEncoding.h"
+
+/**
+ * Evaluate the real spherical harmonics of a direction, the bands up to degree - 1.
+ *
+ * @param params   Parameters of the encoding.
+ * @param coords   Direction in [0, 1]^3.
+ * @param item     Unused, the encoding has a single item.
+ * @param features The degree^2 harmonics.
+ */
+void spherical_harmonics_encode_item(const EncodingParams& params, const float* coords, int item, float* features) {
+	const float x = coords[0] * 2.0f - 1.0f;
+	const float y = coords[1] * 2.0f - 1.0f;
+	const float z = coords[2] * 2.0f - 1.0f;
+	const float x2 = x * x, y2 = y * y, z2 = z * z;
+	const int n_features = params.n_features_per_item;
+
+	features[0] = 0.28209479177387814f;
+	if (n_features <= 1) return;
+	features[1] = -0.48860251190291987f * y;
+	features[2] = 0.48860251190291987f * z;
+	features[3] = -0.48860251190291987f * x;
+	if (n_features <= 4) return;
+	features[4] = 1.0925484305920792f * x * y;
+	features[5] = -1.0925484305920792f * y * z;
+	features[6] = 0.94617469575755997f * z2 - 0.31539156525251999f;
+	features[7] = -1.0925484305920792f * x * z;
+	features[8] = 0.54627421529603959f * (x2 - y2);
+	if (n_features <= 9) return;
+	features[9] = 0.59004358992664352f * y * (-3.0f * x2 + y2);
+	features[10] = 2.8906114426405538f * x * y * z;
+	features[11] = 0.45704579946446572f * y * (1.0f - 5.0f * z2);
+	features[12] = 0.3731763325901154f * z * (5.0f * z2 - 3.0f);
+	features[13] = 0.45704579946446572f * x * (1.0f - 5.0f * z2);
+	features[14] = 1.4453057213202769f * z * (x2 - y2);
+	features[15] = 0.59004358992664352f * x * (-x2 + 3.0f * y2);
+}
+
+/**
+ * Add the gradients of the direction through its harmonics.
+ *
+ * @param params       Parameters of the encoding.
+ * @param coords       Direction in [0, 1]^3.
+ * @param item         Unused, the encoding has a single item.
+ * @param dL_dfeatures Gradients of the degree^2 harmonics.
+ * @param dL_dcoords   Gradients of the direction, or nullptr.
+ */
+void spherical_harmonics_encode_item_backward(const EncodingParams& params, const float* coords, int item, const float* dL_dfeatures, float* dL_dcoords) {
+	if (!dL_dcoords) {
+		return;
+	}
+	const float x = coords[0] * 2.0f - 1.0f;
+	const float y = coords[1] * 2.0f - 1.0f;
+	const float z = coords[2] * 2.0f - 1.0f;
+	const float x2 = x * x, y2 = y * y, z2 = z * z;
+	const int n_features = params.n_features_per_item;
+	const float* g = dL_dfeatures;
+
+	float dx = 0.0f, dy = 0.0f, dz = 0.0f;
+	if (n_features > 1) {
+		dx += -0.48860251190291987f * g[3];
+		dy += -0.48860251190291987f * g[1];
+		dz += 0.48860251190291987f * g[2];
+	}
+	if (n_features > 4) {
+		dx += 1.0925484305920792f * (y * g[4] - z * g[7] + x * g[8]);
+		dy += 1.0925484305920792f * (x * g[4] - z * g[5] - y * g[8]);
+		dz += -1.0925484305920792f * (y * g[5] + x * g[7]) + 1.8923493915151199f * z * g[6];
+	}
+	if (n_features > 9) {
+		dx += -3.5402615395598609f * x * y * g[9] + 2.8906114426405538f * y * z * g[10] + 0.45704579946446572f * (1.0f - 5.0f * z2) * g[13]
+			+ 2.8906114426405538f * x * z * g[14] + 1.7701307697799304f * (y2 - x2) * g[15];
+		dy += 1.7701307697799304f * (y2 - x2) * g[9] + 2.8906114426405538f * x * z * g[10] + 0.45704579946446572f * (1.0f - 5.0f * z2) * g[11]
+			- 2.8906114426405538f * y * z * g[14] + 3.5402615395598609f * x * y * g[15];
+		dz += 2.8906114426405538f * x * y * g[10] - 4.5704579946446572f * y * z * g[11] + (5.597644988851731f * z2 - 1.1195289977703462f) * g[12]
+			- 4.5704579946446572f * x * z * g[13] + 1.4453057213202769f * (x2 - y2) * g[14];
+	}
+
+	// The direction is mapped from [0, 1] to [-1, 1]
+	dL_dcoords[0] += 2.0f * dx;
+	dL_dcoords[1] += 2.0f * dy;
+	dL_dcoords[2] += 2.0f * dz;
+}
+
+/**
+ * Constructor of a spherical harmonics encoding.
+ *
+ * @param degree Number of bands, from 1 to 4, the encoding has degree^2 features.
+ */
+SphericalHarmonicsEncoding::SphericalHarmonicsEncoding(int degree) {
+	if (degree < 1 || degree > 4) {
+		throw std::runtime_error{"The spherical harmonics encoding supports degrees 1 to 4."};
+	}
+	m_params.type = EncodingType::SphericalHarmonics;
+	m_params.n_dims = 3;
+	m_params.n_items = 1;
+	m_params.n_features_per_item = degree * degree;
+}
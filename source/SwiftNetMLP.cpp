@@ -11,6 +11,8 @@
 #define SHMEM_SIZE 1024
 
 #include "SwiftNetMLP.h"
+#include "SwiftNetMLPGroup.h"
+#include "SwiftNetMLPVarWidth.h"
 #include "trainer.h"
 #include "mkl.h"
 #include "common.h"
@@ -20,6 +22,10 @@ using namespace sycl;
 using namespace sycl::ext::oneapi::experimental::matrix;
 using bf16 = sycl::ext::oneapi::bfloat16;
 
+// Number of input columns per block of the split-K first layer, and its shared memory (two input and weight blocks)
+#define SPLIT_K_BLOCK 64
+#define SPLIT_K_SHMEM_SIZE(WIDTH) (2 * (BATCH_CHUNK * (SPLIT_K_BLOCK + SKEW) + SPLIT_K_BLOCK * (WIDTH)))
+
 /**
  * Execute the action made by a work-group to calculate the next layer.
  *
@@ -28,15 +34,17 @@ using bf16 = sycl::ext::oneapi::bfloat16;
  * @param a             Pointer to activation memory.
  * @param a             Pointer to temporary activation memory.
  * @param weights_layer Pointer to weights for the layer.
- * @param out_inter     Pointer to output intermediate memory.
+ * @param out_inter     Pointer to output intermediate memory (activated outputs in forward, deltas in backward).
  * @param out           Pointer to final output memory.
- * @param forward_act   Optional pointer to forward activation memory.
+ * @param forward_act   Optional pointer to the bf16 forward activation memory.
  * @tparam WIDTH        Width of the layer.
  * @tparam N_ITERS      Number of iterations.
  * @tparam BACKWARD     Flag indicating if backward activation is applied.
+ * @tparam outT         Type of the output intermediate memory.
+ * @tparam T            Element type of the activations and weights (bf16 or half).
  */
-template <int WIDTH, int N_ITERS, bool BACKWARD = false>
-void matmul_act_layer(nd_item<1> item, Activation activation, multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> a, multi_ptr<float, access::address_space::local_space, (access::decorated)2> at, bf16* weights_layer, float* out_inter, float* forward_act = nullptr) {
+template <int WIDTH, int N_ITERS, bool BACKWARD = false, typename outT = float, typename T = bf16>
+void matmul_act_layer(nd_item<1> item, Activation activation, multi_ptr<T, access::address_space::local_space, (access::decorated)2> a, multi_ptr<float, access::address_space::local_space, (access::decorated)2> at, T* weights_layer, outT* out_inter, T* forward_act = nullptr) {
 
 	// Get sub-group and local IDs
 	auto sg = item.get_sub_group();
@@ -45,16 +53,16 @@ void matmul_act_layer(nd_item<1> item, Activation activation, multi_ptr<bf16, ac
 	const int N_BLOCKS = WIDTH / TK;
 
 	// Device pointers to memory
-	device_ptr<bf16> w(weights_layer);
-	device_ptr<float> o(out_inter);
-	device_ptr<float> f(forward_act);
+	device_ptr<T> w(weights_layer);
+	device_ptr<outT> o(out_inter);
+	device_ptr<T> f(forward_act);
 
 	// Define matrices and load weights
-	joint_matrix<sub_group, bf16, use::a, TM, TK, layout::row_major> act_matrix;
-	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix0;
-	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix1;
-	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix2;
-	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix3;
+	joint_matrix<sub_group, T, use::a, TM, TK, layout::row_major> act_matrix;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix0;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix1;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix2;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix3;
 	joint_matrix<sub_group, float, use::accumulator, TM, TN> result_matrix;
 
 	joint_matrix_load(sg, weight_matrix0, w + TN * 2 * sgId + TK / 2 * 0 * WIDTH * 2, WIDTH * 2);
@@ -84,11 +92,11 @@ void matmul_act_layer(nd_item<1> item, Activation activation, multi_ptr<bf16, ac
 	for (int i = 0; i < N_ITERS; i++) {
 		if (BACKWARD) {
 			// Apply backward activation matrix if required
-			matrix_activation_backward<float, float, bf16, SG_SIZE>(activation, at, f, a, TN * sgId * (WIDTH + SKEW) + TM * i + id, (WIDTH + SKEW));
+			matrix_activation_backward<float, T, T, SG_SIZE>(activation, at, f, a, TN * sgId * (WIDTH + SKEW) + TM * i + id, (WIDTH + SKEW));
 		}
 		else {
 			// Apply forward activation matrix
-			matrix_activation<float, bf16, SG_SIZE>(activation, at, a, TN * sgId + (WIDTH + SKEW) * TM * i + id, (WIDTH + SKEW));
+			matrix_activation<float, T, SG_SIZE>(activation, at, a, TN * sgId + (WIDTH + SKEW) * TM * i + id, (WIDTH + SKEW));
 		}
 	}
 
@@ -96,14 +104,111 @@ void matmul_act_layer(nd_item<1> item, Activation activation, multi_ptr<bf16, ac
 #pragma unroll
 		for (int i = 0; i < N_ITERS; i++) {
 			for (int k = 0; k < TM; k++) {
-				// Copy results to the output intermediate matrix
-				out_inter[TN * sgId + WIDTH * TM * i + k * WIDTH + id] = at[TN * sgId + (WIDTH + SKEW) * TM * i + k * (WIDTH + SKEW) + id];
+				// Copy results to the output intermediate matrix, the forward pass keeps the activated bf16 values
+				if (BACKWARD) {
+					out_inter[TN * sgId + WIDTH * TM * i + k * WIDTH + id] = (outT)at[TN * sgId + (WIDTH + SKEW) * TM * i + k * (WIDTH + SKEW) + id];
+				}
+				else {
+					out_inter[TN * sgId + WIDTH * TM * i + k * WIDTH + id] = (outT)a[TN * sgId + (WIDTH + SKEW) * TM * i + k * (WIDTH + SKEW) + id];
+				}
 			}
 		}
 	}
 }
 
 
+/**
+ * Forward layer of the specialized kernels, with the activation known at compile time.
+ * The activation is applied to the accumulator elements held by every work item, converted to bf16 in registers
+ * and written once to the activation memory of the next layer: the fp32 results never go through shared memory.
+ * The layers alternate between two activation buffers, so that a single barrier per layer separates the reads
+ * of a_in by the other sub-groups from the writes to a_out.
+ * With SG_SIZE == TN, work item id holds column id of the TM rows of the accumulator.
+ *
+ * With the weights streamed through shared memory, the work-group copies the weights of the next layer straight to
+ * next_weights_mem, a slice before the products of each iteration, so that their latency is hidden by the products
+ * of the other sub-groups without holding them in registers. The barrier of the layer makes them visible to the
+ * next one.
+ *
+ * @param item             The SYCL nd_item representing the work item.
+ * @param a_in             Pointer to the activation memory read by the layer.
+ * @param a_out            Pointer to the activation memory receiving the activated outputs.
+ * @param w                Pointer to weights for the layer, in global or shared memory.
+ * @param out_inter        Pointer to the storage of the activated outputs, or nullptr.
+ * @param next_weights     Pointer to the weights of the next layer to load into shared memory, or nullptr.
+ * @param next_weights_mem Pointer to the shared memory receiving the weights of the next layer.
+ * @tparam WIDTH           Width of the layer.
+ * @tparam N_ITERS         Number of iterations.
+ * @tparam ACTIVATION      Type of activation.
+ * @tparam weightsT        Type of the pointer to the weights.
+ */
+template <int WIDTH, int N_ITERS, Activation ACTIVATION, typename weightsT>
+void matmul_act_layer_static(nd_item<1> item,
+	multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> a_in,
+	multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> a_out,
+	weightsT w,
+	bf16* out_inter,
+	const bf16* next_weights = nullptr,
+	multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> next_weights_mem = nullptr) {
+	static_assert(SG_SIZE == TN, "The accumulator elements of a work item must be a column of the tile.");
+
+	auto sg = item.get_sub_group();
+	int id = item.get_local_id() % SG_SIZE;
+	int sgId = sg.get_group_id();
+	const int li = item.get_local_id(0);
+
+	// Elements of the next weights copied by a work item in each iteration
+	constexpr int N_STAGED = WIDTH * WIDTH / WG_SIZE;
+	constexpr int N_STAGED_PER_ITER = (N_STAGED + N_ITERS - 1) / N_ITERS;
+
+	joint_matrix<sub_group, bf16, use::a, TM, TK, layout::row_major> act_matrix;
+	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix0;
+	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix1;
+	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix2;
+	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix3;
+	joint_matrix<sub_group, float, use::accumulator, TM, TN> result_matrix;
+
+	joint_matrix_load(sg, weight_matrix0, w + TN * 2 * sgId + TK / 2 * 0 * WIDTH * 2, WIDTH * 2);
+	joint_matrix_load(sg, weight_matrix1, w + TN * 2 * sgId + TK / 2 * 1 * WIDTH * 2, WIDTH * 2);
+	joint_matrix_load(sg, weight_matrix2, w + TN * 2 * sgId + TK / 2 * 2 * WIDTH * 2, WIDTH * 2);
+	joint_matrix_load(sg, weight_matrix3, w + TN * 2 * sgId + TK / 2 * 3 * WIDTH * 2, WIDTH * 2);
+
+#pragma unroll
+	for (int l = 0; l < N_ITERS; l++) {
+		// next_weights_mem is not read during the layer, the copy only has to land before its barrier
+		if (next_weights) {
+#pragma unroll
+			for (int i = l * N_STAGED_PER_ITER; i < (l + 1) * N_STAGED_PER_ITER && i < N_STAGED; i++) {
+				next_weights_mem[li + i * WG_SIZE] = next_weights[li + i * WG_SIZE];
+			}
+		}
+
+		joint_matrix_fill(sg, result_matrix, 0.0f);
+
+		joint_matrix_load(sg, act_matrix, a_in + TK * 0 + TM * l * (WIDTH + SKEW), WIDTH + SKEW);
+		result_matrix = joint_matrix_mad(sg, act_matrix, weight_matrix0, result_matrix);
+		joint_matrix_load(sg, act_matrix, a_in + TK * 1 + TM * l * (WIDTH + SKEW), WIDTH + SKEW);
+		result_matrix = joint_matrix_mad(sg, act_matrix, weight_matrix1, result_matrix);
+		joint_matrix_load(sg, act_matrix, a_in + TK * 2 + TM * l * (WIDTH + SKEW), WIDTH + SKEW);
+		result_matrix = joint_matrix_mad(sg, act_matrix, weight_matrix2, result_matrix);
+		joint_matrix_load(sg, act_matrix, a_in + TK * 3 + TM * l * (WIDTH + SKEW), WIDTH + SKEW);
+		result_matrix = joint_matrix_mad(sg, act_matrix, weight_matrix3, result_matrix);
+
+		// Activate the accumulator in registers
+		auto wi_data_c = get_wi_data(sg, result_matrix);
+#pragma unroll
+		for (int r = 0; r < wi_data_c.length(); r++) {
+			const bf16 activated = (bf16)ActivationFunctor<ACTIVATION>::forward((float)wi_data_c[r]);
+			a_out[TN * sgId + (WIDTH + SKEW) * (TM * l + r) + id] = activated;
+			if (out_inter) {
+				out_inter[TN * sgId + WIDTH * (TM * l + r) + id] = activated;
+			}
+		}
+	}
+
+	item.barrier(access::fence_space::local_space);
+}
+
 /**
  * Loads input data into the activation memory using a static pattern for work groups.
  *
@@ -112,9 +217,10 @@ void matmul_act_layer(nd_item<1> item, Activation activation, multi_ptr<bf16, ac
  * @param input     Pointer to the input data.
  * @tparam WIDTH    Width of the data.
  * @tparam N_ITERS  Number of iterations.
+ * @tparam T        Element type of the activations and weights (bf16 or half).
  */
-template <int WIDTH, int N_ITERS>
-void workgroup_prefetch(nd_item<1> item, multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> a, const bf16* input) {
+template <int WIDTH, int N_ITERS, typename T = bf16>
+void workgroup_prefetch(nd_item<1> item, multi_ptr<T, access::address_space::local_space, (access::decorated)2> a, const T* input) {
 
 	// Get local ID and sub-group information
 	int id = item.get_local_id() % SG_SIZE;
@@ -140,9 +246,10 @@ void workgroup_prefetch(nd_item<1> item, multi_ptr<bf16, access::address_space::
  * @param output_threadblock Pointer to the output thread block.
  * @tparam WIDTH             Width of the data.
  * @tparam N_ITERS           Number of iterations.
+ * @tparam T                 Element type of the activations and weights (bf16 or half).
  */
-template <int WIDTH, int N_ITERS>
-void workgroup_write_output_static(nd_item<1> item, multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> a, float* output_threadblock) {
+template <int WIDTH, int N_ITERS, typename T = bf16>
+void workgroup_write_output_static(nd_item<1> item, multi_ptr<T, access::address_space::local_space, (access::decorated)2> a, T* output_threadblock) {
 
 	// Get local ID and sub-group information
 	int id = item.get_local_id() % SG_SIZE;
@@ -153,7 +260,7 @@ void workgroup_write_output_static(nd_item<1> item, multi_ptr<bf16, access::addr
 	for (int i = 0; i < N_ITERS; i++) {
 		for (int k = 0; k < TM; k++) {
 			// Copy data from shared memory to output thread block
-			output_threadblock[TN * sgId * WIDTH + TM * i + k * WIDTH + id] = a[TN * sgId + (WIDTH + SKEW) * TM * i + k * WIDTH + id];
+			output_threadblock[TN * sgId + WIDTH * TM * i + k * WIDTH + id] = a[TN * sgId + (WIDTH + SKEW) * TM * i + k * (WIDTH + SKEW) + id];
 		}
 	}
 }
@@ -168,19 +275,20 @@ void workgroup_write_output_static(nd_item<1> item, multi_ptr<bf16, access::addr
  * @param at                    Pointer to the shared memory containing temporary activation data.
  * @param input                 Pointer to the input data.
  * @param weights_layer         Pointer to weights for the layer.
- * @param out_intermediate_layer Pointer to output intermediate memory for the layer.
+ * @param out_intermediate_layer Pointer to output intermediate memory for the layer (activated bf16 values).
  * @param input_width           Width of the input data.
  * @tparam WIDTH                Width of the layer.
  * @tparam N_ITERS              Number of iterations.
+ * @tparam T                    Element type of the activations and weights (bf16 or half).
  */
-template <int WIDTH, int N_ITERS>
+template <int WIDTH, int N_ITERS, typename T = bf16>
 void workgroup_matmul_act_dynamic(nd_item<1> item,
 	Activation activation,
-	multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> a,
+	multi_ptr<T, access::address_space::local_space, (access::decorated)2> a,
 	multi_ptr<float, access::address_space::local_space, (access::decorated)2> at,
-	bf16* input,
-	bf16* weights_layer,
-	float* out_intermediate_layer,
+	T* input,
+	T* weights_layer,
+	T* out_intermediate_layer,
 	const int input_width,
 	const int batch_size
 )
@@ -191,13 +299,13 @@ void workgroup_matmul_act_dynamic(nd_item<1> item,
 	const int N_BLOCKS = WIDTH / TK;
 
 	// Device pointers to memory
-	device_ptr<bf16> in(input);
-	device_ptr<bf16> w(weights_layer);
-	device_ptr<float> o(out_intermediate_layer);
+	device_ptr<T> in(input);
+	device_ptr<T> w(weights_layer);
+	device_ptr<T> o(out_intermediate_layer);
 
 	// Define matrices and load weights
-	joint_matrix<sub_group, bf16, use::a, TM, TK, layout::row_major> act_matrix;
-	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix;
+	joint_matrix<sub_group, T, use::a, TM, TK, layout::row_major> act_matrix;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix;
 
 	joint_matrix<sub_group, float, use::accumulator, TM, TN> result_matrix;
 
@@ -216,16 +324,148 @@ void workgroup_matmul_act_dynamic(nd_item<1> item,
 			joint_matrix_store(sg, result_matrix, at + TN * sgId + TM * l * WIDTH, WIDTH, layout::row_major);
 		}
 
-		matrix_activation<float, bf16, SG_SIZE>(activation, at, a, TN * sgId + TM * l * WIDTH + id, WIDTH);
+		matrix_activation<float, T, SG_SIZE>(activation, at, a, TN * sgId + TM * l * WIDTH + id, WIDTH);
 	}
-	for (int i = 0; i < N_ITERS; i++) {
-		for (int k = 0; k < TM; k++) {
-			o[TN * sgId + WIDTH * TM * i + k * WIDTH + id] = (bf16)at[TN * sgId + WIDTH * TM * i + k * WIDTH + id];
+	if (out_intermediate_layer) {
+		for (int i = 0; i < N_ITERS; i++) {
+			for (int k = 0; k < TM; k++) {
+				o[TN * sgId + WIDTH * TM * i + k * WIDTH + id] = a[TN * sgId + WIDTH * TM * i + k * WIDTH + id];
+			}
+		}
+	}
+}
+/**
+ * Copies one block of SPLIT_K_BLOCK input columns of a work-group and the matching rows of the packed first layer
+ * to shared memory. The packed rows of a block are contiguous.
+ *
+ * @param item          The SYCL nd_item representing the work item.
+ * @param in_block      Pointer to the shared memory of the input block (row stride SPLIT_K_BLOCK + SKEW).
+ * @param w_block       Pointer to the shared memory of the weight block.
+ * @param input         Pointer to the input rows of the work-group.
+ * @param weights_layer Pointer to the packed weights of the first layer.
+ * @param input_width   Width of the input data.
+ * @param block         Index of the block.
+ * @tparam WIDTH        Width of the layer.
+ * @tparam T            Element type of the activations and weights (bf16 or half).
+ */
+template <int WIDTH, typename T = bf16>
+void workgroup_load_split_k_block(nd_item<1> item,
+	multi_ptr<T, access::address_space::local_space, (access::decorated)2> in_block,
+	multi_ptr<T, access::address_space::local_space, (access::decorated)2> w_block,
+	const T* input,
+	const T* weights_layer,
+	const int input_width,
+	const int block) {
+
+	const int li = item.get_local_id(0);
+
+	for (int p = li; p < BATCH_CHUNK * SPLIT_K_BLOCK; p += WG_SIZE) {
+		const int row = p / SPLIT_K_BLOCK;
+		const int col = p % SPLIT_K_BLOCK;
+		in_block[row * (SPLIT_K_BLOCK + SKEW) + col] = input[row * input_width + block * SPLIT_K_BLOCK + col];
+	}
+	for (int p = li; p < SPLIT_K_BLOCK * WIDTH; p += WG_SIZE) {
+		w_block[p] = weights_layer[block * SPLIT_K_BLOCK * WIDTH + p];
+	}
+}
+
+/**
+ * Performs the first layer for inputs wider than the layer, split along K.
+ * The input and the weights are streamed by blocks of SPLIT_K_BLOCK columns through two shared memory buffers: the
+ * next block is copied while the current one is multiplied, and the products are accumulated in the joint_matrix
+ * accumulators of the sub-groups until the last block. Only the activated result goes through a.
+ *
+ * @param item                  The SYCL nd_item representing the work item.
+ * @param activation            The type of activation to be applied.
+ * @param a                     Pointer to the shared memory receiving the activated layer.
+ * @param at                    Pointer to the shared memory containing temporary activation data.
+ * @param split_k_mem           Pointer to the shared memory of the blocks (SPLIT_K_SHMEM_SIZE(WIDTH) values).
+ * @param input                 Pointer to the input rows of the work-group.
+ * @param weights_layer         Pointer to the packed weights of the first layer.
+ * @param out_intermediate_layer Pointer to output intermediate memory for the layer (activated bf16 values), or nullptr.
+ * @param input_width           Width of the input data, a multiple of SPLIT_K_BLOCK.
+ * @tparam WIDTH                Width of the layer.
+ * @tparam N_ITERS              Number of iterations.
+ * @tparam T                    Element type of the activations and weights (bf16 or half).
+ */
+template <int WIDTH, int N_ITERS, typename T = bf16>
+void workgroup_matmul_act_split_k(nd_item<1> item,
+	Activation activation,
+	multi_ptr<T, access::address_space::local_space, (access::decorated)2> a,
+	multi_ptr<float, access::address_space::local_space, (access::decorated)2> at,
+	multi_ptr<T, access::address_space::local_space, (access::decorated)2> split_k_mem,
+	const T* input,
+	const T* weights_layer,
+	T* out_intermediate_layer,
+	const int input_width) {
+
+	auto sg = item.get_sub_group();
+	int id = item.get_local_id() % SG_SIZE;
+	int sgId = sg.get_group_id();
+
+	// Every sub-group owns the blocks of TN columns sgId, sgId + N_SGS, ...
+	constexpr int N_SGS = WG_SIZE / SG_SIZE;
+	constexpr int N_COLS = WIDTH / TN / N_SGS;
+	constexpr int IN_BLOCK_SIZE = BATCH_CHUNK * (SPLIT_K_BLOCK + SKEW);
+	const int n_blocks = input_width / SPLIT_K_BLOCK;
+
+	joint_matrix<sub_group, T, use::a, TM, TK, layout::row_major> act_matrix;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix;
+	joint_matrix<sub_group, float, use::accumulator, TM, TN> result_matrix[N_COLS * N_ITERS];
+
+#pragma unroll
+	for (int r = 0; r < N_COLS * N_ITERS; r++) {
+		joint_matrix_fill(sg, result_matrix[r], 0.0f);
+	}
+
+	workgroup_load_split_k_block<WIDTH>(item, split_k_mem, split_k_mem + 2 * IN_BLOCK_SIZE, input, weights_layer, input_width, 0);
+	group_barrier(item.get_group());
+
+	for (int block = 0; block < n_blocks; block++) {
+		const int buffer = block % 2;
+		auto in_block = split_k_mem + buffer * IN_BLOCK_SIZE;
+		auto w_block = split_k_mem + 2 * IN_BLOCK_SIZE + buffer * SPLIT_K_BLOCK * WIDTH;
+
+		// The other buffer was released by the barrier of the previous block
+		if (block + 1 < n_blocks) {
+			workgroup_load_split_k_block<WIDTH>(item, split_k_mem + (1 - buffer) * IN_BLOCK_SIZE, split_k_mem + 2 * IN_BLOCK_SIZE + (1 - buffer) * SPLIT_K_BLOCK * WIDTH, input, weights_layer, input_width, block + 1);
+		}
+
+#pragma unroll
+		for (int k = 0; k < SPLIT_K_BLOCK / TK; k++) {
+#pragma unroll
+			for (int n = 0; n < N_COLS; n++) {
+				joint_matrix_load(sg, weight_matrix, w_block + TN * 2 * (sgId + n * N_SGS) + TK / 2 * k * WIDTH * 2, WIDTH * 2);
+#pragma unroll
+				for (int l = 0; l < N_ITERS; l++) {
+					joint_matrix_load(sg, act_matrix, in_block + TK * k + TM * l * (SPLIT_K_BLOCK + SKEW), SPLIT_K_BLOCK + SKEW);
+					result_matrix[n * N_ITERS + l] = joint_matrix_mad(sg, act_matrix, weight_matrix, result_matrix[n * N_ITERS + l]);
+				}
+			}
+		}
+		group_barrier(item.get_group());
+	}
+
+#pragma unroll
+	for (int n = 0; n < N_COLS; n++) {
+		const int col = TN * (sgId + n * N_SGS);
+#pragma unroll
+		for (int l = 0; l < N_ITERS; l++) {
+			joint_matrix_store(sg, result_matrix[n * N_ITERS + l], at + col + TM * l * (WIDTH + SKEW), WIDTH + SKEW, layout::row_major);
+			matrix_activation<float, T, SG_SIZE>(activation, at, a, col + (WIDTH + SKEW) * TM * l + id, (WIDTH + SKEW));
+			if (out_intermediate_layer) {
+				for (int k = 0; k < TM; k++) {
+					out_intermediate_layer[col + WIDTH * TM * l + k * WIDTH + id] = a[col + (WIDTH + SKEW) * TM * l + k * (WIDTH + SKEW) + id];
+				}
+			}
 		}
 	}
+	group_barrier(item.get_group());
 }
+
 /**
  * Performs forward computation for the last layer within a work group.
+ * The output activation is applied to the accumulators before they are stored.
  *
  * @param item              The SYCL nd_item representing the work item.
  * @param activation        The type of activation to be applied.
@@ -235,12 +475,13 @@ void workgroup_matmul_act_dynamic(nd_item<1> item,
  * @param output_stride     The stride for the output memory.
  * @tparam WIDTH            Width of the layer.
  * @tparam N_ITERS          Number of iterations.
+ * @tparam T                Element type of the activations and weights (bf16 or half).
  */
-template <int WIDTH, int N_ITERS>
+template <int WIDTH, int N_ITERS, typename T = bf16>
 void workgroup_last_layer(nd_item<1> item,
 	Activation activation,
-	multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> a,
-	bf16* weights_layer,
+	multi_ptr<T, access::address_space::local_space, (access::decorated)2> a,
+	T* weights_layer,
 	float* out,
 	const int output_stride) {
 
@@ -248,15 +489,15 @@ void workgroup_last_layer(nd_item<1> item,
 	int sgId = sg.get_group_id();
 	const int li = item.get_local_id(0);
 	int N_BLOCKS = WIDTH / 16;
-	device_ptr<bf16> w(weights_layer);
+	device_ptr<T> w(weights_layer);
 	device_ptr<float> o(out);
 
-	joint_matrix<sub_group, bf16, use::a, TM, TK, layout::row_major> act_matrix;
+	joint_matrix<sub_group, T, use::a, TM, TK, layout::row_major> act_matrix;
 
-	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix0;
-	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix1;
-	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix2;
-	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix3;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix0;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix1;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix2;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix3;
 	joint_matrix<sub_group, float, use::accumulator, TM, TN> result_matrix;
 
 	joint_matrix_load(sg, weight_matrix0, w + TN * 2 * sgId + TK / 2 * 0 * WIDTH * 2, WIDTH * 2);
@@ -276,10 +517,114 @@ void workgroup_last_layer(nd_item<1> item,
 		joint_matrix_load(sg, act_matrix, a + TK * 3 + TM * l * WIDTH, WIDTH);
 		result_matrix = joint_matrix_mad(sg, act_matrix, weight_matrix3, result_matrix);
 
+		if (activation != Activation::None) {
+			auto wi_data_c = get_wi_data(sg, result_matrix);
+			for (int r = 0; r < wi_data_c.length(); r++) {
+				float result = wi_data_c[r];
+				wi_data_c[r] = elt_activation_ret<float>(activation, result);
+			}
+		}
+
 		joint_matrix_store(sg, result_matrix, o + TM * sgId + TN * l * WIDTH, WIDTH, layout::row_major);
 	}
 }
 
+/**
+ * Computes the input encoding of the positions of a work-group straight into the activation memory, so that
+ * the first layer reads it from shared memory. Every work item computes (row, item) pairs of the encoding, the
+ * columns past the encoded features are zero.
+ *
+ * @param item        The SYCL nd_item representing the work item.
+ * @param a           Pointer to the activation memory.
+ * @param coords      Pointer to the positions of the work-group, n_dims floats per row.
+ * @param first_row   Index in the batch of the first row of the work-group.
+ * @param encoding    Parameters of the encoding.
+ * @param encoded_out Pointer to the bf16 storage of the encoded rows for the backward pass (nullptr in inference).
+ * @tparam WIDTH      Width of the first layer.
+ * @tparam N_ITERS    Number of iterations.
+ * @tparam T          Element type of the activations and weights (bf16 or half).
+ */
+template <int WIDTH, int N_ITERS, typename T = bf16>
+void workgroup_encode(nd_item<1> item,
+	multi_ptr<T, access::address_space::local_space, (access::decorated)2> a,
+	const float* coords,
+	const int first_row,
+	const EncodingParams& encoding,
+	T* encoded_out) {
+
+	const int li = item.get_local_id(0);
+	const int n_items = encoding.n_items;
+	const int n_features = encoding.n_features_per_item;
+	const int n_encoded = n_items * n_features;
+
+	for (int p = li; p < BATCH_CHUNK * n_items; p += WG_SIZE) {
+		const int row = p / n_items;
+		const int encoding_item = p % n_items;
+		float features[ENCODING_MAX_FEATURES];
+		encode_item(encoding, coords + row * encoding.n_dims, first_row + row, encoding_item, features);
+		for (int f = 0; f < n_features; f++) {
+			a[row * (WIDTH + SKEW) + encoding_item * n_features + f] = (T)features[f];
+			if (encoded_out) {
+				encoded_out[row * WIDTH + encoding_item * n_features + f] = (T)features[f];
+			}
+		}
+	}
+	for (int p = li; p < BATCH_CHUNK * (WIDTH - n_encoded); p += WG_SIZE) {
+		const int row = p / (WIDTH - n_encoded);
+		const int col = n_encoded + p % (WIDTH - n_encoded);
+		a[row * (WIDTH + SKEW) + col] = (T)0.0f;
+		if (encoded_out) {
+			encoded_out[row * WIDTH + col] = (T)0.0f;
+		}
+	}
+	group_barrier(item.get_group());
+}
+
+/**
+ * Get the batch chunk processed next by a work-group. Without chunk counter, every work-group processes the chunk
+ * of its group id. In a persistent kernel, the first work item pulls the next chunk from the global counter, after
+ * a barrier as the shared memory of the previous chunk is reused.
+ *
+ * @param item          The SYCL nd_item representing the work item.
+ * @param chunk_counter Pointer to the counter of the chunks taken, or nullptr.
+ * @param chunk         Chunk processed so far, -1 before the first one.
+ * @param n_chunks      Number of chunks of the batch.
+ * @return The next chunk, n_chunks when there is none left.
+ */
+int workgroup_next_chunk(nd_item<1> item, int* chunk_counter, const int chunk, const int n_chunks) {
+	if (!chunk_counter) {
+		return chunk < 0 ? (int)item.get_group(0) : n_chunks;
+	}
+	if (chunk >= 0) {
+		item.barrier(access::fence_space::local_space);
+	}
+	int next = 0;
+	if (item.get_local_id(0) == 0) {
+		next = atomic_ref<int, memory_order::relaxed, memory_scope::device, access::address_space::global_space>(*chunk_counter).fetch_add(1);
+	}
+	return group_broadcast(item.get_group(), next);
+}
+
+/**
+ * Number of work-groups of a kernel over the batch chunks. With more chunks than XVEs, the kernel is persistent:
+ * about one work-group per XVE pulls the chunks from chunk_counter, which is reset, and reuses the weights
+ * loaded for its previous chunks. Otherwise every chunk gets its own work-group.
+ *
+ * @param q             SYCL queue for command submission.
+ * @param n_chunks      Number of chunks of the batch.
+ * @param chunk_counter Pointer to the counter of the chunks taken, set to nullptr when the kernel is not persistent.
+ * @return The number of work-groups to launch.
+ */
+int persistent_work_groups(queue& q, const int n_chunks, int*& chunk_counter) {
+	const int n_groups = std::min(n_chunks, (int)q.get_device().get_info<info::device::max_compute_units>());
+	if (!chunk_counter || n_groups == n_chunks) {
+		chunk_counter = nullptr;
+		return n_chunks;
+	}
+	q.memset(chunk_counter, 0, sizeof(int)).wait();
+	return n_groups;
+}
+
 /**
  * Kernel function for the forward pass of the Swift MLP model.
  *
@@ -287,49 +632,77 @@ void workgroup_last_layer(nd_item<1> item,
  * @param output_activation     The type of activation to be applied for output layer.
  * @param input                 Pointer to input data.
  * @param weights_layer         Pointer to weights for the layer.
- * @param out_intermediate_layer Pointer to intermediate output memory.
+ * @param out_intermediate_layer Pointer to intermediate output memory (activated bf16 values of every layer).
  * @param act_mem               Pointer to activation memory.
  * @param act_mem_temp          Pointer to temporary activation memory.
+ * @param split_k_mem           Shared memory of the split-K first layer of wide inputs.
  * @param out                   Pointer to output memory.
+ * @param last_act              Pointer to the bf16 activations of the last hidden layer (used in inference when the output layer runs with oneMKL).
  * @param output_stride         The stride for the output memory.
  * @param input_width           Width of the input data.
  * @param output_width          Width of the output data.
  * @param n_hidden_matmuls      Number of hidden matrix multiplications.
  * @param batch_size            Batch size of the data.
+ * @param checkpoint_interval   Only every checkpoint_interval-th layer is stored in out_intermediate_layer.
+ * @param coords                Pointer to the positions encoded in the kernel (nullptr for encodings without positions).
+ * @param encoding              Parameters of the input encoding, of type None when the input is read from input.
+ * @param encoded_out           Pointer to the storage of the encoded input for the backward pass.
+ * @param chunk                 Index of the batch chunk of the work-group.
  * @tparam WIDTH                Width of the layers.
  * @tparam N_ITERS              Number of iterations.
  * @tparam activation           Type of activation for hidden layers.
+ * @tparam T                    Element type of the activations and weights (bf16 or half).
  */
-template <int WIDTH, int N_ITERS, Activation activation, bool INFERENCE = false>
+template <int WIDTH, int N_ITERS, Activation activation, bool INFERENCE = false, typename T = bf16>
 void kernel_swift_mlp(nd_item<1> item,
 	const Activation output_activation,
-	bf16* input,
-	bf16* weights_layer,
-	float* out_intermediate_layer,
-	local_accessor<bf16> act_mem,
+	T* input,
+	T* weights_layer,
+	T* out_intermediate_layer,
+	local_accessor<T> act_mem,
 	local_accessor<float> act_mem_temp,
+	local_accessor<T> split_k_mem,
 	float* out,
+	T* last_act,
 	const uint32_t output_stride,
 	const uint32_t input_width,
 	const uint32_t output_width,
 	const uint32_t n_hidden_matmuls,
-	int batch_size) {
+	int batch_size,
+	const int checkpoint_interval,
+	const float* coords,
+	const EncodingParams encoding,
+	T* encoded_out,
+	const int chunk) {
 
 	auto a = act_mem.get_pointer();
 	auto at = act_mem_temp.get_pointer();
 
 	// Handle first layer because it has different input
 
-	auto wg = item.get_group();
-	const int wg_idx = wg.get_group_id();
-	const int elem_idx = BATCH_CHUNK * wg_idx;
+	const int elem_idx = BATCH_CHUNK * chunk;
 	const int first_weight_length = input_width * WIDTH;
 	const int hidden_weight_lenght = WIDTH * WIDTH;
 	const int layer_lenght = WIDTH * batch_size;
 
-	if (input_width == WIDTH) {
+	// Layers which are not checkpoints are recomputed in the backward pass and are not stored
+	T* first_out_inter = nullptr;
+	if (!INFERENCE && isCheckpointLayer(1, checkpoint_interval, n_hidden_matmuls)) {
+		first_out_inter = out_intermediate_layer + elem_idx * WIDTH + (checkpointSlot(1, checkpoint_interval, n_hidden_matmuls) - 1) * layer_lenght;
+	}
+
+	if (encoding.type != EncodingType::None) {
+		// The encoded input never goes through global memory before the first layer
+		workgroup_encode<WIDTH, N_ITERS>(item, a, coords + elem_idx * encoding.n_dims, elem_idx, encoding, encoded_out ? encoded_out + elem_idx * WIDTH : nullptr);
+		matmul_act_layer<WIDTH, N_ITERS, false>(item, activation, a, at, weights_layer, first_out_inter);
+	}
+	else if (input_width == WIDTH) {
 		workgroup_prefetch<WIDTH, N_ITERS>(item, a, input + elem_idx * WIDTH);
-		matmul_act_layer<WIDTH, N_ITERS, false>(item, activation, a, at, weights_layer, !INFERENCE ? (out_intermediate_layer + elem_idx * WIDTH) : nullptr);
+		matmul_act_layer<WIDTH, N_ITERS, false>(item, activation, a, at, weights_layer, first_out_inter);
+	}
+	else if (input_width > WIDTH && input_width % SPLIT_K_BLOCK == 0) {
+		// Wide inputs never fit in a: they are streamed by blocks through split_k_mem
+		workgroup_matmul_act_split_k<WIDTH, N_ITERS>(item, activation, a, at, split_k_mem.get_pointer(), input + elem_idx * input_width, weights_layer, first_out_inter, input_width);
 	}
 	else {
 		workgroup_matmul_act_dynamic<WIDTH, N_ITERS>(item,
@@ -338,7 +711,7 @@ void kernel_swift_mlp(nd_item<1> item,
 			at,
 			input + elem_idx * input_width,
 			weights_layer,
-			!INFERENCE ? (out_intermediate_layer + elem_idx * WIDTH) : nullptr,
+			first_out_inter,
 			input_width,
 			batch_size);
 	}
@@ -346,18 +719,23 @@ void kernel_swift_mlp(nd_item<1> item,
 	// Handle hidden layers all together
 
 	for (int k = 0; k < n_hidden_matmuls; k++) {
+		T* out_inter = nullptr;
+		if (!INFERENCE && isCheckpointLayer(k + 2, checkpoint_interval, n_hidden_matmuls)) {
+			out_inter = out_intermediate_layer + elem_idx * WIDTH + (checkpointSlot(k + 2, checkpoint_interval, n_hidden_matmuls) - 1) * layer_lenght;
+		}
 		matmul_act_layer<WIDTH, N_ITERS, false>(item,
 			activation,
 			a,
 			at,
 			weights_layer + first_weight_length + k * hidden_weight_lenght,
-			!INFERENCE ? (out_intermediate_layer + elem_idx * WIDTH + (k + 1) * layer_lenght) : nullptr);
+			out_inter);
 	}
 
 	// Handle output layer
 	if (output_width > 16) {
+		// In training, the last hidden activations are already stored in out_intermediate_layer
 		if (INFERENCE) {
-			workgroup_write_output_static<WIDTH, N_ITERS>(item, a, out_intermediate_layer + elem_idx * WIDTH + (n_hidden_matmuls + 1) * layer_lenght);
+			workgroup_write_output_static<WIDTH, N_ITERS>(item, a, last_act + elem_idx * WIDTH);
 		}
 	}
 	else if (out) {
@@ -377,726 +755,2913 @@ void kernel_swift_mlp(nd_item<1> item,
  * @param q                  SYCL queue for command submission.
  * @param output_activation The type of activation to be applied for output layer.
  * @param weights            Device memory containing weights for the model.
- * @param inputs             Device memory containing input data.
+ * @param inputs             Pointer to the input data.
  * @param intermediate_output Pointer to intermediate output memory.
  * @param act_mem            Pointer to activation memory.
  * @param act_mem_temp       Pointer to temporary activation memory.
  * @param output             Device memory for storing the output.
+ * @param last_act           Pointer to the bf16 activations of the last hidden layer.
  * @param output_stride      The stride for the output memory.
  * @param n_hidden_layers    Number of hidden layers.
  * @param input_width        Width of the input data.
  * @param output_width       Width of the output data.
  * @param batch_size         Batch size of the data.
+ * @param checkpoint_interval Only every checkpoint_interval-th layer is stored in intermediate_output.
+ * @param coords             Positions encoded by the kernel instead of reading inputs (nullptr without positions).
+ * @param encoding           Parameters of the input encoding (type None without encoding).
+ * @param encoded_out        Storage of the encoded input for the backward pass (nullptr in inference).
+ * @param chunk_counter      Device counter of the persistent kernel, or nullptr for one work-group per chunk.
  * @tparam WIDTH             Width of the layers.
  * @tparam activation        Type of activation for hidden layers.
+ * @tparam T                 Element type of the activations and weights (bf16 or half).
  */
-template <int WIDTH, Activation activation, bool INFERENCE>
+template <int WIDTH, Activation activation, bool INFERENCE, typename T = bf16>
 void mlp_swift_forward(queue q,
 	Activation output_activation,
-	const DeviceMem<bf16>& weights,
-	const DeviceMem<bf16>& inputs,
-	float* intermediate_output,
+	const DeviceMem<T>& weights,
+	T* inputs,
+	T* intermediate_output,
 	DeviceMem<float>& output,
+	T* last_act,
 	const int output_stride,
 	const int n_hidden_layers,
 	const int input_width,
 	const int output_width,
-	int batch_size)
+	int batch_size,
+	const int checkpoint_interval = 1,
+	const float* coords = nullptr,
+	const EncodingParams encoding = EncodingParams(),
+	T* encoded_out = nullptr,
+	int* chunk_counter = nullptr)
 {
 
 	const int N_BLOCKS = WIDTH / TK;
 	const int N_ITERS = BATCH_CHUNK / TM;
+	const int n_chunks = batch_size / BATCH_CHUNK;
+	const int n_groups = persistent_work_groups(q, n_chunks, chunk_counter);
 
 	q.submit([&](handler& cgh)
 		{
-			local_accessor<bf16> act_mem = local_accessor<bf16>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, cgh);
+			local_accessor<T> act_mem = local_accessor<T>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, cgh);
 			local_accessor<float> act_mem_temp = local_accessor<float>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, cgh);
+			// Only the split-K first layer of wide inputs uses this memory
+			const bool split_k = encoding.type == EncodingType::None && input_width > WIDTH && input_width % SPLIT_K_BLOCK == 0;
+			local_accessor<T> split_k_mem = local_accessor<T>(range<1>(split_k ? SPLIT_K_SHMEM_SIZE(WIDTH) : 1), cgh);
 
 			cgh.parallel_for(
-				nd_range<1>(batch_size * WG_SIZE / BATCH_CHUNK, WG_SIZE),
+				nd_range<1>(n_groups * WG_SIZE, WG_SIZE),
 				[=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]]
 				{
-					kernel_swift_mlp<WIDTH, N_ITERS, activation, INFERENCE>(item,
-						output_activation,
-						inputs.data(),
-						weights.data(),
-						intermediate_output,
-						act_mem,
-						act_mem_temp,
-						output.data(),
-						output_stride,
-						input_width,
-						output_width,
-						n_hidden_layers - 1,
-						batch_size);
-
+					for (int chunk = workgroup_next_chunk(item, chunk_counter, -1, n_chunks); chunk < n_chunks; chunk = workgroup_next_chunk(item, chunk_counter, chunk, n_chunks)) {
+						kernel_swift_mlp<WIDTH, N_ITERS, activation, INFERENCE>(item,
+							output_activation,
+							inputs,
+							weights.data(),
+							intermediate_output,
+							act_mem,
+							act_mem_temp,
+							split_k_mem,
+							output.data(),
+							last_act,
+							output_stride,
+							input_width,
+							output_width,
+							n_hidden_layers - 1,
+							batch_size,
+							checkpoint_interval,
+							coords,
+							encoding,
+							encoded_out,
+							chunk);
+					}
 				});
 		}).wait();
 }
 
 
+// Where the specialized forward kernel reads the weights of the hidden layers
+enum class WeightsMemory {
+	Global,   // Global memory, for the networks too wide for shared memory
+	Streamed, // Shared memory, the weights of the next layer are loaded during the current layer
+	Resident, // Shared memory, all the layers are loaded once by a persistent work-group for all its chunks
+};
+
 /**
- * Kernel function for backpropagation in the SwiftNet model.
+ * Copies weights to shared memory, cooperatively by the work-group.
  *
- * @param item             The SYCL nd_item representing the work item.
- * @param deltas           Pointer to the losses deltas from where the backpropagation starts.
- * @param a                Pointer to loss gradients for backpropagation.
- * @param at               Pointer to temporary loss gradients memory.
- * @param grads            Pointer to gradients for weight updates.
- * @param weights          Pointer to weights of the model.
- * @param forward          Pointer to forward pass intermediate outputs.
- * @param out_inter        Pointer to intermediate output memory.
- * @param n_hidden_matmuls Number of hidden matrix multiplications.
- * @param batch_size       Batch size of the data.
- * @tparam WIDTH           Width of the layers.
- * @tparam N_ITERS         Number of iterations.
- * @tparam ACTIVATION      Type of activation for hidden layers.
+ * @param item     The SYCL nd_item representing the work item.
+ * @param w        Pointer to the shared memory of the weights.
+ * @param weights  Pointer to the weights in global memory.
+ * @param n        Number of weights.
+ * @tparam WIDTH   Width of the layers.
  */
-template <int WIDTH, int N_ITERS, Activation ACTIVATION>
-void kernel_swiftnet_backward(
-	nd_item<1> item,
-	bf16* deltas,
-	multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> a,
-	multi_ptr<float, access::address_space::local_space, (access::decorated)2> at,
-	bf16* grads,
-	bf16* weights,
-	float* forward,
-	float* out_inter,
-	uint32_t n_hidden_matmuls,
-	int batch_size
-) {
-	auto sg = item.get_sub_group();
-
-
-	int groupId = item.get_group(0);
-	int sgId = sg.get_group_id();
-	const int layer_length = WIDTH * batch_size;
-
-	workgroup_prefetch<WIDTH, N_ITERS>(item, a, deltas + groupId * BATCH_CHUNK * WIDTH);
-
-	// Iterate through hidden layers for backpropagation
-	for (int k = 0; k < n_hidden_matmuls; k++) {
-		matmul_act_layer<WIDTH, N_ITERS, true>(
-			item,
-			ACTIVATION,
-			a,
-			at,
-			weights + WIDTH * WIDTH * (n_hidden_matmuls - k),
-			out_inter + groupId * BATCH_CHUNK * WIDTH + (n_hidden_matmuls - k - 1) * layer_length,
-			forward + WIDTH * batch_size + WIDTH * batch_size * (n_hidden_matmuls - k - 1) + groupId * BATCH_CHUNK * WIDTH
-		);
+template <int WIDTH>
+void workgroup_load_weights(nd_item<1> item, multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> w, const bf16* weights, const int n) {
+	for (int i = item.get_local_id(0); i < n; i += WG_SIZE) {
+		w[i] = weights[i];
 	}
 }
 
 /**
- * Multiplies matrices using DGEMM for gradient calculation in the SwiftNet model.
+ * Kernel function for the forward pass specialized on the depth and the hidden activation of the network.
+ * It covers the common case of the generic kernel: the input width is the network width, there is no input
+ * encoding and every layer is stored. The hidden layers are fully unrolled.
  *
- * @param q                 SYCL queue for command submission.
- * @param grads_device      Pointer to device memory for gradients.
- * @param loss_gradients    Pointer to loss gradients for backpropagation.
- * @param fwd               Pointer to forward pass intermediate outputs.
- * @param A                 Pointer to matrix A (calculated activations).
- * @param B                 Pointer to matrix B (loss gradients).
- * @param C                 Pointer to matrix C (result of DGEMM).
- * @param k                 Index of the hidden matrix multiplication.
- * @param m_n_hidden_matrices Number of hidden matrix multiplications.
+ * @param item              The SYCL nd_item representing the work item.
+ * @param output_activation The type of activation to be applied for output layer.
+ * @param input             Pointer to the input data.
+ * @param weights_layer     Pointer to weights of the model.
+ * @param out_intermediate_layer Pointer to the storage of the activated hidden layers (unused in inference).
+ * @param act_mem           Pointer to activation memory, two buffers of BATCH_CHUNK rows.
+ * @param weights_mem       Pointer to the shared memory of the weights: two layers when streamed, all of them when
+ *                          resident (loaded by the caller).
+ * @param out               Pointer to the output memory.
+ * @param last_act          Pointer to the bf16 activations of the last hidden layer (inference with output_width > 16).
+ * @param output_stride     The stride for the output memory.
+ * @param output_width      Width of the output data.
  * @param batch_size        Batch size of the data.
- * @tparam WIDTH            Width of the matrices.
+ * @param chunk             Index of the batch chunk of the work-group.
+ * @tparam WIDTH            Width of the layers.
+ * @tparam N_ITERS          Number of iterations.
+ * @tparam N_HIDDEN_MATMULS Number of hidden matrix multiplications.
  * @tparam ACTIVATION       Type of activation for hidden layers.
+ * @tparam INFERENCE        Whether the hidden layers are not stored.
+ * @tparam WEIGHTS_MEMORY   Where the weights of the hidden layers are read.
  */
-template <int WIDTH, Activation ACTIVATION>
-void dgemm_multiply(queue q,
-	bf16* grads_device,
-	float* loss_gradients,
-	float* fwd,
-	float* A,
-	float* B,
-	float* C,
-	int k,
-	int m_n_hidden_matrices,
-	int batch_size) {
-	const int layer_lenght = WIDTH * batch_size;
-	const int n_hidden_matrices = m_n_hidden_matrices;
+template <int WIDTH, int N_ITERS, int N_HIDDEN_MATMULS, Activation ACTIVATION, bool INFERENCE, WeightsMemory WEIGHTS_MEMORY>
+void kernel_swift_mlp_static(nd_item<1> item,
+	const Activation output_activation,
+	bf16* input,
+	bf16* weights_layer,
+	bf16* out_intermediate_layer,
+	local_accessor<bf16> act_mem,
+	local_accessor<bf16> weights_mem,
+	float* out,
+	bf16* last_act,
+	const uint32_t output_stride,
+	const uint32_t output_width,
+	int batch_size,
+	const int chunk) {
 
-	// Calculate matrix A using the given activation function
-	q.parallel_for<>(range<1>(WIDTH * batch_size), [=](id<1> idx) {
-		int i = idx / batch_size;
-		int j = idx % batch_size;
-		A[i * batch_size + j] = (float)elt_activation_ret<float>(ACTIVATION, fwd[i + j * WIDTH + (n_hidden_matrices - k - 1) * layer_lenght]);
-		});
+	// The two activation buffers of the layers
+	auto a = act_mem.get_pointer();
+	auto a_next = a + BATCH_CHUNK * (WIDTH + SKEW);
 
-	// Assign matrix B using loss gradients
-	q.parallel_for<>(range<1>(WIDTH * batch_size), [=](id<1> idx) {
-		B[idx] = (float)loss_gradients[idx + (n_hidden_matrices - k - 1) * layer_lenght];
-		});
+	// The weights of the current and of the next layer, when they are streamed
+	auto w = weights_mem.get_pointer();
+	auto w_next = w + WIDTH * WIDTH;
 
-	// Perform DGEMM operation
-	oneapi::mkl::blas::row_major::gemm(q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
-		WIDTH, WIDTH, batch_size, 1, A, batch_size, B, WIDTH, 0, C, WIDTH);
+	const int elem_idx = BATCH_CHUNK * chunk;
+	const int layer_length = WIDTH * batch_size;
+	bf16* out_inter = INFERENCE ? nullptr : out_intermediate_layer + elem_idx * WIDTH;
 
-	// Update gradients_device with the computed values
-	q.parallel_for<>(range<1>(WIDTH * WIDTH), [=](id<1> idx) {
-		grads_device[(m_n_hidden_matrices - k - 1) * WIDTH * WIDTH + idx] += C[idx];
-		});
-}
+	if constexpr (WEIGHTS_MEMORY == WeightsMemory::Streamed) {
+		workgroup_load_weights<WIDTH>(item, w, weights_layer, WIDTH * WIDTH);
+	}
+	workgroup_prefetch<WIDTH, N_ITERS>(item, a, input + elem_idx * WIDTH);
+	item.barrier(access::fence_space::local_space);
+
+	// Layer k multiplies by the k-th weight matrix (0 is the first layer)
+	auto layer = [&](int k, bf16* layer_out_inter) {
+		bf16* layer_weights = weights_layer + WIDTH * WIDTH * k;
+		if constexpr (WEIGHTS_MEMORY == WeightsMemory::Resident) {
+			matmul_act_layer_static<WIDTH, N_ITERS, ACTIVATION>(item, a, a_next, weights_mem.get_pointer() + WIDTH * WIDTH * k, layer_out_inter);
+		}
+		else if constexpr (WEIGHTS_MEMORY == WeightsMemory::Streamed) {
+			matmul_act_layer_static<WIDTH, N_ITERS, ACTIVATION>(item, a, a_next, w, layer_out_inter, k < N_HIDDEN_MATMULS ? layer_weights + WIDTH * WIDTH : nullptr, w_next);
+			std::swap(w, w_next);
+		}
+		else {
+			matmul_act_layer_static<WIDTH, N_ITERS, ACTIVATION>(item, a, a_next, device_ptr<bf16>(layer_weights), layer_out_inter);
+		}
+		std::swap(a, a_next);
+	};
 
+	layer(0, out_inter);
+
+#pragma unroll
+	for (int k = 0; k < N_HIDDEN_MATMULS; k++) {
+		layer(k + 1, INFERENCE ? nullptr : out_inter + (k + 1) * layer_length);
+	}
+
+	if (output_width > 16) {
+		if constexpr (INFERENCE) {
+			workgroup_write_output_static<WIDTH, N_ITERS>(item, a, last_act + elem_idx * WIDTH);
+		}
+	}
+	else if (out) {
+		workgroup_last_layer<WIDTH, N_ITERS>(item, output_activation, a, weights_layer + WIDTH * WIDTH * (N_HIDDEN_MATMULS + 1), out + elem_idx * WIDTH, output_stride);
+	}
+}
 
 /**
- * Backward pass for gradient calculation in the SwiftNet model.
+ * Performs the forward pass with the kernel specialized on the depth and the hidden activation, see mlp_swift_forward.
+ * The output activation is applied at runtime by the output layer, as in the generic kernel.
  *
- * @param q                 SYCL queue for command submission.
- * @param weights_transposed Pointer to transposed and packed weights.
- * @param deltas            Pointer to delta values.
- * @param grads_matrices    Pointer to matrices for gradients.
- * @param out_inter         Pointer to intermediate outputs.
- * @param delta_temp        Pointer to temporary delta memory.
- * @param forward           Pointer to forward pass intermediate outputs.
- * @param A_dgemm           Pointer to matrix A for DGEMM.
- * @param B_dgemm           Pointer to matrix B for DGEMM.
- * @param C_dgemm           Pointer to matrix C for DGEMM.
- * @param n_hidden_matmuls Number of hidden matrix multiplications.
+ * @tparam WIDTH             Width of the layers.
+ * @tparam INFERENCE         Whether the hidden layers are not stored.
+ * @tparam N_HIDDEN_LAYERS   Number of hidden layers.
+ * @tparam ACTIVATION        Type of activation for hidden layers.
+ */
+template <int WIDTH, bool INFERENCE, int N_HIDDEN_LAYERS, Activation ACTIVATION>
+void mlp_swift_forward_static(queue q,
+	Activation output_activation,
+	const DeviceMem<bf16>& weights,
+	bf16* inputs,
+	bf16* intermediate_output,
+	DeviceMem<float>& output,
+	bf16* last_act,
+	const int output_stride,
+	const int output_width,
+	int batch_size,
+	int* chunk_counter)
+{
+	const int N_ITERS = BATCH_CHUNK / TM;
+	const int n_chunks = batch_size / BATCH_CHUNK;
+	const int n_groups = persistent_work_groups(q, n_chunks, chunk_counter);
+
+	// The weights stay in shared memory when the activations and the weights of two layers fit in it, wide
+	// networks keep reading them from global memory. The work-groups of a persistent kernel keep all the layers
+	// for all their chunks when they fit.
+	const size_t local_mem_size = q.get_device().get_info<info::device::local_mem_size>();
+	const size_t act_mem_size = 2 * BATCH_CHUNK * (WIDTH + SKEW);
+	const size_t streamed_mem_size = 2 * WIDTH * WIDTH;
+	const size_t resident_mem_size = N_HIDDEN_LAYERS * WIDTH * WIDTH;
+
+	auto launch = [&](auto weights_memory_constant) {
+		constexpr WeightsMemory WEIGHTS_MEMORY = decltype(weights_memory_constant)::value;
+		const size_t weights_mem_size = WEIGHTS_MEMORY == WeightsMemory::Resident ? resident_mem_size : WEIGHTS_MEMORY == WeightsMemory::Streamed ? streamed_mem_size : 1;
+
+		q.submit([&](handler& cgh)
+			{
+				// No fp32 temporary memory: the activations go from the registers to the other bf16 buffer
+				local_accessor<bf16> act_mem = local_accessor<bf16>(range<1>(act_mem_size), cgh);
+				local_accessor<bf16> weights_mem = local_accessor<bf16>(range<1>(weights_mem_size), cgh);
+
+				cgh.parallel_for(
+					nd_range<1>(n_groups * WG_SIZE, WG_SIZE),
+					[=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]]
+					{
+						if constexpr (WEIGHTS_MEMORY == WeightsMemory::Resident) {
+							// Made visible by the barrier after the input of the first chunk
+							workgroup_load_weights<WIDTH>(item, weights_mem.get_pointer(), weights.data(), N_HIDDEN_LAYERS * WIDTH * WIDTH);
+						}
+						for (int chunk = workgroup_next_chunk(item, chunk_counter, -1, n_chunks); chunk < n_chunks; chunk = workgroup_next_chunk(item, chunk_counter, chunk, n_chunks)) {
+							kernel_swift_mlp_static<WIDTH, N_ITERS, N_HIDDEN_LAYERS - 1, ACTIVATION, INFERENCE, WEIGHTS_MEMORY>(item,
+								output_activation,
+								inputs,
+								weights.data(),
+								intermediate_output,
+								act_mem,
+								weights_mem,
+								output.data(),
+								last_act,
+								output_stride,
+								output_width,
+								batch_size,
+								chunk);
+						}
+					});
+			}).wait();
+	};
+
+	if (chunk_counter && (act_mem_size + resident_mem_size) * sizeof(bf16) <= local_mem_size) {
+		launch(std::integral_constant<WeightsMemory, WeightsMemory::Resident>{});
+	}
+	else if ((act_mem_size + streamed_mem_size) * sizeof(bf16) <= local_mem_size) {
+		launch(std::integral_constant<WeightsMemory, WeightsMemory::Streamed>{});
+	}
+	else {
+		launch(std::integral_constant<WeightsMemory, WeightsMemory::Global>{});
+	}
+}
+
+// Number of hidden layers up to which the production shapes have specialized kernels
+#define STATIC_MAX_HIDDEN_LAYERS 4
+
+template <int WIDTH, bool INFERENCE, typename T = bf16>
+using StaticForward = void (*)(queue, Activation, const DeviceMem<T>&, T*, T*, DeviceMem<float>&, T*, const int, const int, int, int*);
+
+// Configuration of the network a specialized kernel is generated for, the output activation is a runtime argument
+struct StaticKernelKey {
+	int n_hidden_layers;
+	Activation activation;
+};
+
+// Adds the specialized forward passes of an activation for every depth of the sequence (offset by one)
+template <int WIDTH, bool INFERENCE, Activation ACTIVATION, int... DEPTHS>
+void add_static_forwards(std::vector<std::pair<StaticKernelKey, StaticForward<WIDTH, INFERENCE>>>& table, std::integer_sequence<int, DEPTHS...>) {
+	(table.push_back({ { DEPTHS + 1, ACTIVATION }, &mlp_swift_forward_static<WIDTH, INFERENCE, DEPTHS + 1, ACTIVATION> }), ...);
+}
+
+/**
+ * Find the forward pass specialized on a configuration of the network.
+ * The table is generated for the production shapes: every depth up to STATIC_MAX_HIDDEN_LAYERS with the
+ * hidden activations below. The output activation is given to the specialized pass at runtime and handled by
+ * the same output layer as the generic kernel, so that both kernels give the same outputs.
+ *
+ * @param n_hidden_layers Number of hidden layers.
+ * @param activation      Activation function for hidden layers.
+ * @tparam T              Element type of the network, the kernels are only specialized for bf16.
+ * @return The specialized forward pass, or nullptr when the generic kernel has to be used.
+ */
+template <int WIDTH, bool INFERENCE, typename T = bf16>
+StaticForward<WIDTH, INFERENCE, T> find_static_forward(int n_hidden_layers, Activation activation) {
+	static const std::vector<std::pair<StaticKernelKey, StaticForward<WIDTH, INFERENCE, T>>> table = []() {
+		std::vector<std::pair<StaticKernelKey, StaticForward<WIDTH, INFERENCE, T>>> table;
+		if constexpr (std::is_same<T, bf16>::value) {
+			const auto depths = std::make_integer_sequence<int, STATIC_MAX_HIDDEN_LAYERS>();
+			add_static_forwards<WIDTH, INFERENCE, Activation::ReLU>(table, depths);
+			add_static_forwards<WIDTH, INFERENCE, Activation::LeakyReLU>(table, depths);
+			add_static_forwards<WIDTH, INFERENCE, Activation::Sigmoid>(table, depths);
+		}
+		return table;
+	}();
+
+	for (const auto& entry : table) {
+		if (entry.first.n_hidden_layers == n_hidden_layers && entry.first.activation == activation) {
+			return entry.second;
+		}
+	}
+	return nullptr;
+}
+
+// Largest batch of the latency kernel of the inference
+#define LATENCY_MAX_BATCH 256
+
+/**
+ * Kernel function of one hidden layer of the inference of small batches, see mlp_swift_inference_latency.
+ * Every work-group is a single sub-group computing one tile of TM rows and TN columns of the layer, from the full
+ * rows of the previous layer in global memory.
+ *
+ * @param item           The SYCL nd_item representing the work item.
+ * @param src            Pointer to the activations of the previous layer (or the input), batch_size rows.
+ * @param weights_layer  Pointer to the packed weights of the layer.
+ * @param dst            Pointer to the activations of the layer, batch_size rows.
+ * @tparam WIDTH         Width of the layers.
+ * @tparam ACTIVATION    Type of activation for hidden layers.
+ * @tparam T             Element type of the activations and weights (bf16 or half).
+ */
+template <int WIDTH, Activation ACTIVATION, typename T = bf16>
+void kernel_swift_mlp_latency(nd_item<1> item,
+	T* src,
+	T* weights_layer,
+	T* dst) {
+	static_assert(SG_SIZE == TN, "The accumulator elements of a work item must be a column of the tile.");
+
+	constexpr int N_COL_TILES = WIDTH / TN;
+	auto sg = item.get_sub_group();
+	const int id = item.get_local_id(0);
+	const int row_tile = item.get_group(0) / N_COL_TILES;
+	const int col_tile = item.get_group(0) % N_COL_TILES;
+	const int first_row = TM * row_tile;
+
+	device_ptr<T> in(src);
+	device_ptr<T> w(weights_layer);
+
+	joint_matrix<sub_group, T, use::a, TM, TK, layout::row_major> act_matrix;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix;
+	joint_matrix<sub_group, float, use::accumulator, TM, TN> result_matrix;
+
+	joint_matrix_fill(sg, result_matrix, 0.0f);
+#pragma unroll
+	for (int b = 0; b < WIDTH / TK; b++) {
+		joint_matrix_load(sg, act_matrix, in + TK * b + first_row * WIDTH, WIDTH);
+		joint_matrix_load(sg, weight_matrix, w + TN * 2 * col_tile + TK / 2 * b * WIDTH * 2, WIDTH * 2);
+		result_matrix = joint_matrix_mad(sg, act_matrix, weight_matrix, result_matrix);
+	}
+
+	auto wi_data_c = get_wi_data(sg, result_matrix);
+#pragma unroll
+	for (int r = 0; r < wi_data_c.length(); r++) {
+		dst[(first_row + r) * WIDTH + TN * col_tile + id] = (T)ActivationFunctor<ACTIVATION>::forward((float)wi_data_c[r]);
+	}
+}
+
+/**
+ * Performs the hidden layers of the inference of a small batch, with a latency kernel splitting the output
+ * columns (N dimension) of every layer over the work-groups. The generic kernel only launches one work-group per
+ * BATCH_CHUNK rows, i.e. a few work-groups for a small batch, each computing all the layers in sequence. Here
+ * batch_size / TM * WIDTH / TN work-groups share every layer. The layers are launched one after the other, the
+ * dependency between two launches being the only synchronization: no work-group waits for another one, so the
+ * work-groups do not need to be resident together. The output layer is left to the caller.
+ *
+ * @param q               SYCL queue for command submission.
+ * @param weights         Pointer to weights of the model.
+ * @param inputs          Pointer to the input data.
+ * @param act             Pointer to the scratch memory of the activations, 2 * batch_size * WIDTH values.
+ * @param last_act        Pointer to the bf16 activations of the last hidden layer.
+ * @param n_hidden_layers Number of hidden layers.
+ * @param batch_size      Batch size of the data.
+ * @tparam WIDTH          Width of the layers.
+ * @tparam ACTIVATION     Type of activation for hidden layers.
+ * @tparam T              Element type of the activations and weights (bf16 or half).
+ */
+template <int WIDTH, Activation ACTIVATION, typename T = bf16>
+void mlp_swift_inference_latency(queue q,
+	T* weights,
+	T* inputs,
+	T* act,
+	T* last_act,
+	const int n_hidden_layers,
+	const int batch_size)
+{
+	const int n_groups = batch_size / TM * (WIDTH / TN);
+
+	// Every launch depends on the previous one, the host only waits for the last layer
+	event layer_done;
+	for (int l = 0; l < n_hidden_layers; l++) {
+		T* src = l == 0 ? inputs : act + ((l - 1) % 2) * batch_size * WIDTH;
+		T* weights_layer = weights + WIDTH * WIDTH * l;
+		T* dst = l == n_hidden_layers - 1 ? last_act : act + (l % 2) * batch_size * WIDTH;
+		layer_done = q.parallel_for(nd_range<1>(n_groups * SG_SIZE, SG_SIZE), layer_done, [=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]] {
+			kernel_swift_mlp_latency<WIDTH, ACTIVATION>(item, src, weights_layer, dst);
+			});
+	}
+	layer_done.wait();
+}
+
+/**
+ * Kernel function for the grouped inference of several Swift MLP models.
+ * Every work-group evaluates one chunk of BATCH_CHUNK rows with the weights of the model of its chunk. The output
+ * layer is computed in the kernel as well, each sub-group handling every n_sgs-th block of TN output columns.
+ *
+ * @param item              The SYCL nd_item representing the work item.
+ * @param output_activation The type of activation to be applied for output layer.
+ * @param input             Pointer to the input data, sorted by model.
+ * @param weights           Pointer to the packed weights of all the models, one after the other.
+ * @param chunk_models      Pointer to the model of every chunk, -1 for the chunks without input.
+ * @param forward           Pointer to the storage of the activated hidden layers for training (nullptr in inference).
+ * @param act_mem           Pointer to activation memory.
+ * @param act_mem_temp      Pointer to temporary activation memory.
+ * @param out               Pointer to the output memory.
+ * @param n_params          Number of parameters of a model.
+ * @param output_width      Width of the output data.
+ * @param n_hidden_matmuls  Number of hidden matrix multiplications.
+ * @param layer_length      Size of a layer in forward (all rows).
+ * @tparam WIDTH            Width of the layers.
+ * @tparam N_ITERS          Number of iterations.
+ * @tparam activation       Type of activation for hidden layers.
+ */
+template <int WIDTH, int N_ITERS, Activation activation>
+void kernel_swift_mlp_group(nd_item<1> item,
+	const Activation output_activation,
+	const bf16* input,
+	bf16* weights,
+	const int* chunk_models,
+	bf16* forward,
+	local_accessor<bf16> act_mem,
+	local_accessor<float> act_mem_temp,
+	float* out,
+	const int n_params,
+	const int output_width,
+	const uint32_t n_hidden_matmuls,
+	const int layer_length) {
+
+	auto a = act_mem.get_pointer();
+	auto at = act_mem_temp.get_pointer();
+
+	auto sg = item.get_sub_group();
+	int id = item.get_local_id() % SG_SIZE;
+	int sgId = sg.get_group_id();
+	const int n_sgs = sg.get_group_range()[0];
+	const int wg_idx = item.get_group().get_group_id();
+	const int elem_idx = BATCH_CHUNK * wg_idx;
+
+	// The whole work-group leaves together, before any barrier
+	const int model = chunk_models[wg_idx];
+	if (model < 0) {
+		return;
+	}
+	bf16* weights_model = weights + model * n_params;
+
+	workgroup_prefetch<WIDTH, N_ITERS>(item, a, input + elem_idx * WIDTH);
+	group_barrier(item.get_group());
+
+	for (int k = 0; k <= n_hidden_matmuls; k++) {
+		bf16* out_inter = forward ? forward + (k + 1) * layer_length + elem_idx * WIDTH : nullptr;
+		matmul_act_layer<WIDTH, N_ITERS, false>(item, activation, a, at, weights_model + k * WIDTH * WIDTH, out_inter);
+		group_barrier(item.get_group());
+	}
+
+	// Output layer, its packed matrix has rows of output_width pairs
+	device_ptr<bf16> w(weights_model + (n_hidden_matmuls + 1) * WIDTH * WIDTH);
+	device_ptr<float> o(out + elem_idx * output_width);
+	const int N_BLOCKS = WIDTH / TK;
+
+	joint_matrix<sub_group, bf16, use::a, TM, TK, layout::row_major> act_matrix;
+	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix;
+	joint_matrix<sub_group, float, use::accumulator, TM, TN> result_matrix;
+
+	for (int c = sgId; c < output_width / TN; c += n_sgs) {
+		for (int l = 0; l < N_ITERS; l++) {
+			joint_matrix_fill(sg, result_matrix, 0.0f);
+			for (int b = 0; b < N_BLOCKS; b++) {
+				joint_matrix_load(sg, act_matrix, a + TK * b + TM * l * (WIDTH + SKEW), WIDTH + SKEW);
+				joint_matrix_load(sg, weight_matrix, w + TN * 2 * c + TK / 2 * b * output_width * 2, output_width * 2);
+				result_matrix = joint_matrix_mad(sg, act_matrix, weight_matrix, result_matrix);
+			}
+			joint_matrix_store(sg, result_matrix, o + TN * c + TM * l * output_width, output_width, layout::row_major);
+		}
+	}
+
+	if (output_activation != Activation::None) {
+		group_barrier(sg);
+		for (int c = sgId; c < output_width / TN; c += n_sgs) {
+			for (int k = 0; k < BATCH_CHUNK; k++) {
+				const int idx = TN * c + k * output_width + id % TN;
+				if (id < TN) {
+					o[idx] = elt_activation_ret<float>(output_activation, o[idx]);
+				}
+			}
+		}
+	}
+}
+
+
+/**
+ * Computes a layer of K inputs and N outputs of a network with per-layer widths.
+ * All the layers share the activation memory with a row stride of MAX_WIDTH + SKEW. As the outputs may be wider or
+ * narrower than the inputs, the products are computed into at, and activated back into a once all of a is read.
+ *
+ * @param item          The SYCL nd_item representing the work item.
+ * @param activation    The type of activation to be applied.
+ * @param a             Pointer to activation memory.
+ * @param at            Pointer to temporary activation memory.
+ * @param weights_layer Pointer to the packed K x N weights of the layer.
+ * @tparam K            Width of the input of the layer.
+ * @tparam N            Width of the output of the layer.
+ * @tparam MAX_WIDTH    Largest width of the network.
+ * @tparam N_ITERS      Number of iterations.
+ */
+template <int K, int N, int MAX_WIDTH, int N_ITERS>
+void matmul_act_layer_var_width(nd_item<1> item,
+	Activation activation,
+	multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> a,
+	multi_ptr<float, access::address_space::local_space, (access::decorated)2> at,
+	bf16* weights_layer) {
+
+	auto sg = item.get_sub_group();
+	int sgId = sg.get_group_id();
+	const int li = item.get_local_id(0);
+	constexpr int N_SGS = WG_SIZE / SG_SIZE;
+	device_ptr<bf16> w(weights_layer);
+
+	joint_matrix<sub_group, bf16, use::a, TM, TK, layout::row_major> act_matrix;
+	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix;
+	joint_matrix<sub_group, float, use::accumulator, TM, TN> result_matrix;
+
+	for (int c = sgId; c < N / TN; c += N_SGS) {
+#pragma unroll
+		for (int l = 0; l < N_ITERS; l++) {
+			joint_matrix_fill(sg, result_matrix, 0.0f);
+#pragma unroll
+			for (int b = 0; b < K / TK; b++) {
+				joint_matrix_load(sg, act_matrix, a + TK * b + TM * l * (MAX_WIDTH + SKEW), MAX_WIDTH + SKEW);
+				joint_matrix_load(sg, weight_matrix, w + TN * 2 * c + TK / 2 * b * N * 2, N * 2);
+				result_matrix = joint_matrix_mad(sg, act_matrix, weight_matrix, result_matrix);
+			}
+			joint_matrix_store(sg, result_matrix, at + TN * c + TM * l * (MAX_WIDTH + SKEW), MAX_WIDTH + SKEW, layout::row_major);
+		}
+	}
+	group_barrier(item.get_group());
+
+	for (int p = li; p < BATCH_CHUNK * N; p += WG_SIZE) {
+		const int idx = (p / N) * (MAX_WIDTH + SKEW) + p % N;
+		elt_activation<float, bf16>(activation, at[idx], a[idx]);
+	}
+	group_barrier(item.get_group());
+}
+
+/**
+ * Computes the hidden layers of a network with per-layer widths, one instantiation per pair of consecutive widths.
+ *
+ * @param item       The SYCL nd_item representing the work item.
+ * @param activation The type of activation to be applied.
+ * @param a          Pointer to activation memory.
+ * @param at         Pointer to temporary activation memory.
+ * @param weights    Pointer to the packed weights of the first remaining layer, the others following it.
+ * @tparam MAX_WIDTH Largest width of the network.
+ * @tparam N_ITERS   Number of iterations.
+ * @tparam K         Width of the input of the first remaining layer.
+ * @tparam N         Width of its output.
+ * @tparam REST      Widths of the outputs of the next layers.
+ */
+template <int MAX_WIDTH, int N_ITERS, int K, int N, int... REST>
+void var_width_hidden_layers(nd_item<1> item,
+	Activation activation,
+	multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> a,
+	multi_ptr<float, access::address_space::local_space, (access::decorated)2> at,
+	bf16* weights) {
+
+	matmul_act_layer_var_width<K, N, MAX_WIDTH, N_ITERS>(item, activation, a, at, weights);
+	if constexpr (sizeof...(REST) > 0) {
+		var_width_hidden_layers<MAX_WIDTH, N_ITERS, N, REST...>(item, activation, a, at, weights + K * N);
+	}
+}
+
+/**
+ * Kernel function for the inference of a network with per-layer widths.
+ * The output layer is computed in the kernel, each sub-group handling every N_SGS-th block of TN output columns.
+ *
+ * @param item              The SYCL nd_item representing the work item.
+ * @param activation        The type of activation to be applied for hidden layers.
+ * @param output_activation The type of activation to be applied for output layer.
+ * @param input             Pointer to the input data.
+ * @param weights           Pointer to the packed weights, the output matrix last.
+ * @param act_mem           Pointer to activation memory.
+ * @param act_mem_temp      Pointer to temporary activation memory.
+ * @param out               Pointer to the output memory.
+ * @param output_width      Width of the output data, a multiple of TN.
+ * @tparam N_ITERS          Number of iterations.
+ * @tparam WIDTHS           Widths of the input and the hidden layers.
+ */
+template <int N_ITERS, int... WIDTHS>
+void kernel_swift_mlp_var_width(nd_item<1> item,
+	const Activation activation,
+	const Activation output_activation,
+	const bf16* input,
+	bf16* weights,
+	local_accessor<bf16> act_mem,
+	local_accessor<float> act_mem_temp,
+	float* out,
+	const int output_width) {
+
+	constexpr int widths[] = { WIDTHS... };
+	constexpr int INPUT_WIDTH = widths[0];
+	constexpr int LAST_WIDTH = widths[sizeof...(WIDTHS) - 1];
+	constexpr int MAX_WIDTH = std::max({ WIDTHS... });
+	constexpr int N_SGS = WG_SIZE / SG_SIZE;
+
+	auto a = act_mem.get_pointer();
+	auto at = act_mem_temp.get_pointer();
+	auto sg = item.get_sub_group();
+	int sgId = sg.get_group_id();
+	const int li = item.get_local_id(0);
+	const int elem_idx = BATCH_CHUNK * item.get_group(0);
+
+	for (int p = li; p < BATCH_CHUNK * INPUT_WIDTH; p += WG_SIZE) {
+		a[(p / INPUT_WIDTH) * (MAX_WIDTH + SKEW) + p % INPUT_WIDTH] = input[elem_idx * INPUT_WIDTH + p];
+	}
+	group_barrier(item.get_group());
+
+	var_width_hidden_layers<MAX_WIDTH, N_ITERS, WIDTHS...>(item, activation, a, at, weights);
+
+	// Output layer, its packed matrix has rows of output_width pairs
+	device_ptr<bf16> w(weights + var_width_n_hidden_params<WIDTHS...>());
+	device_ptr<float> o(out + elem_idx * output_width);
+
+	joint_matrix<sub_group, bf16, use::a, TM, TK, layout::row_major> act_matrix;
+	joint_matrix<sub_group, bf16, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix;
+	joint_matrix<sub_group, float, use::accumulator, TM, TN> result_matrix;
+
+	for (int c = sgId; c < output_width / TN; c += N_SGS) {
+#pragma unroll
+		for (int l = 0; l < N_ITERS; l++) {
+			joint_matrix_fill(sg, result_matrix, 0.0f);
+#pragma unroll
+			for (int b = 0; b < LAST_WIDTH / TK; b++) {
+				joint_matrix_load(sg, act_matrix, a + TK * b + TM * l * (MAX_WIDTH + SKEW), MAX_WIDTH + SKEW);
+				joint_matrix_load(sg, weight_matrix, w + TN * 2 * c + TK / 2 * b * output_width * 2, output_width * 2);
+				result_matrix = joint_matrix_mad(sg, act_matrix, weight_matrix, result_matrix);
+			}
+			joint_matrix_store(sg, result_matrix, o + TN * c + TM * l * output_width, output_width, layout::row_major);
+		}
+	}
+
+	if (output_activation != Activation::None) {
+		group_barrier(item.get_group());
+		for (int p = li; p < BATCH_CHUNK * output_width; p += WG_SIZE) {
+			o[p] = elt_activation_ret<float>(output_activation, o[p]);
+		}
+	}
+}
+
+
+/**
+ * Execute the action made by a work-group to calculate the next layer in int8.
+ *
+ * The int8 activations are multiplied by the int8 weights with int32 accumulation, the weight tiles being loaded
+ * straight from global memory in their VNNI layout (4 rows of K interleaved). The per-tensor scale of the
+ * activations and the per-output-channel scale of the weights factor out of the dot products, so the
+ * dequantization is fused with the activation in registers, which then requantizes with the scale of the next
+ * layer input. The layers alternate between two activation buffers, a single barrier per layer is needed.
+ * With SG_SIZE == TN, work item id holds column id of the TM rows of the accumulator.
+ *
+ * @param item          The SYCL nd_item representing the work item.
+ * @param activation    The type of activation to be applied.
+ * @param a_in          Pointer to the int8 activations read by the layer.
+ * @param a_out         Pointer to the int8 activations receiving the requantized outputs.
+ * @param weights_layer Pointer to the int8 weights for the layer, in the VNNI layout.
+ * @param scales_layer  Pointer to the scales of the output channels of the layer.
+ * @param act_scale     Scale of the int8 activations read by the layer.
+ * @param inv_out_scale Inverse of the scale of the int8 activations written by the layer.
+ * @param last_act      Pointer receiving the bf16 activations when the layer is the last one, nullptr otherwise.
+ * @tparam WIDTH        Width of the layer.
+ * @tparam N_ITERS      Number of iterations.
+ * @tparam T            Element type of the activations and weights (bf16 or half).
+ */
+template <int WIDTH, int N_ITERS, typename T = bf16>
+void matmul_act_layer_int8(nd_item<1> item,
+	Activation activation,
+	multi_ptr<int8_t, access::address_space::local_space, (access::decorated)2> a_in,
+	multi_ptr<int8_t, access::address_space::local_space, (access::decorated)2> a_out,
+	int8_t* weights_layer,
+	const float* scales_layer,
+	const float act_scale,
+	const float inv_out_scale,
+	T* last_act) {
+	static_assert(SG_SIZE == TN, "The accumulator elements of a work item must be a column of the tile.");
+
+	// The int8 joint_matrix consumes 4 elements per VNNI row, K is twice the bf16 one
+	constexpr int TK_INT8 = 2 * TK;
+	constexpr int N_BLOCKS = WIDTH / TK_INT8;
+
+	auto sg = item.get_sub_group();
+	int id = item.get_local_id() % SG_SIZE;
+	int sgId = sg.get_group_id();
+	device_ptr<int8_t> w(weights_layer);
+
+	joint_matrix<sub_group, int8_t, use::a, TM, TK_INT8, layout::row_major> act_matrix;
+	joint_matrix<sub_group, int8_t, use::b, TK_INT8, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix;
+	joint_matrix<sub_group, int32_t, use::accumulator, TM, TN> result_matrix;
+
+	const float dequant_scale = act_scale * scales_layer[TN * sgId + id];
+
+	for (int l = 0; l < N_ITERS; l++) {
+		joint_matrix_fill(sg, result_matrix, 0);
+		for (int b = 0; b < N_BLOCKS; b++) {
+			joint_matrix_load(sg, act_matrix, a_in + TK_INT8 * b + TM * l * (WIDTH + SKEW), WIDTH + SKEW);
+			joint_matrix_load(sg, weight_matrix, w + TN * 4 * sgId + TK_INT8 / 4 * b * WIDTH * 4, WIDTH * 4);
+			result_matrix = joint_matrix_mad(sg, act_matrix, weight_matrix, result_matrix);
+		}
+
+		// Dequantize, activate and requantize the accumulator in registers
+		auto wi_data_c = get_wi_data(sg, result_matrix);
+		for (int r = 0; r < wi_data_c.length(); r++) {
+			float result = (float)(int32_t)wi_data_c[r] * dequant_scale;
+			const float activated = elt_activation_ret<float>(activation, result);
+			if (last_act) {
+				last_act[TN * sgId + WIDTH * (TM * l + r) + id] = (T)activated;
+			}
+			else {
+				a_out[TN * sgId + (WIDTH + SKEW) * (TM * l + r) + id] = (int8_t)sycl::clamp(sycl::round(activated * inv_out_scale), -127.0f, 127.0f);
+			}
+		}
+	}
+
+	// Every sub-group has read a_in before the next layer overwrites it
+	item.barrier(access::fence_space::local_space);
+}
+
+
+/**
+ * Kernel function for the inference of the Swift MLP model in int8.
+ * The input is quantized with the scale of the first layer while it is loaded, the input and hidden layers are
+ * computed in int8, and the activations of the last hidden layer are written in bf16 to last_act for the output
+ * layer.
+ *
+ * @param item             The SYCL nd_item representing the work item.
+ * @param activation       The type of activation of the hidden layers.
+ * @param input            Pointer to input data.
+ * @param weights          Pointer to the int8 weights, in the VNNI layout.
+ * @param scales           Pointer to the scales of the output channels (WIDTH per matrix).
+ * @param act_scales       Pointer to the scales of the activations read by every matrix.
+ * @param act_mem          Int8 activation memory.
+ * @param act_mem_next     Int8 activation memory of the next layer.
+ * @param last_act         Pointer to the bf16 activations of the last hidden layer.
+ * @param n_hidden_matmuls Number of hidden matrix multiplications.
+ * @tparam WIDTH           Width of the layers.
+ * @tparam N_ITERS         Number of iterations.
+ * @tparam T               Element type of the activations and weights (bf16 or half).
+ */
+template <int WIDTH, int N_ITERS, typename T = bf16>
+void kernel_swift_mlp_int8(nd_item<1> item,
+	const Activation activation,
+	const T* input,
+	int8_t* weights,
+	const float* scales,
+	const float* act_scales,
+	local_accessor<int8_t> act_mem,
+	local_accessor<int8_t> act_mem_next,
+	T* last_act,
+	const uint32_t n_hidden_matmuls) {
+
+	auto a = act_mem.get_pointer();
+	auto a_next = act_mem_next.get_pointer();
+
+	int id = item.get_local_id() % SG_SIZE;
+	int sgId = item.get_sub_group().get_group_id();
+	const int elem_idx = BATCH_CHUNK * item.get_group().get_group_id();
+
+	const float inv_input_scale = 1.0f / act_scales[0];
+	for (int i = 0; i < N_ITERS; i++) {
+		for (int k = 0; k < TM; k++) {
+			const float x = (float)input[elem_idx * WIDTH + TN * sgId + WIDTH * TM * i + k * WIDTH + id];
+			a[TN * sgId + (WIDTH + SKEW) * TM * i + k * (WIDTH + SKEW) + id] = (int8_t)sycl::clamp(sycl::round(x * inv_input_scale), -127.0f, 127.0f);
+		}
+	}
+	item.barrier(access::fence_space::local_space);
+
+	for (int k = 0; k <= n_hidden_matmuls; k++) {
+		const bool last = k == n_hidden_matmuls;
+		matmul_act_layer_int8<WIDTH, N_ITERS>(item, activation, a, a_next, weights + k * WIDTH * WIDTH, scales + k * WIDTH, act_scales[k], last ? 0.0f : 1.0f / act_scales[k + 1], last ? last_act + elem_idx * WIDTH : nullptr);
+		std::swap(a, a_next);
+	}
+}
+
+
+/**
+ * Execute the action made by a work-group to calculate the next layer in the precision T of the joint_matrix.
+ * Every layer has N_BLOCKS = WIDTH / TK weight blocks, loaded from the packed weights of type T.
+ *
+ * @param item          The SYCL nd_item representing the work item.
+ * @param activation    The type of activation to be applied.
+ * @param a             Pointer to activation memory (type T).
+ * @param at            Pointer to temporary activation memory.
+ * @param weights_layer Pointer to the packed weights for the layer (type T).
+ * @tparam T            Element type of the joint_matrix operands (bf16 or half).
+ * @tparam WIDTH        Width of the layer.
+ * @tparam N_ITERS      Number of iterations.
+ */
+template <typename T, int WIDTH, int N_ITERS>
+void matmul_act_layer_typed(nd_item<1> item,
+	Activation activation,
+	multi_ptr<T, access::address_space::local_space, (access::decorated)2> a,
+	multi_ptr<float, access::address_space::local_space, (access::decorated)2> at,
+	T* weights_layer) {
+
+	auto sg = item.get_sub_group();
+	int id = item.get_local_id() % SG_SIZE;
+	int sgId = sg.get_group_id();
+	const int N_BLOCKS = WIDTH / TK;
+
+	device_ptr<T> w(weights_layer);
+
+	joint_matrix<sub_group, T, use::a, TM, TK, layout::row_major> act_matrix;
+	joint_matrix<sub_group, T, use::b, TK, TN, sycl::ext::intel::experimental::matrix::layout::packed> weight_matrix;
+	joint_matrix<sub_group, float, use::accumulator, TM, TN> result_matrix;
+
+	for (int l = 0; l < N_ITERS; l++) {
+		joint_matrix_fill(sg, result_matrix, 0.0f);
+		for (int b = 0; b < N_BLOCKS; b++) {
+			joint_matrix_load(sg, act_matrix, a + TK * b + TM * l * (WIDTH + SKEW), WIDTH + SKEW);
+			joint_matrix_load(sg, weight_matrix, w + TN * 2 * sgId + TK / 2 * b * WIDTH * 2, WIDTH * 2);
+			result_matrix = joint_matrix_mad(sg, act_matrix, weight_matrix, result_matrix);
+		}
+		joint_matrix_store(sg, result_matrix, at + TN * sgId + TM * l * (WIDTH + SKEW), WIDTH + SKEW, layout::row_major);
+	}
+
+	// Every sub-group has read the previous activations before they are overwritten
+	group_barrier(item.get_group());
+
+	for (int i = 0; i < N_ITERS; i++) {
+		for (int k = 0; k < TM; k++) {
+			const int idx = TN * sgId + (WIDTH + SKEW) * TM * i + k * (WIDTH + SKEW) + id;
+			float result = at[idx];
+			a[idx] = (T)elt_activation_ret<float>(activation, result);
+		}
+	}
+	group_barrier(item.get_group());
+}
+
+
+/**
+ * Kernel function for the inference of the Swift MLP model in the precision T.
+ * The inputs are converted to T in the prefetch, the input and hidden layers are computed with the packed
+ * weights of type T and the activations of the last hidden layer are written to last_act for the output layer.
+ *
+ * @param item             The SYCL nd_item representing the work item.
+ * @param activation       The type of activation of the hidden layers.
+ * @param input            Pointer to the input data, in the element type of the network.
+ * @param weights          Pointer to the packed weights of type T.
+ * @param act_mem          Activation memory.
+ * @param act_mem_temp     Temporary activation memory.
+ * @param last_act         Pointer to the activations of the last hidden layer.
+ * @param n_hidden_matmuls Number of hidden matrix multiplications.
+ * @tparam T               Element type of the joint_matrix operands (bf16 or half).
+ * @tparam WIDTH           Width of the layers.
+ * @tparam N_ITERS         Number of iterations.
+ * @tparam inT             Element type of the network (bf16 or half).
+ */
+template <typename T, int WIDTH, int N_ITERS, typename inT>
+void kernel_swift_mlp_typed(nd_item<1> item,
+	const Activation activation,
+	const inT* input,
+	T* weights,
+	local_accessor<T> act_mem,
+	local_accessor<float> act_mem_temp,
+	T* last_act,
+	const uint32_t n_hidden_matmuls) {
+
+	auto a = act_mem.get_pointer();
+	auto at = act_mem_temp.get_pointer();
+
+	int id = item.get_local_id() % SG_SIZE;
+	int sgId = item.get_sub_group().get_group_id();
+	const int elem_idx = BATCH_CHUNK * item.get_group().get_group_id();
+
+	for (int i = 0; i < N_ITERS; i++) {
+		for (int k = 0; k < TM; k++) {
+			a[TN * sgId + (WIDTH + SKEW) * TM * i + k * (WIDTH + SKEW) + id] = (T)(float)input[elem_idx * WIDTH + TN * sgId + WIDTH * TM * i + k * WIDTH + id];
+		}
+	}
+	group_barrier(item.get_group());
+
+	for (int k = 0; k <= n_hidden_matmuls; k++) {
+		matmul_act_layer_typed<T, WIDTH, N_ITERS>(item, activation, a, at, weights + k * WIDTH * WIDTH);
+	}
+
+	for (int i = 0; i < N_ITERS; i++) {
+		for (int k = 0; k < TM; k++) {
+			last_act[elem_idx * WIDTH + TN * sgId + WIDTH * TM * i + k * WIDTH + id] = a[TN * sgId + (WIDTH + SKEW) * TM * i + k * (WIDTH + SKEW) + id];
+		}
+	}
+}
+
+
+/**
+ * Kernel function for backpropagation in the SwiftNet model.
+ *
+ * The hidden matrix multiplications k_begin to k_end - 1 are processed. When the backpropagation does not
+ * reach the first layer (checkpointing), the deltas of the last processed layer are written back to deltas
+ * so that the next segment starts from them.
+ *
+ * @param item             The SYCL nd_item representing the work item.
+ * @param deltas           Pointer to the losses deltas from where the backpropagation starts.
+ * @param a                Pointer to loss gradients for backpropagation.
+ * @param at               Pointer to temporary loss gradients memory.
+ * @param grads            Pointer to gradients for weight updates.
+ * @param weights          Pointer to weights of the model.
+ * @param forward          Pointer to forward pass intermediate outputs (activated bf16 values), starting at layer first_layer.
+ * @param out_inter        Pointer to intermediate output memory, starting at layer first_layer.
+ * @param n_hidden_matmuls Number of hidden matrix multiplications.
+ * @param batch_size       Batch size of the data.
+ * @param k_begin          First hidden matrix multiplication to process.
+ * @param k_end            Last hidden matrix multiplication to process (excluded).
+ * @param first_layer      Index of the first layer held in forward and out_inter.
+ * @param dL_dinput        Pointer to the fp32 gradients of the input, written when the backpropagation reaches the
+ *                         first layer, or nullptr.
+ * @param chunk            Index of the batch chunk of the work-group, -1 for its group id.
+ * @tparam WIDTH           Width of the layers.
+ * @tparam N_ITERS         Number of iterations.
+ * @tparam ACTIVATION      Type of activation for hidden layers.
+ * @tparam N_HIDDEN_MATMULS Number of hidden matrix multiplications when known at compile time (all of them are
+ *                         then processed, fully unrolled), -1 otherwise.
+ * @tparam T                Element type of the activations and weights (bf16 or half).
+ */
+template <int WIDTH, int N_ITERS, Activation ACTIVATION, int N_HIDDEN_MATMULS = -1, typename T = bf16>
+void kernel_swiftnet_backward(
+	nd_item<1> item,
+	T* deltas,
+	multi_ptr<T, access::address_space::local_space, (access::decorated)2> a,
+	multi_ptr<float, access::address_space::local_space, (access::decorated)2> at,
+	float* grads,
+	T* weights,
+	T* forward,
+	T* out_inter,
+	uint32_t n_hidden_matmuls,
+	int batch_size,
+	int k_begin,
+	int k_end,
+	int first_layer,
+	float* dL_dinput = nullptr,
+	const int chunk = -1
+) {
+	auto sg = item.get_sub_group();
+
+
+	int groupId = chunk < 0 ? (int)item.get_group(0) : chunk;
+	int sgId = sg.get_group_id();
+	const int layer_length = WIDTH * batch_size;
+
+	workgroup_prefetch<WIDTH, N_ITERS>(item, a, deltas + groupId * BATCH_CHUNK * WIDTH);
+
+	auto backward_layer = [&](int k) {
+		matmul_act_layer<WIDTH, N_ITERS, true, T>(
+			item,
+			ACTIVATION,
+			a,
+			at,
+			weights + WIDTH * WIDTH * (n_hidden_matmuls - k),
+			out_inter + groupId * BATCH_CHUNK * WIDTH + (n_hidden_matmuls - k - 1 - first_layer) * layer_length,
+			forward + WIDTH * batch_size * (n_hidden_matmuls - k - first_layer) + groupId * BATCH_CHUNK * WIDTH
+		);
+	};
+
+	// Iterate through hidden layers for backpropagation
+	if constexpr (N_HIDDEN_MATMULS >= 0) {
+#pragma unroll
+		for (int k = 0; k < N_HIDDEN_MATMULS; k++) {
+			backward_layer(k);
+		}
+	}
+	else {
+		for (int k = k_begin; k < k_end; k++) {
+			backward_layer(k);
+		}
+	}
+
+	// Hand the deltas over to the next segment
+	if (k_end < n_hidden_matmuls) {
+		group_barrier(item.get_group());
+		workgroup_write_output_static<WIDTH, N_ITERS>(item, a, deltas + groupId * BATCH_CHUNK * WIDTH);
+	}
+
+	// One more product with the transposed first layer, which has no activation, gives the gradients of the input
+	else if (dL_dinput) {
+		matmul_act_layer<WIDTH, N_ITERS, true, float>(
+			item,
+			Activation::None,
+			a,
+			at,
+			weights,
+			dL_dinput + groupId * BATCH_CHUNK * WIDTH,
+			forward + groupId * BATCH_CHUNK * WIDTH
+		);
+	}
+}
+
+/**
+ * Kernel function for the backward pass of a group of models, every work-group backpropagates the deltas of its
+ * chunk through the transposed weights of the model of the chunk.
+ *
+ * @param item             The SYCL nd_item representing the work item.
+ * @param a                Pointer to activation memory.
+ * @param at               Pointer to temporary activation memory.
+ * @param chunk_models     Pointer to the model of every chunk.
+ * @param weightsT         Pointer to the transposed and packed weights of all the models.
+ * @param n_params         Number of parameters of a model.
+ * @param forward          Pointer to the stored activations (input and hidden layers).
+ * @param out_inter        Pointer to the deltas of the hidden layers, the last one is already computed.
+ * @param n_hidden_matmuls Number of hidden matrix multiplications.
+ * @param batch_size       Number of rows of all the models.
+ * @tparam WIDTH           Width of the layers.
+ * @tparam N_ITERS         Number of iterations.
+ * @tparam ACTIVATION      Type of activation for hidden layers.
+ */
+template <int WIDTH, int N_ITERS, Activation ACTIVATION>
+void kernel_swiftnet_backward_group(
+	nd_item<1> item,
+	multi_ptr<bf16, access::address_space::local_space, (access::decorated)2> a,
+	multi_ptr<float, access::address_space::local_space, (access::decorated)2> at,
+	const int* chunk_models,
+	bf16* weightsT,
+	const int n_params,
+	bf16* forward,
+	bf16* out_inter,
+	uint32_t n_hidden_matmuls,
+	int batch_size
+) {
+	const int model = chunk_models[item.get_group(0)];
+	kernel_swiftnet_backward<WIDTH, N_ITERS, ACTIVATION>(item, out_inter + n_hidden_matmuls * WIDTH * batch_size, a, at, nullptr, weightsT + model * n_params, forward, out_inter, n_hidden_matmuls, batch_size, 0, n_hidden_matmuls, 0);
+}
+
+/**
+ * Recomputes the activations of a segment of layers from its first layer (checkpoint) for the backward pass.
+ *
+ * @param item             The SYCL nd_item representing the work item.
+ * @param activation       The type of activation to be applied.
+ * @param a                Pointer to activation memory.
+ * @param at               Pointer to temporary activation memory.
+ * @param weights          Pointer to weights of the model.
+ * @param segment          Pointer to the segment memory, its first layer holds the checkpoint.
+ * @param first_layer      Index of the checkpoint layer.
+ * @param n_layers         Number of layers to recompute after the checkpoint.
+ * @param batch_size       Batch size of the data.
+ * @tparam WIDTH           Width of the layers.
+ * @tparam N_ITERS         Number of iterations.
+ * @tparam T               Element type of the activations and weights (bf16 or half).
+ */
+template <int WIDTH, int N_ITERS, typename T = bf16>
+void kernel_swift_mlp_recompute(nd_item<1> item,
+	Activation activation,
+	multi_ptr<T, access::address_space::local_space, (access::decorated)2> a,
+	multi_ptr<float, access::address_space::local_space, (access::decorated)2> at,
+	T* weights,
+	T* segment,
+	int first_layer,
+	int n_layers,
+	int batch_size) {
+
+	const int elem_idx = BATCH_CHUNK * item.get_group(0);
+	const int layer_length = WIDTH * batch_size;
+
+	workgroup_prefetch<WIDTH, N_ITERS>(item, a, segment + elem_idx * WIDTH);
+
+	// The layer first_layer + j is the output of the weight matrix first_layer + j - 1
+	for (int j = 1; j <= n_layers; j++) {
+		matmul_act_layer<WIDTH, N_ITERS, false>(item,
+			activation,
+			a,
+			at,
+			weights + (first_layer + j - 1) * WIDTH * WIDTH,
+			segment + elem_idx * WIDTH + j * layer_length);
+	}
+}
+
+/**
+ * Computes the weight gradients of all hidden layers with a single batched DGEMM in the SwiftNet model.
+ *
+ * The forward pass stores the activated outputs of every layer in bf16 with a batch x WIDTH layout, so they
+ * are fed as they are to the bf16 x bf16 -> fp32 gemm_batch call, which handles the transposition. The
+ * gradients are kept in fp32, so the results of all layers are accumulated into them by the call itself.
+ *
+ * @param q                 SYCL queue for command submission.
+ * @param grads_device      Pointer to device memory for the fp32 gradients.
+ * @param loss_gradients    Pointer to loss gradients for backpropagation (one layer after the other).
+ * @param fwd               Pointer to forward pass intermediate outputs (activated bf16 values).
+ * @param m_n_hidden_matrices Number of hidden matrix multiplications.
+ * @param batch_size        Batch size of the data.
+ * @tparam WIDTH            Width of the matrices.
+ * @tparam T                Element type of the activations and weights (bf16 or half).
+ */
+template <int WIDTH, typename T = bf16>
+void dgemm_multiply(queue q,
+	float* grads_device,
+	T* loss_gradients,
+	T* fwd,
+	int m_n_hidden_matrices,
+	int batch_size) {
+	const int layer_lenght = WIDTH * batch_size;
+	const int n_hidden_matrices = m_n_hidden_matrices;
+
+	if (n_hidden_matrices == 0) {
+		return;
+	}
+
+	// Perform one DGEMM per layer in a single call and accumulate into the gradients: G_k += A_k^T * B_k
+	oneapi::mkl::blas::row_major::gemm_batch(q, oneapi::mkl::transpose::trans, oneapi::mkl::transpose::nontrans,
+		WIDTH, WIDTH, batch_size, 1, fwd, WIDTH, layer_lenght, loss_gradients, WIDTH, layer_lenght, 1, grads_device, WIDTH, WIDTH * WIDTH, n_hidden_matrices).wait();
+}
+
+
+/**
+ * Backward pass for gradient calculation in the SwiftNet model.
+ *
+ * With a checkpoint interval K > 1, only every K-th layer has been stored by the forward pass. The layers are then
+ * processed by segments of K, from the last one to the first one: the missing activations of a segment are
+ * recomputed from its checkpoint with the fused forward layers, the deltas are backpropagated through the segment
+ * and its weight gradients are computed, so that only one segment of activations and deltas is alive at a time.
+ *
+ * @param q                 SYCL queue for command submission.
+ * @param weights           Pointer to packed weights (used to recompute the activations).
+ * @param weights_transposed Pointer to transposed and packed weights.
+ * @param deltas            Pointer to delta values.
+ * @param grads_matrices    Pointer to matrices for fp32 gradients.
+ * @param out_inter         Pointer to intermediate outputs (one segment when checkpointing).
+ * @param delta_temp        Pointer to temporary delta memory.
+ * @param forward           Pointer to forward pass intermediate outputs (activated bf16 values of the stored layers).
+ * @param segment           Pointer to the memory of the recomputed segment (K + 1 layers, unused without checkpointing).
+ * @param n_hidden_matmuls  Number of hidden matrix multiplications.
  * @param batch_size        Batch size of the data.
+ * @param checkpoint_interval Number of layers between two stored layers.
+ * @param dL_dinput         Pointer to the fp32 gradients of the input, computed by the kernel, or nullptr.
+ * @param chunk_counter     Device counter of the persistent backward kernel, or nullptr for one work-group per chunk.
  * @tparam WIDTH            Width of the matrices.
  * @tparam ACTIVATION       Type of activation for hidden layers.
+ * @tparam T                Element type of the activations and weights (bf16 or half).
+ */
+template<int WIDTH, Activation ACTIVATION, typename T = bf16>
+void mlp_swiftnet_backward(
+	queue q,
+	DeviceMem<T>& weights,
+	DeviceMem<T>& weights_transposed,
+	DeviceMem<T>& deltas,
+	DeviceMem<float>& grads_matrices,
+	T* out_inter,
+	float* delta_temp_,
+	T* forward,
+	T* segment,
+	const uint32_t n_hidden_matmuls,
+	int batch_size,
+	const int checkpoint_interval,
+	float* dL_dinput = nullptr,
+	int* chunk_counter = nullptr
+) {
+
+	// here, weights are already transposed and packed
+	// in deltas, the last layer has already been calculated
+
+	const int layer_lenght = WIDTH * batch_size;
+	const int N_ITERS = BATCH_CHUNK / TM;
+	const int n_hidden = n_hidden_matmuls;
+	const int n_chunks = batch_size / BATCH_CHUNK;
+
+	if (checkpoint_interval <= 1) {
+		const int n_groups = persistent_work_groups(q, n_chunks, chunk_counter);
+
+		// Execute the kernel for backward pass
+		q.submit([&](handler& h) {
+
+			local_accessor<T> deltas_layers = local_accessor<T>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
+			local_accessor<float> delta_temp = local_accessor<float>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
+			auto a = deltas_layers.get_pointer();
+			auto at = delta_temp.get_pointer();
+
+			h.parallel_for(nd_range<1>(n_groups * WG_SIZE, WG_SIZE), [=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]] {
+				for (int chunk = workgroup_next_chunk(item, chunk_counter, -1, n_chunks); chunk < n_chunks; chunk = workgroup_next_chunk(item, chunk_counter, chunk, n_chunks)) {
+					kernel_swiftnet_backward<WIDTH, N_ITERS, ACTIVATION>(item, deltas.data(), a, at, grads_matrices.data(), weights_transposed.data(), forward, out_inter, n_hidden_matmuls, batch_size, 0, n_hidden, 0, dL_dinput, chunk);
+				}
+				});
+			}).wait();
+
+		// Execute DGEMM multiply for all hidden layers
+		dgemm_multiply<WIDTH>(q, grads_matrices.data(), out_inter, forward, n_hidden_matmuls, batch_size);
+		return;
+	}
+
+	if (n_hidden == 0) {
+		return;
+	}
+
+	for (int first_layer = ((n_hidden - 1) / checkpoint_interval) * checkpoint_interval; first_layer >= 0; first_layer -= checkpoint_interval) {
+		const int last_layer = std::min(first_layer + checkpoint_interval, n_hidden);
+		const int n_recomputed = last_layer - first_layer - 1;
+
+		// Both ends of the segment are stored by the forward pass
+		q.memcpy(segment, forward + checkpointSlot(first_layer, checkpoint_interval, n_hidden) * layer_lenght, layer_lenght * sizeof(T));
+		q.memcpy(segment + (last_layer - first_layer) * layer_lenght, forward + checkpointSlot(last_layer, checkpoint_interval, n_hidden) * layer_lenght, layer_lenght * sizeof(T)).wait();
+
+		// Recompute the activations in between with the fused forward layers
+		if (n_recomputed > 0) {
+			q.submit([&](handler& h) {
+
+				local_accessor<T> act_mem = local_accessor<T>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
+				local_accessor<float> act_mem_temp = local_accessor<float>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
+				auto a = act_mem.get_pointer();
+				auto at = act_mem_temp.get_pointer();
+
+				h.parallel_for(nd_range<1>(batch_size * WG_SIZE / BATCH_CHUNK, WG_SIZE), [=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]] {
+					kernel_swift_mlp_recompute<WIDTH, N_ITERS>(item, ACTIVATION, a, at, weights.data(), segment, first_layer, n_recomputed, batch_size);
+					});
+				}).wait();
+		}
+
+		// Backpropagate through the segment
+		int* segment_counter = chunk_counter;
+		const int n_groups = persistent_work_groups(q, n_chunks, segment_counter);
+		q.submit([&](handler& h) {
+
+			local_accessor<T> deltas_layers = local_accessor<T>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
+			local_accessor<float> delta_temp = local_accessor<float>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
+			auto a = deltas_layers.get_pointer();
+			auto at = delta_temp.get_pointer();
+
+			h.parallel_for(nd_range<1>(n_groups * WG_SIZE, WG_SIZE), [=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]] {
+				for (int chunk = workgroup_next_chunk(item, segment_counter, -1, n_chunks); chunk < n_chunks; chunk = workgroup_next_chunk(item, segment_counter, chunk, n_chunks)) {
+					kernel_swiftnet_backward<WIDTH, N_ITERS, ACTIVATION>(item, deltas.data(), a, at, grads_matrices.data(), weights_transposed.data(), segment, out_inter, n_hidden_matmuls, batch_size, n_hidden - last_layer, n_hidden - first_layer, first_layer, dL_dinput, chunk);
+				}
+				});
+			}).wait();
+
+		// Weight gradients of the segment
+		dgemm_multiply<WIDTH>(q, grads_matrices.data() + first_layer * WIDTH * WIDTH, out_inter, segment, last_layer - first_layer, batch_size);
+	}
+}
+
+
+/**
+ * Performs the backward pass without checkpointing with the kernel specialized on the depth, see mlp_swiftnet_backward.
+ *
+ * @tparam WIDTH           Width of the matrices.
+ * @tparam N_HIDDEN_LAYERS Number of hidden layers.
+ * @tparam ACTIVATION      Type of activation for hidden layers.
+ */
+template<int WIDTH, int N_HIDDEN_LAYERS, Activation ACTIVATION>
+void mlp_swiftnet_backward_static(
+	queue q,
+	DeviceMem<bf16>& weights_transposed,
+	DeviceMem<bf16>& deltas,
+	DeviceMem<float>& grads_matrices,
+	bf16* out_inter,
+	bf16* forward,
+	int batch_size,
+	float* dL_dinput,
+	int* chunk_counter
+) {
+	const int N_ITERS = BATCH_CHUNK / TM;
+	const int N_HIDDEN_MATMULS = N_HIDDEN_LAYERS - 1;
+	const int n_chunks = batch_size / BATCH_CHUNK;
+	const int n_groups = persistent_work_groups(q, n_chunks, chunk_counter);
+
+	q.submit([&](handler& h) {
+
+		local_accessor<bf16> deltas_layers = local_accessor<bf16>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
+		local_accessor<float> delta_temp = local_accessor<float>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
+		auto a = deltas_layers.get_pointer();
+		auto at = delta_temp.get_pointer();
+
+		h.parallel_for(nd_range<1>(n_groups * WG_SIZE, WG_SIZE), [=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]] {
+			for (int chunk = workgroup_next_chunk(item, chunk_counter, -1, n_chunks); chunk < n_chunks; chunk = workgroup_next_chunk(item, chunk_counter, chunk, n_chunks)) {
+				kernel_swiftnet_backward<WIDTH, N_ITERS, ACTIVATION, N_HIDDEN_MATMULS>(item, deltas.data(), a, at, grads_matrices.data(), weights_transposed.data(), forward, out_inter, N_HIDDEN_MATMULS, batch_size, 0, N_HIDDEN_MATMULS, 0, dL_dinput, chunk);
+			}
+			});
+		}).wait();
+
+	dgemm_multiply<WIDTH>(q, grads_matrices.data(), out_inter, forward, N_HIDDEN_MATMULS, batch_size);
+}
+
+template <int WIDTH, typename T = bf16>
+using StaticBackward = void (*)(queue, DeviceMem<T>&, DeviceMem<T>&, DeviceMem<float>&, T*, T*, int, float*, int*);
+
+// Adds the specialized backward passes of an activation for every depth of the sequence (offset by one)
+template <int WIDTH, Activation ACTIVATION, int... DEPTHS>
+void add_static_backwards(std::vector<std::pair<StaticKernelKey, StaticBackward<WIDTH>>>& table, std::integer_sequence<int, DEPTHS...>) {
+	(table.push_back({ { DEPTHS + 1, ACTIVATION }, &mlp_swiftnet_backward_static<WIDTH, DEPTHS + 1, ACTIVATION> }), ...);
+}
+
+/**
+ * Find the backward pass specialized on the depth and the activation of the network, for the shapes of
+ * find_static_forward. The output activation is backpropagated before the kernel and is not part of the key.
+ *
+ * @param n_hidden_layers Number of hidden layers.
+ * @param activation      Activation function for hidden layers.
+ * @tparam T              Element type of the network, the kernels are only specialized for bf16.
+ * @return The specialized backward pass, or nullptr when the generic kernel has to be used.
+ */
+template <int WIDTH, typename T = bf16>
+StaticBackward<WIDTH, T> find_static_backward(int n_hidden_layers, Activation activation) {
+	static const std::vector<std::pair<StaticKernelKey, StaticBackward<WIDTH, T>>> table = []() {
+		std::vector<std::pair<StaticKernelKey, StaticBackward<WIDTH, T>>> table;
+		if constexpr (std::is_same<T, bf16>::value) {
+			const auto depths = std::make_integer_sequence<int, STATIC_MAX_HIDDEN_LAYERS>();
+			add_static_backwards<WIDTH, Activation::ReLU>(table, depths);
+			add_static_backwards<WIDTH, Activation::LeakyReLU>(table, depths);
+			add_static_backwards<WIDTH, Activation::Sigmoid>(table, depths);
+		}
+		return table;
+	}();
+
+	for (const auto& entry : table) {
+		if (entry.first.n_hidden_layers == n_hidden_layers && entry.first.activation == activation) {
+			return entry.second;
+		}
+	}
+	return nullptr;
+}
+
+/**
+ * Constructor for the SwiftNetMLP class.
+ *
+ * @param q                  SYCL queue for command submission.
+ * @param input_width        Width of the input data.
+ * @param output_width       Width of the output data.
+ * @param n_hidden_layers    Number of hidden layers.
+ * @param activation         Activation function for hidden layers.
+ * @param output_activation  Activation function for the output layer.
+ * @param batch_size         Batch size of the data.
+ * @param checkpoint_interval Number of layers between two layers stored for the backward pass (1 stores all of them).
+ * @param precision          Compute precision of the inference. A network in another precision than bf16 cannot be trained.
+ * @tparam WIDTH             Width of the matrices.
+ * @tparam T                 Element type of the network, bf16 or half for the fp16 training.
+ */
+template <int WIDTH, typename T>
+SwiftNetMLP<WIDTH, T>::SwiftNetMLP(
+	queue q,
+	int input_width,
+	int output_width,
+	int n_hidden_layers,
+	Activation activation,
+	Activation output_activation,
+	int batch_size,
+	int checkpoint_interval,
+	Precision precision
+) :
+	m_inputs_width{ input_width },
+	m_net_width{ WIDTH },
+	m_output_width{ output_width },
+	m_n_hidden_layers{ n_hidden_layers },
+	m_activation{ activation },
+	m_output_activation{ output_activation },
+	m_batch_size{ batch_size },
+	m_checkpoint_interval{ checkpoint_interval },
+	m_precision{ precision }
+{
+	// Store provided parameters
+	m_q = q;
+	m_n_hidden_matrices = m_n_hidden_layers - 1;
+
+	if (m_checkpoint_interval < 1) {
+		throw std::runtime_error{"The checkpoint interval must be at least 1."};
+	}
+	if (m_checkpoint_interval > 1 && m_inputs_width != WIDTH) {
+		throw std::runtime_error{"Checkpointing requires the input width to be equal to the network width."};
+	}
+	if (m_precision != Precision::BFloat16 && m_inputs_width != WIDTH) {
+		throw std::runtime_error{"fp16 and fp32 inference require the input width to be equal to the network width."};
+	}
+	if (m_precision != Precision::BFloat16 && !std::is_same<T, bf16>::value) {
+		throw std::runtime_error{"The inference precision can only be selected for a bf16 network."};
+	}
+
+	// Number of hidden layers kept by the forward pass, the others are recomputed in the backward pass
+	m_n_stored_layers = checkpointSlot(m_n_hidden_matrices + 1, m_checkpoint_interval, m_n_hidden_matrices);
+
+	// Allocate memory for various matrices
+	m_weightsT_matrices.allocate(m_net_width * m_inputs_width + (m_net_width * m_net_width) * m_n_hidden_matrices + m_net_width * m_output_width, m_q);
+	m_weights_matrices.allocate(m_net_width * m_inputs_width + (m_net_width * m_net_width) * m_n_hidden_matrices + m_net_width * m_output_width, m_q);
+	m_weights_matrices_inferences.allocate(m_net_width * m_inputs_width + (m_net_width * m_net_width) * m_n_hidden_matrices + m_net_width * m_output_width, m_q);
+	m_grads_matrices.allocate(m_net_width * m_inputs_width + (m_net_width * m_net_width) * m_n_hidden_matrices + m_net_width * m_output_width, m_q);
+
+	// Initialize constants and allocations
+	const int layer_length = WIDTH * m_batch_size;
+	m_alignment = SHMEM_SIZE;
+
+	// Allocate and initialize various memory buffers
+	// The inputs and the activated outputs of the stored layers are kept in the element type for the backward pass
+	m_forward = malloc_device<T>(m_batch_size * (m_inputs_width + m_output_width + WIDTH * m_n_stored_layers), q);
+
+	// Operands of the oneMKL GEMMs are kept in the element type, only their results are in float
+	m_A_forward = sycl::aligned_alloc_device<T>(m_alignment, layer_length, q);
+	m_B_forward = sycl::aligned_alloc_device<T>(m_alignment, m_output_width * WIDTH, q);
+	m_C_forward = sycl::aligned_alloc_device<float>(m_alignment, m_output_width * m_batch_size, q);
+
+	// With checkpointing, the backward pass only holds the activations and deltas of one segment at a time
+	if (m_checkpoint_interval > 1) {
+		m_forward_segment = malloc_device<T>(layer_length * (m_checkpoint_interval + 1), q);
+		m_out_inter = malloc_device<T>(layer_length * m_checkpoint_interval, q);
+	}
+	else {
+		m_forward_segment = nullptr;
+		m_out_inter = malloc_device<T>(m_batch_size * WIDTH * (m_n_hidden_layers), q);
+	}
+	m_deltas_temp = sycl::aligned_alloc_device<float>(m_alignment, m_output_width * m_batch_size, q);
+	m_deltas.allocate(m_output_width * m_batch_size, q);
+
+	// Counter of the batch chunks taken by the work-groups of the persistent kernels
+	m_chunk_counter.allocate(1, q);
+
+	// Small batches run the latency kernel in inference
+	m_latency_inference = m_batch_size <= LATENCY_MAX_BATCH;
+
+	// The weight gradients are written in fp32 by the GEMMs themselves, only the deltas of the last layer need a buffer
+	m_B_backward_last_layer = sycl::aligned_alloc_device<T>(m_alignment, m_output_width * WIDTH, q);
+	m_C_backward_last_layer = sycl::aligned_alloc_device<float>(m_alignment, WIDTH * m_batch_size, q);
+
+	// Activations of the fp16 and fp32 inference, the fp32 path ping-pongs between two layers
+	if (m_precision == Precision::Half) {
+		m_act_half.allocate(layer_length, q);
+	}
+	else if (m_precision != Precision::BFloat16) {
+		m_act_float.allocate(2 * layer_length, q);
+	}
+}
+
+template <int WIDTH, typename T>
+SwiftNetMLP<WIDTH, T>::~SwiftNetMLP() {
+
+}
+/**
+ * Get a pointer to the gradients matrices.
+ *
+ * @return A pointer to the gradients matrices.
+ */
+template <int WIDTH, typename T>
+DeviceMem<float>* SwiftNetMLP<WIDTH, T>::get_grads_matrices() {
+	return &m_grads_matrices;
+}
+
+/**
+ * Get a pointer to the weights matrices.
+ *
+ * @return A pointer to the weights matrices.
+ */
+template <int WIDTH, typename T>
+DeviceMem<T>* SwiftNetMLP<WIDTH, T>::get_weights_matrices() {
+	return &m_weights_matrices;
+}
+
+/**
+ * Get a pointer to the transposed weights matrices.
+ *
+ * @return A pointer to the transposed weights matrices.
+ */
+template <int WIDTH, typename T>
+DeviceMem<T>* SwiftNetMLP<WIDTH, T>::get_weightsT_matrices() {
+	return &m_weightsT_matrices;
+}
+
+/**
+ * Get the batch size the network buffers are sized for.
+ *
+ * @return The batch size of one forward and backward pass.
+ */
+template <int WIDTH, typename T>
+int SwiftNetMLP<WIDTH, T>::get_batch_size() {
+	return m_batch_size;
+}
+
+/**
+ * Check whether a derived weight layout has to be rebuilt, and mark it as up to date.
+ * A layout is stale when the weights changed since it was built, or when it is built from other weights
+ * (moving average) or into another buffer.
+ *
+ * @param layout The derived layout.
+ * @param source The packed weights it is built from.
+ * @param data The buffer holding the derived layout.
+ * @return True if the layout has to be rebuilt.
+ */
+template <int WIDTH, typename T>
+bool SwiftNetMLP<WIDTH, T>::is_stale(DerivedLayout& layout, const void* source, const void* data) {
+	if (layout.version == m_weights_version && layout.source == source && layout.data == data) {
+		return false;
+	}
+	layout.version = m_weights_version;
+	layout.source = source;
+	layout.data = data;
+	return true;
+}
+
+/**
+ * Get the number of bytes of activation memory saved by checkpointing.
+ * It compares the stored layers, the recomputed segment and the segment deltas to storing every layer.
+ * A negative value means that the interval is too large for the depth of the network.
+ *
+ * @return The number of bytes saved compared to storing every layer.
+ */
+template <int WIDTH, typename T>
+long long SwiftNetMLP<WIDTH, T>::get_checkpointing_bytes_saved() {
+	if (m_checkpoint_interval <= 1) {
+		return 0;
+	}
+	const long long layer_bytes = (long long)WIDTH * m_batch_size * sizeof(T);
+	const long long full = (long long)(m_n_hidden_layers + m_n_hidden_layers) * layer_bytes;
+	const long long used = (long long)(m_n_stored_layers + 2 * m_checkpoint_interval + 1) * layer_bytes;
+	return full - used;
+}
+
+/**
+ * Initialize parameters for the neural network.
+ * This function initializes the weights matrices with uniform random values.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::initialize_params() {
+	// Initialize weights matrices with uniform random values, you can choose a different initialization ( look in DeviceMem.cpp )
+	m_weights_matrices.initialize_uniform(0.01, m_weightsT_matrices, m_inputs_width, m_net_width, m_output_width, m_n_hidden_matrices, m_q);
+	m_master_weights = nullptr;
+	m_weights_version++;
+};
+
+
+/**
+ * Save the neural network parameters to a file.
+ *
+ * @param filename The name of the file to save the parameters to.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::save_to_file(std::string filename) {
+	// Open the file for writing
+	std::ofstream file;
+	file.open(filename);
+
+	// Write parameters to the file
+	file << m_inputs_width << "\n";
+	file << m_net_width << "\n";
+	file << m_output_width << "\n";
+	file << m_n_hidden_layers << "\n";
+	file << m_n_hidden_matrices << "\n";
+
+	// Write each value of the weights matrices to the file
+	for (int i = 0; i < m_weights_matrices.size(); i++) {
+		file << m_weights_matrices.data()[i] << "\n";
+	}
+
+	// Close the file
+	file.close();
+	return;
+}
+
+/**
+ * Load neural network parameters from a file.
+ *
+ * @param filename The name of the file to load parameters from.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::load_from_file(std::string filename) {
+	// Open the file for reading
+	std::ifstream file;
+	file.open(filename);
+	std::string line;
+
+	// Read parameters from the file
+	file >> m_inputs_width;
+	file >> m_net_width;
+	file >> m_output_width;
+	file >> m_n_hidden_layers;
+	file >> m_n_hidden_matrices;
+
+	// Read each value from the file and set it as a bf16 value in weights matrices
+	for (int i = 0; i < m_weights_matrices.size(); i++) {
+		float x;
+		file >> x;
+		m_weights_matrices.data()[i] = T(x);
+	}
+
+	// Close the file
+	file.close();
+
+	// Make the weights matrices transposed using the transposed weights matrices
+	m_weights_matrices.make_transposed(m_weightsT_matrices, m_inputs_width, m_net_width, m_output_width, m_n_hidden_matrices, m_q);
+	m_master_weights = nullptr;
+	m_weights_version++;
+	return;
+}
+
+
+/**
+ * Free memory allocated on the device for various arrays.
+ *
+ * @param q The SYCL queue used for device operations.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::free_mem(queue q) {
+	// Free memory for arrays allocated using sycl::aligned_alloc_device
+	free(m_forward, q);
+	if (m_forward_segment) {
+		free(m_forward_segment, q);
+	}
+	free(m_out_inter, q);
+	free(m_deltas_temp, q);
+	free(m_A_forward, q);
+	free(m_B_forward, q);
+	free(m_C_forward, q);
+
+	// Free memory for DeviceMem<bf16> arrays using their free_mem member function
+	m_deltas.free_mem(q);
+	m_chunk_counter.free_mem(q);
+
+	free(m_B_backward_last_layer, q);
+	free(m_C_backward_last_layer, q);
+
+	if (m_weights_int8.size() > 0) {
+		m_weights_int8.free_mem(q);
+		m_weights_int8_scales.free_mem(q);
+	}
+	if (m_act_int8_scales.size() > 0) {
+		m_act_int8_scales.free_mem(q);
+	}
+	if (m_weights_half.size() > 0) {
+		m_weights_half.free_mem(q);
+		m_output_weights_half.free_mem(q);
+	}
+	if (m_weights_float.size() > 0) {
+		m_weights_float.free_mem(q);
+	}
+	if (m_act_half.size() > 0) {
+		m_act_half.free_mem(q);
+	}
+	if (m_act_float.size() > 0) {
+		m_act_float.free_mem(q);
+	}
+	if (m_dL_dinput.size() > 0) {
+		m_dL_dinput.free_mem(q);
+	}
+	if (m_dL_dcoords.size() > 0) {
+		m_dL_dcoords.free_mem(q);
+	}
+}
+
+
+/**
+ * Perform a forward pass of the SwiftNetMLP model.
+ *
+ * @param input The input data on the device.
+ * @param forward Pointer to the bf16 forward intermediate array.
+ * @param A Temporary bf16 array A (unused, the last hidden activations are read from forward).
+ * @param B Temporary bf16 array B holding the unpacked output weights.
+ * @param C Temporary array C for matrix multiplication.
+ * @param output The output data on the device.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::forward_pass(const DeviceMem<T>& input, T* forward, T* A, T* B, float* C, DeviceMem<float>& output) {
+	m_encoded_forward = false;
+	forward_pass_impl(input.data(), nullptr, forward, A, B, C, output);
+}
+
+/**
+ * Perform a forward pass of the SwiftNetMLP model on positions, encoded by the input encoding in the forward kernel.
+ * The encoded input is stored as the first layer of m_forward for the backward pass.
+ *
+ * @param coords The positions on the device, get_n_dims() floats per row (empty for an encoding without positions).
+ * @param output The output data on the device.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::forward_pass_encoded(const DeviceMem<float>& coords, DeviceMem<float>& output) {
+	if (!m_encoding) {
+		throw std::runtime_error{"The network has no input encoding."};
+	}
+	m_encoding_coords = coords.data();
+	m_encoded_forward = true;
+	forward_pass_impl(nullptr, coords.data(), m_forward, m_A_forward, m_B_forward, m_C_forward, output);
+}
+
+/**
+ * Forward pass shared by forward_pass and forward_pass_encoded.
+ *
+ * @param input Pointer to the input data, nullptr when the input encoding is computed by the kernel.
+ * @param coords Pointer to the positions encoded by the kernel, or nullptr.
+ * @param forward Pointer to the bf16 forward intermediate array.
+ * @param A Temporary bf16 array A (unused, the last hidden activations are read from forward).
+ * @param B Temporary bf16 array B holding the unpacked output weights.
+ * @param C Temporary array C for matrix multiplication.
+ * @param output The output data on the device.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::forward_pass_impl(T* input, const float* coords, T* forward, T* A, T* B, float* C, DeviceMem<float>& output) {
+	if (m_precision != Precision::BFloat16) {
+		throw std::runtime_error{"The training runs in the element type of the network, the other precisions are for inference."};
+	}
+
+	// Constants and dimensions
+	const int input_size = m_batch_size * m_inputs_width;
+	const EncodingParams encoding = input ? EncodingParams() : m_encoding->get_params();
+	T* encoded_out = input ? nullptr : forward;
+	const int output_stride = WIDTH;
+	const int intermediate_output_size = m_batch_size * WIDTH * m_n_stored_layers;
+	const int layer_length = WIDTH * m_batch_size;
+	const int n_hidden_matrices = m_n_hidden_matrices;
+	const int net_width = m_net_width;
+	const int inputs_width = m_inputs_width;
+	const int output_width = m_output_width;
+
+	// Static assertion and assertion checks
+	static_assert(WIDTH % 16 == 0, "Width must be a multiple of 16.");
+	assert(m_batch_size % 64 == 0);
+
+	// Get a pointer to the weights matrices data
+	auto p = m_weights_matrices.data();
+
+	// Production shapes run the forward kernel specialized on their depth and activations
+	const auto forward_static = (input && m_inputs_width == WIDTH && m_checkpoint_interval == 1) ? find_static_forward<WIDTH, false, T>(m_n_hidden_layers, m_activation) : nullptr;
+	if (forward_static) {
+		forward_static(m_q, m_output_activation, m_weights_matrices, input, forward + input_size, output, A, output_stride, m_output_width, m_batch_size, m_chunk_counter.data());
+	}
+	else {
+		// Perform forward pass based on activation function
+		switch (m_activation) {
+		case Activation::None:
+			mlp_swift_forward<WIDTH, Activation::None, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input_size, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, m_checkpoint_interval, coords, encoding, encoded_out, m_chunk_counter.data());
+			break;
+		case Activation::Exponential:
+			mlp_swift_forward<WIDTH, Activation::None, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input_size, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, m_checkpoint_interval, coords, encoding, encoded_out, m_chunk_counter.data());
+			break;
+		case Activation::Sigmoid:
+			mlp_swift_forward<WIDTH, Activation::Sigmoid, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input_size, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, m_checkpoint_interval, coords, encoding, encoded_out, m_chunk_counter.data());
+			break;
+		case Activation::ReLU:
+			mlp_swift_forward<WIDTH, Activation::ReLU, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input_size, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, m_checkpoint_interval, coords, encoding, encoded_out, m_chunk_counter.data());
+			break;
+		case Activation::LeakyReLU:
+			mlp_swift_forward<WIDTH, Activation::LeakyReLU, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input_size, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, m_checkpoint_interval, coords, encoding, encoded_out, m_chunk_counter.data());
+			break;
+		case Activation::Squareplus:
+			mlp_swift_forward<WIDTH, Activation::Squareplus, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input_size, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, m_checkpoint_interval, coords, encoding, encoded_out, m_chunk_counter.data());
+			break;
+		case Activation::Softplus:
+			mlp_swift_forward<WIDTH, Activation::Softplus, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input_size, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, m_checkpoint_interval, coords, encoding, encoded_out, m_chunk_counter.data());
+			break;
+		case Activation::Tanh:
+			mlp_swift_forward<WIDTH, Activation::Tanh, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input_size, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, m_checkpoint_interval, coords, encoding, encoded_out, m_chunk_counter.data());
+			break;
+		default: return;
+		}
+	}
+
+	// Handle the case when output_width is greater than 16
+	if (m_output_width > 16) {
+		// The unpacked output matrix is only rebuilt after the weights changed
+		if (is_stale(m_output_weights_layout, p, B)) {
+			m_q.parallel_for<>(range<1>(m_output_width * m_net_width), [=](id<1> idx) {
+				B[idx] = p[toPackedLayoutCoord(idx, net_width, output_width) + net_width * (inputs_width + n_hidden_matrices * net_width)];
+				}).wait();
+		}
+
+		oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
+			m_batch_size, m_output_width, WIDTH, 1, forward + input_size + (m_n_stored_layers - 1) * layer_length, WIDTH, B, m_output_width, 0, C, m_output_width).wait();
+
+		// The output and its copy read by the backward pass of the output activation are both activated
+		const Activation output_activation = m_output_activation;
+		m_q.parallel_for<>(range<1>(m_output_width * m_batch_size), [=](id<1> idx) {
+			const float activated = elt_activation_ret<float>(output_activation, C[idx]);
+			output.data()[idx] = activated;
+			forward[intermediate_output_size + input_size + idx] = (T)activated;
+			}).wait();
+	}
+}
+
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::inference(const DeviceMem<T>& input, T* forward, T* A, T* B, float* C, DeviceMem<float>& output) {
+
+	static_assert(WIDTH % 16 == 0, "Width must be a multiply of 16.");
+	assert(m_batch_size % 64 == 0);
+
+	if (m_precision != Precision::BFloat16) {
+		inference_precision(input, output);
+		return;
+	}
+	inference_impl(input.data(), nullptr, forward, A, B, C, output);
+}
+
+/**
+ * Perform inference on positions, encoded by the input encoding in the forward kernel.
+ *
+ * @param coords The positions on the device, get_n_dims() floats per row (empty for an encoding without positions).
+ * @param output The output data on the device.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::inference_encoded(const DeviceMem<float>& coords, DeviceMem<float>& output) {
+	if (!m_encoding) {
+		throw std::runtime_error{"The network has no input encoding."};
+	}
+	inference_impl(nullptr, coords.data(), m_forward, m_A_forward, m_B_forward, m_C_forward, output);
+}
+
+/**
+ * Inference shared by inference and inference_encoded, in bf16.
+ *
+ * @param input Pointer to the input data, nullptr when the input encoding is computed by the kernel.
+ * @param coords Pointer to the positions encoded by the kernel, or nullptr.
+ * @param forward Pointer to the bf16 forward intermediate array.
+ * @param A Temporary bf16 array A receiving the last hidden activations.
+ * @param B Temporary bf16 array B holding the unpacked output weights.
+ * @param C Temporary array C for matrix multiplication.
+ * @param output The output data on the device.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::inference_impl(T* input, const float* coords, T* forward, T* A, T* B, float* C, DeviceMem<float>& output) {
+	const int layer_length = WIDTH * m_batch_size;
+	const int n_hidden_matrices = m_n_hidden_matrices;
+	const int net_width = m_net_width;
+	const int inputs_width = m_inputs_width;
+	const int output_width = m_output_width;
+	const int output_stride = WIDTH;
+	const EncodingParams encoding = input ? EncodingParams() : m_encoding->get_params();
+
+	// The moving average of the weights is read in place when it is maintained by the optimizer
+	DeviceMem<T>& weights = m_inference_uses_ema ? m_weights_matrices_inferences : m_weights_matrices;
+	auto p = weights.data();
+
+
+	// Small batches spread the columns of every hidden layer over the device, the output layer is then a GEMM
+	const bool latency = input && m_inputs_width == WIDTH && m_latency_inference;
+	auto launch_latency = [&](auto activation_constant) {
+		constexpr Activation activation = decltype(activation_constant)::value;
+		mlp_swift_inference_latency<WIDTH, activation>(m_q, p, input, forward, A, m_n_hidden_layers, m_batch_size);
+	};
+
+	// Production shapes run the forward kernel specialized on their depth and activations
+	const auto inference_static = (input && m_inputs_width == WIDTH) ? find_static_forward<WIDTH, true, T>(m_n_hidden_layers, m_activation) : nullptr;
+	if (latency) {
+		switch (m_activation) {
+		case Activation::None:        launch_latency(std::integral_constant<Activation, Activation::None>{}); break;
+		case Activation::Exponential: launch_latency(std::integral_constant<Activation, Activation::Exponential>{}); break;
+		case Activation::Sigmoid:     launch_latency(std::integral_constant<Activation, Activation::Sigmoid>{}); break;
+		case Activation::ReLU:        launch_latency(std::integral_constant<Activation, Activation::ReLU>{}); break;
+		case Activation::LeakyReLU:   launch_latency(std::integral_constant<Activation, Activation::LeakyReLU>{}); break;
+		case Activation::Squareplus:  launch_latency(std::integral_constant<Activation, Activation::Squareplus>{}); break;
+		case Activation::Softplus:    launch_latency(std::integral_constant<Activation, Activation::Softplus>{}); break;
+		case Activation::Tanh:        launch_latency(std::integral_constant<Activation, Activation::Tanh>{}); break;
+		default: throw std::runtime_error{"Unsupported activation."};
+		}
+	}
+	else if (inference_static) {
+		inference_static(m_q, m_output_activation, weights, input, forward, output, A, output_stride, m_output_width, m_batch_size, m_chunk_counter.data());
+	}
+	else {
+		switch (m_activation) {
+		case Activation::None:        mlp_swift_forward<WIDTH, Activation::None, true>(m_q, m_output_activation, weights, input, forward, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, 1, coords, encoding, nullptr, m_chunk_counter.data()); break;
+		case Activation::Exponential: mlp_swift_forward<WIDTH, Activation::Exponential, true>(m_q, m_output_activation, weights, input, forward, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, 1, coords, encoding, nullptr, m_chunk_counter.data()); break;
+		case Activation::Sigmoid:     mlp_swift_forward<WIDTH, Activation::Sigmoid, true>(m_q, m_output_activation, weights, input, forward, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, 1, coords, encoding, nullptr, m_chunk_counter.data()); break;
+		case Activation::ReLU:        mlp_swift_forward<WIDTH, Activation::ReLU, true>(m_q, m_output_activation, weights, input, forward, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, 1, coords, encoding, nullptr, m_chunk_counter.data()); break;
+		case Activation::LeakyReLU:   mlp_swift_forward<WIDTH, Activation::LeakyReLU, true>(m_q, m_output_activation, weights, input, forward, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, 1, coords, encoding, nullptr, m_chunk_counter.data()); break;
+		case Activation::Squareplus:  mlp_swift_forward<WIDTH, Activation::Squareplus, true>(m_q, m_output_activation, weights, input, forward, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, 1, coords, encoding, nullptr, m_chunk_counter.data()); break;
+		case Activation::Softplus:    mlp_swift_forward<WIDTH, Activation::Softplus, true>(m_q, m_output_activation, weights, input, forward, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, 1, coords, encoding, nullptr, m_chunk_counter.data()); break;
+		case Activation::Tanh:        mlp_swift_forward<WIDTH, Activation::Tanh, true>(m_q, m_output_activation, weights, input, forward, output, A, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size, 1, coords, encoding, nullptr, m_chunk_counter.data()); break;
+		default: throw std::runtime_error{"Unsupported activation."};
+		}
+	}
+
+	if (m_output_width > 16 || latency) {
+		// The unpacked output matrix is only rebuilt after the weights changed
+		if (is_stale(m_output_weights_layout, p, B)) {
+			m_q.parallel_for<>(range<1>(m_output_width * m_net_width), [=](id<1> idx) {
+				B[idx] = p[toPackedLayoutCoord(idx, net_width, output_width) + net_width * (inputs_width + n_hidden_matrices * net_width)];
+				}).wait();
+		}
+
+		// Narrow outputs keep the row stride of the output layer of the kernels, which they get otherwise
+		const int output_ld = m_output_width > 16 ? m_output_width : output_stride;
+		oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
+			m_batch_size, m_output_width, WIDTH, 1, A, WIDTH, B, m_output_width, 0, output.data(), output_ld).wait();
+
+		// The kernels leave the output layer to the GEMM, its activation is applied here as in inference_int8
+		if (m_output_activation != Activation::None) {
+			auto out = output.data();
+			const Activation output_activation = m_output_activation;
+			m_q.parallel_for<>(range<1>(m_output_width * m_batch_size), [=](id<1> idx) {
+				const int out_idx = (idx / output_width) * output_ld + idx % output_width;
+				out[out_idx] = elt_activation_ret<float>(output_activation, out[out_idx]);
+				}).wait();
+		}
+	}
+}
+
+/**
+ * Quantize the weights of the input and hidden layers to int8 (post-training quantization).
+ * Each output channel (column of a weight matrix) gets its own scale, absmax / 127. The int8 weights are stored
+ * in the VNNI layout of the int8 joint_matrix, the element (row, col) of a matrix at
+ * (row / 4) * WIDTH * 4 + col * 4 + row % 4. They are derived from the weights read by inference and only rebuilt
+ * when these changed.
  */
-template<int WIDTH, Activation ACTIVATION>
-void mlp_swiftnet_backward(
-	queue q,
-	DeviceMem<bf16>& weights_transposed,
-	DeviceMem<bf16>& deltas,
-	DeviceMem<bf16>& grads_matrices,
-	float* out_inter,
-	float* delta_temp_,
-	float* forward,
-	float* A_dgemm,
-	float* B_dgemm,
-	float* C_dgemm,
-	const uint32_t n_hidden_matmuls,
-	int batch_size
-) {
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::quantize_weights_int8() {
+	if (m_inputs_width != WIDTH) {
+		throw std::runtime_error{"Int8 inference requires the input width to be equal to the network width."};
+	}
 
-	// here, weights are already transposed and packed
-	// in deltas, the last layer has already been calculated
+	DeviceMem<T>& weights = m_inference_uses_ema ? m_weights_matrices_inferences : m_weights_matrices;
+	const int n_matrices = m_n_hidden_matrices + 1;
 
-	const int layer_lenght = WIDTH * batch_size;
-	const int N_ITERS = BATCH_CHUNK / TM;
+	if (m_weights_int8.size() == 0) {
+		m_weights_int8.allocate(n_matrices * WIDTH * WIDTH, m_q);
+		m_weights_int8_scales.allocate(n_matrices * WIDTH, m_q);
+	}
+	if (!is_stale(m_weights_int8_layout, weights.data(), m_weights_int8.data())) {
+		return;
+	}
 
-	// Execute the kernel for backward pass
-	q.submit([&](handler& h) {
+	auto p = weights.data();
+	auto q8 = m_weights_int8.data();
+	auto scales = m_weights_int8_scales.data();
+
+	// One work-item per output channel computes its scale
+	m_q.parallel_for<>(range<1>(n_matrices * WIDTH), [=](id<1> idx) {
+		const int matrix = idx / WIDTH;
+		const int col = idx % WIDTH;
+		float absmax = 0.0f;
+		for (int row = 0; row < WIDTH; row++) {
+			absmax = sycl::fmax(absmax, sycl::fabs((float)p[matrix * WIDTH * WIDTH + toPackedLayoutCoord(row * WIDTH + col, WIDTH, WIDTH)]));
+		}
+		scales[idx] = (absmax > 0.0f) ? absmax / 127.0f : 1.0f;
+		}).wait();
 
-		local_accessor<bf16> deltas_layers = local_accessor<bf16>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
-		local_accessor<float> delta_temp = local_accessor<float>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
-		auto a = deltas_layers.get_pointer();
-		auto at = delta_temp.get_pointer();
+	m_q.parallel_for<>(range<1>(n_matrices * WIDTH * WIDTH), [=](id<1> idx) {
+		const int matrix = idx / (WIDTH * WIDTH);
+		const int row = (idx % (WIDTH * WIDTH)) / WIDTH;
+		const int col = (idx % (WIDTH * WIDTH)) % WIDTH;
+		const int packed_idx = matrix * WIDTH * WIDTH + toPackedLayoutCoord(idx % (WIDTH * WIDTH), WIDTH, WIDTH);
+		const float x = sycl::round((float)p[packed_idx] / scales[matrix * WIDTH + col]);
+		q8[matrix * WIDTH * WIDTH + row / 4 * WIDTH * 4 + col * 4 + row % 4] = (int8_t)sycl::clamp(x, -127.0f, 127.0f);
+		}).wait();
+}
+
+/**
+ * Calibrate the scales of the int8 activations: one per-tensor scale, absmax / 127, for the input of every
+ * int8 matrix, measured by a bf16 forward pass on a representative batch with the weights read by inference.
+ * The scales are tied to the weights they were measured with, inference_int8 requires a new calibration after
+ * the weights changed.
+ *
+ * @param input A representative batch of inputs on the device.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::calibrate_int8(const DeviceMem<T>& input) {
+	if (m_inputs_width != WIDTH) {
+		throw std::runtime_error{"Int8 inference requires the input width to be equal to the network width."};
+	}
+	if (m_checkpoint_interval != 1) {
+		throw std::runtime_error{"The int8 calibration needs every layer stored by the forward pass (checkpoint interval 1)."};
+	}
+
+	const int n_matrices = m_n_hidden_matrices + 1;
+	const int layer_length = m_batch_size * WIDTH;
+	if (m_act_int8_scales.size() == 0) {
+		m_act_int8_scales.allocate(n_matrices, m_q);
+	}
+
+	// The forward pass reads the training weights, the weights read by inference are swapped in for it
+	DeviceMem<float> output(m_batch_size * m_output_width, m_q);
+	if (m_inference_uses_ema) {
+		std::swap(m_weights_matrices, m_weights_matrices_inferences);
+	}
+	forward_pass(input, m_forward, m_A_forward, m_B_forward, m_C_forward, output);
+	if (m_inference_uses_ema) {
+		std::swap(m_weights_matrices, m_weights_matrices_inferences);
+	}
+	output.free_mem(m_q);
+
+	// The input of the matrix k > 0 is the stored output of the hidden layer k - 1, after the input of the network
+	DeviceMem<float> absmax(n_matrices, m_q);
+	for (int k = 0; k < n_matrices; k++) {
+		const T* layer = m_forward + k * layer_length;
+		m_q.parallel_for<>(range<1>(layer_length), sycl::reduction(absmax.data() + k, sycl::maximum<float>(), property::reduction::initialize_to_identity{}), [=](id<1> idx, auto& max) {
+			max.combine(sycl::fabs((float)layer[idx]));
+			}).wait();
+	}
+
+	std::vector<float> scales(n_matrices);
+	absmax.copy_to_host(scales, m_q);
+	absmax.free_mem(m_q);
+	for (float& scale : scales) {
+		scale = (scale > 0.0f) ? scale / 127.0f : 1.0f;
+	}
+	m_act_int8_scales.copy_from_host(scales, m_q);
+	m_act_int8_scales_version = m_weights_version;
+}
+
+/**
+ * Perform inference in int8 for the input and hidden layers, with int8 weights and activations.
+ * The weights are quantized at the first call and after each change of the weights, the activation scales come
+ * from calibrate_int8. The output layer is computed in bf16 by oneMKL from the activations of the last hidden layer.
+ *
+ * @param input The input data on the device.
+ * @param forward Unused, kept for the signature of inference.
+ * @param A bf16 array receiving the activations of the last hidden layer.
+ * @param B bf16 array holding the unpacked output weights.
+ * @param C Unused, kept for the signature of inference.
+ * @param output The output data on the device.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::inference_int8(const DeviceMem<T>& input, T* forward, T* A, T* B, float* C, DeviceMem<float>& output) {
+	if (m_act_int8_scales_version != m_weights_version) {
+		throw std::runtime_error{"The int8 activation scales are not calibrated for the current weights, call calibrate_int8."};
+	}
+	quantize_weights_int8();
 
-		// Execute DGEMM multiply for each hidden layer
-		h.parallel_for(nd_range<1>(batch_size * WG_SIZE / BATCH_CHUNK, WG_SIZE), [=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]] {
-			kernel_swiftnet_backward<WIDTH, N_ITERS, ACTIVATION>(item, deltas.data(), a, at, grads_matrices.data(), weights_transposed.data(), forward, out_inter, n_hidden_matmuls, batch_size);
+	const int N_ITERS = BATCH_CHUNK / TM;
+	const int net_width = m_net_width;
+	const int inputs_width = m_inputs_width;
+	const int output_width = m_output_width;
+	const int n_hidden_matrices = m_n_hidden_matrices;
+	const int batch_size = m_batch_size;
+	const Activation activation = m_activation;
+	auto weights = m_weights_int8.data();
+	auto scales = m_weights_int8_scales.data();
+	auto act_scales = m_act_int8_scales.data();
+	auto inputs = input.data();
+
+	m_q.submit([&](handler& cgh) {
+		local_accessor<int8_t> act_mem = local_accessor<int8_t>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, cgh);
+		local_accessor<int8_t> act_mem_next = local_accessor<int8_t>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, cgh);
+
+		cgh.parallel_for(nd_range<1>(batch_size * WG_SIZE / BATCH_CHUNK, WG_SIZE), [=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]] {
+			kernel_swift_mlp_int8<WIDTH, N_ITERS>(item, activation, inputs, weights, scales, act_scales, act_mem, act_mem_next, A, n_hidden_matrices);
 			});
 		}).wait();
 
-		for (int k = 0; k < n_hidden_matmuls; k++) {
-			dgemm_multiply<WIDTH, ACTIVATION>(q, grads_matrices.data(), out_inter, forward, A_dgemm, B_dgemm, C_dgemm, k, n_hidden_matmuls, batch_size);
+	DeviceMem<T>& packed_weights = m_inference_uses_ema ? m_weights_matrices_inferences : m_weights_matrices;
+	auto p = packed_weights.data();
+	if (is_stale(m_output_weights_layout, p, B)) {
+		m_q.parallel_for<>(range<1>(m_output_width * m_net_width), [=](id<1> idx) {
+			B[idx] = p[toPackedLayoutCoord(idx, net_width, output_width) + net_width * (inputs_width + n_hidden_matrices * net_width)];
+			}).wait();
+	}
+
+	oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
+		m_batch_size, m_output_width, WIDTH, 1, A, WIDTH, B, m_output_width, 0, output.data(), m_output_width).wait();
+
+	if (m_output_activation != Activation::None) {
+		auto out = output.data();
+		const Activation output_activation = m_output_activation;
+		m_q.parallel_for<>(range<1>(m_output_width * m_batch_size), [=](id<1> idx) {
+			out[idx] = elt_activation_ret<float>(output_activation, out[idx]);
+			}).wait();
+	}
+}
+
+/**
+ * Build the copies of the weights used by the fp16 and fp32 inference, if the weights changed.
+ * They are converted from the fp32 master weights of the optimizer when they are known, so that they are not
+ * limited to the precision of the bf16 weights. The fp16 copy keeps the packed layout (plus an unpacked output
+ * matrix for oneMKL), the fp32 copy is unpacked for oneMKL.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::update_precision_weights() {
+	DeviceMem<T>& weights = m_inference_uses_ema ? m_weights_matrices_inferences : m_weights_matrices;
+	const float* master = m_master_weights;
+	const void* source = master ? (const void*)master : (const void*)weights.data();
+	const int n_elements = weights.size();
+	const int n_square_matrices = m_n_hidden_matrices + 1;
+	const int output_offset = n_square_matrices * WIDTH * WIDTH;
+	const int output_width = m_output_width;
+	auto p = weights.data();
+
+	if (m_precision == Precision::Half) {
+		if (m_weights_half.size() == 0) {
+			m_weights_half.allocate(n_elements, m_q);
+			m_output_weights_half.allocate(WIDTH * m_output_width, m_q);
+		}
+		if (!is_stale(m_precision_weights_layout, source, m_weights_half.data())) {
+			return;
+		}
+		auto w = m_weights_half.data();
+		auto w_out = m_output_weights_half.data();
+		m_q.parallel_for<>(range<1>(n_elements), [=](id<1> idx) {
+			const int packed_idx = toPackedWeightCoord(idx, WIDTH, output_width, n_square_matrices, false);
+			const float weight = master ? master[idx] : (float)p[packed_idx];
+			w[packed_idx] = (sycl::half)weight;
+			if (idx >= output_offset) {
+				w_out[idx - output_offset] = (sycl::half)weight;
+			}
+			}).wait();
+	}
+	else {
+		if (m_weights_float.size() == 0) {
+			m_weights_float.allocate(n_elements, m_q);
+		}
+		if (!is_stale(m_precision_weights_layout, source, m_weights_float.data())) {
+			return;
+		}
+		auto w = m_weights_float.data();
+		m_q.parallel_for<>(range<1>(n_elements), [=](id<1> idx) {
+			w[idx] = master ? master[idx] : (float)p[toPackedWeightCoord(idx, WIDTH, output_width, n_square_matrices, false)];
+			}).wait();
+	}
+}
+
+/**
+ * Perform inference in fp16 or fp32 (tf32 where the device supports it).
+ * The fp16 path runs the fused kernel on half joint_matrix operands. The fp32 path has no joint_matrix type and
+ * chains oneMKL GEMMs, which use the FMA units or, in tf32 mode, the matrix engines.
+ *
+ * @param input The bf16 input data on the device.
+ * @param output The output data on the device.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::inference_precision(const DeviceMem<T>& input, DeviceMem<float>& output) {
+	update_precision_weights();
+
+	const int N_ITERS = BATCH_CHUNK / TM;
+	const int layer_length = WIDTH * m_batch_size;
+	const int n_square_matrices = m_n_hidden_matrices + 1;
+	const int n_hidden_matrices = m_n_hidden_matrices;
+	const int batch_size = m_batch_size;
+	const Activation activation = m_activation;
+	const Activation output_activation = m_output_activation;
+	auto inputs = input.data();
+	auto out = output.data();
+
+	if (m_precision == Precision::Half) {
+		auto weights = m_weights_half.data();
+		auto last_act = m_act_half.data();
+
+		m_q.submit([&](handler& cgh) {
+			local_accessor<sycl::half> act_mem = local_accessor<sycl::half>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, cgh);
+			local_accessor<float> act_mem_temp = local_accessor<float>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, cgh);
+
+			cgh.parallel_for(nd_range<1>(batch_size * WG_SIZE / BATCH_CHUNK, WG_SIZE), [=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]] {
+				kernel_swift_mlp_typed<sycl::half, WIDTH, N_ITERS>(item, activation, inputs, weights, act_mem, act_mem_temp, last_act, n_hidden_matrices);
+				});
+			}).wait();
+
+		oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
+			m_batch_size, m_output_width, WIDTH, 1.0f, last_act, WIDTH, m_output_weights_half.data(), m_output_width, 0.0f, out, m_output_width).wait();
+	}
+	else {
+		const auto mode = (m_precision == Precision::TF32) ? oneapi::mkl::blas::compute_mode::float_to_tf32 : oneapi::mkl::blas::compute_mode::standard;
+		auto weights = m_weights_float.data();
+		float* act_in = m_act_float.data();
+		float* act_out = act_in + layer_length;
+
+		m_q.parallel_for<>(range<1>(layer_length), [=](id<1> idx) {
+			act_in[idx] = (float)inputs[idx];
+			}).wait();
+
+		for (int k = 0; k < n_square_matrices; k++) {
+			oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
+				m_batch_size, WIDTH, WIDTH, 1.0f, act_in, WIDTH, weights + k * WIDTH * WIDTH, WIDTH, 0.0f, act_out, WIDTH, mode).wait();
+			m_q.parallel_for<>(range<1>(layer_length), [=](id<1> idx) {
+				act_out[idx] = elt_activation_ret<float>(activation, act_out[idx]);
+				}).wait();
+			std::swap(act_in, act_out);
+		}
+
+		oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
+			m_batch_size, m_output_width, WIDTH, 1.0f, act_in, WIDTH, weights + n_square_matrices * WIDTH * WIDTH, m_output_width, 0.0f, out, m_output_width, mode).wait();
+	}
+
+	if (output_activation != Activation::None) {
+		m_q.parallel_for<>(range<1>(m_output_width * m_batch_size), [=](id<1> idx) {
+			out[idx] = elt_activation_ret<float>(output_activation, out[idx]);
+			}).wait();
+	}
+}
+
+/**
+ * Perform matrix multiplications and activation backpropagation for the last layer (beginning of the backward pass) .
+ * The loss gradients are read in bf16 directly by the oneMKL GEMMs.
+ *
+ * @param grads The gradients on the device.
+ * @param forward Pointer to the bf16 forward intermediate array.
+ * @param loss The loss gradients on the device.
+ * @param batch_size The batch size.
+ * @param B bf16 array B holding the unpacked transposed output weights, rebuilt only after the weights changed.
+ * @param C Temporary array C for matrix multiplication.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::dgemm_last_layer_backward(DeviceMem<T>& grads,
+	T* forward,
+	DeviceMem<T>& loss,
+	int batch_size,
+	T* B,
+	float* C) {
+
+	auto p_w = m_weightsT_matrices.data();
+	auto p_g = m_grads_matrices.data();
+	auto p_l = loss.data();
+	const int offset_w = m_n_hidden_matrices * m_net_width * m_net_width + m_net_width * m_inputs_width;
+	const int offset_g = m_inputs_width * m_net_width + (m_n_hidden_matrices - 1) * m_net_width * m_net_width;
+	const int offset_f = m_inputs_width * batch_size + (checkpointSlot(m_n_hidden_matrices, m_checkpoint_interval, m_n_hidden_matrices) - 1) * m_net_width * batch_size;
+	const int output_width = m_output_width;
+	const int net_width = m_net_width;
+
+	auto activation = m_activation;
+
+	if (is_stale(m_output_weightsT_layout, p_w, B)) {
+		m_q.parallel_for<>(range<1>(m_output_width * WIDTH), [=](id<1> idx) {
+			B[idx] = p_w[offset_w + toPackedLayoutCoord(idx, output_width, net_width)];
+			}).wait();
+	}
+
+	oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
+		batch_size, m_net_width, m_output_width, 1, p_l, m_output_width, B, m_net_width, 0, C, m_net_width).wait();
+
+	m_q.parallel_for<>(range<1>(m_net_width * batch_size), [=](id<1> idx) {
+		elt_activation_bwd<float, T, T>(activation, C[idx], forward[offset_f + idx], p_l[idx]);
+		}).wait();
+
+	// The activated forward outputs are read in place, the transposition is left to the GEMM
+	oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::trans, oneapi::mkl::transpose::nontrans,
+		m_net_width, m_net_width, batch_size, 1, forward + offset_f, m_net_width, p_l, m_net_width, 0, p_g + offset_g, m_net_width).wait();
+}
+
+
+/**
+ * Perform the backward pass of the neural network.
+ * The weight gradients are summed over the batch, they are normalized by the trainer.
+ *
+ * @param input The input data on the device.
+ * @param grads The gradients on the device.
+ * @param out_inter Intermediate bf16 array for storing outputs.
+ * @param delta_temp Temporary array for deltas.
+ * @param loss Loss array on the device.
+ * @param B_backward_last_layer Temporary bf16 array B for last layer backward pass.
+ * @param C_backward_last_layer Temporary array C for last layer backward pass.
+ * @param forward Pointer to the bf16 forward intermediate array.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::backward_pass(const DeviceMem<T>& input,
+	DeviceMem<T>& grads,
+	T* out_inter,
+	float* delta_temp,
+	DeviceMem<T> loss,
+	T* B_backward_last_layer,
+	float* C_backward_last_layer,
+	T* forward) {
+
+	if (m_precision != Precision::BFloat16) {
+		throw std::runtime_error{"The training runs in the element type of the network, the other precisions are for inference."};
+	}
+
+	int batch_size = m_batch_size;
+	auto p = m_grads_matrices.data();
+	auto p_l = loss.data();
+	int s = m_grads_matrices.size();
+	auto activation = m_activation;
+	auto output_activation = m_output_activation;
+	const int offset_grad = m_n_hidden_matrices * m_net_width * m_net_width + m_inputs_width * m_net_width;
+	const int offset_f = m_inputs_width * batch_size + (m_n_stored_layers - 1) * m_net_width * batch_size;
+
+	const size_t alignment = 1024;
+
+	// The hidden layers accumulate into the gradients, start from zero
+	m_q.memset(p, 0, s * sizeof(float)).wait();
+
+	// Compute output activation backpropagation using parallel_for directly into the loss array
+	m_q.parallel_for<>(range<1>(batch_size * m_output_width), [=](id<1> idx) {
+		elt_activation_bwd<T, T, T>(output_activation, grads.data()[idx], forward[offset_f + batch_size * WIDTH + idx], p_l[idx]);
+		}).wait();
+
+	// Perform matrix multiplication using MKL BLAS straight into the fp32 gradients, the activated outputs of the last hidden layer are read from forward
+	oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::trans, oneapi::mkl::transpose::nontrans,
+		m_net_width, m_output_width, batch_size, 1, forward + offset_f, m_net_width, p_l, m_output_width, 0, p + offset_grad, m_output_width).wait();
+
+	// Backpropagation through last layer using dgemm_last_layer_backward
+	dgemm_last_layer_backward(grads, forward, loss, batch_size, B_backward_last_layer, C_backward_last_layer);
+
+	// The gradients of the input come out of the backward kernel, for the input encoding or when requested
+	float* dL_dinput = (m_input_gradients || (m_encoding && m_encoded_forward)) ? m_dL_dinput.data() : nullptr;
+
+	// Production shapes run the backward kernel specialized on their depth
+	const auto backward_static = m_checkpoint_interval == 1 ? find_static_backward<WIDTH, T>(m_n_hidden_layers, m_activation) : nullptr;
+	if (backward_static) {
+		backward_static(m_q, m_weightsT_matrices, loss, m_grads_matrices, out_inter, forward, m_batch_size, dL_dinput, m_chunk_counter.data());
+	}
+	else {
+		// Choose appropriate mlp_swiftnet_backward based on activation
+		switch (m_activation) {
+		case Activation::None: mlp_swiftnet_backward<WIDTH, Activation::None>(m_q, m_weights_matrices, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, m_forward_segment, m_n_hidden_matrices, m_batch_size, m_checkpoint_interval, dL_dinput, m_chunk_counter.data()); break;
+		case Activation::ReLU: mlp_swiftnet_backward<WIDTH, Activation::ReLU>(m_q, m_weights_matrices, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, m_forward_segment, m_n_hidden_matrices, m_batch_size, m_checkpoint_interval, dL_dinput, m_chunk_counter.data()); break;
+		case Activation::LeakyReLU: mlp_swiftnet_backward<WIDTH, Activation::LeakyReLU>(m_q, m_weights_matrices, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, m_forward_segment, m_n_hidden_matrices, m_batch_size, m_checkpoint_interval, dL_dinput, m_chunk_counter.data()); break;
+		case Activation::Exponential: mlp_swiftnet_backward<WIDTH, Activation::Exponential>(m_q, m_weights_matrices, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, m_forward_segment, m_n_hidden_matrices, m_batch_size, m_checkpoint_interval, dL_dinput, m_chunk_counter.data()); break;
+		case Activation::Sigmoid: mlp_swiftnet_backward<WIDTH, Activation::Sigmoid>(m_q, m_weights_matrices, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, m_forward_segment, m_n_hidden_matrices, m_batch_size, m_checkpoint_interval, dL_dinput, m_chunk_counter.data()); break;
+		case Activation::Tanh: mlp_swiftnet_backward<WIDTH, Activation::Tanh>(m_q, m_weights_matrices, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, m_forward_segment, m_n_hidden_matrices, m_batch_size, m_checkpoint_interval, dL_dinput, m_chunk_counter.data()); break;
+		default: return;
 		}
+	}
 
+	// Backpropagate through the input encoding into its parameters and the positions
+	if (m_encoding && m_encoded_forward) {
+		m_encoding->backward(m_q, m_encoding_coords, m_dL_dinput.data(), batch_size, WIDTH, m_input_gradients && m_encoding->get_n_dims() > 0 ? m_dL_dcoords.data() : nullptr);
+	}
 }
 
+/**
+ * Compute the input of the network with an input encoding, in the forward kernel.
+ * The encoded features are read by the first layer from shared memory, the columns past them are zero.
+ * The training then goes through forward_pass_encoded, and the backward pass scatters the gradients into
+ * the parameters of the encoding, if it has any, and into the positions when the input gradients are enabled.
+ *
+ * @param encoding The encoding, its number of output dimensions at most WIDTH.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::set_encoding(Encoding* encoding) {
+	if (m_inputs_width != WIDTH || encoding->get_n_output_dims() > WIDTH) {
+		throw std::runtime_error{"The encoding must fit in the input width, which must be equal to the network width."};
+	}
+	if (m_precision != Precision::BFloat16) {
+		throw std::runtime_error{"The input encoding requires the precision of the element type of the network."};
+	}
+	m_encoding = encoding;
+	m_encoded_forward = false;
+	if (m_dL_dinput.size() == 0) {
+		m_dL_dinput.allocate(WIDTH * m_batch_size, m_q);
+	}
+	if (m_dL_dcoords.size() > 0) {
+		m_dL_dcoords.free_mem(m_q);
+	}
+	if (encoding->get_n_dims() > 0) {
+		m_dL_dcoords.allocate(encoding->get_n_dims() * m_batch_size, m_q);
+	}
+}
 
 /**
- * Constructor for the SwiftNetMLP class.
+ * Enable or disable the gradients of the loss with respect to the input in the backward pass, e.g. for the normals
+ * of a signed distance function or physics-informed losses. The deltas of the first hidden layer are propagated
+ * through the first layer in the backward kernel, and then through the input encoding when the forward pass was
+ * encoded. Passing the gradients of the output as loss gradients gives d(output)/d(input).
  *
- * @param q                  SYCL queue for command submission.
- * @param input_width        Width of the input data.
- * @param output_width       Width of the output data.
- * @param n_hidden_layers    Number of hidden layers.
- * @param activation         Activation function for hidden layers.
- * @param output_activation  Activation function for the output layer.
- * @param batch_size         Batch size of the data.
- * @tparam WIDTH             Width of the matrices.
+ * @param enabled Whether the backward pass computes the gradients of the input.
+ */
+template <int WIDTH, typename T>
+void SwiftNetMLP<WIDTH, T>::set_input_gradients(bool enabled) {
+	if (enabled && m_inputs_width != WIDTH) {
+		throw std::runtime_error{"The input gradients require the input width to be equal to the network width."};
+	}
+	m_input_gradients = enabled;
+	if (enabled && m_dL_dinput.size() == 0) {
+		m_dL_dinput.allocate(WIDTH * m_batch_size, m_q);
+	}
+}
+
+/**
+ * Get the gradients of the loss with respect to the input computed by the last backward pass.
+ *
+ * @return The gradients of the positions (get_n_dims() floats per row) after forward_pass_encoded, of the input
+ *         rows (WIDTH floats per row) otherwise or when the encoding has no positions.
+ */
+template <int WIDTH, typename T>
+DeviceMem<float>* SwiftNetMLP<WIDTH, T>::get_input_gradients() {
+	if (!m_input_gradients) {
+		throw std::runtime_error{"The input gradients are not enabled."};
+	}
+	return m_encoded_forward && m_encoding->get_n_dims() > 0 ? &m_dL_dcoords : &m_dL_dinput;
+}
+
+/**
+ * Constructor of a group of n_models SwiftNetMLP models sharing their shape.
+ *
+ * @param q                 SYCL queue for command submission.
+ * @param n_models          Number of models of the group.
+ * @param input_width       Width of the input data, equal to WIDTH.
+ * @param output_width      Width of the output data, a multiple of 16.
+ * @param n_hidden_layers   Number of hidden layers.
+ * @param activation        Activation function for hidden layers.
+ * @param output_activation Activation function for the output layer.
+ * @param max_batch_size    Maximum number of rows (all segments included) of an inference.
+ * @param training_batch_size Number of training rows of each model, 0 when the group is only used for inference.
  */
 template <int WIDTH>
-SwiftNetMLP<WIDTH>::SwiftNetMLP(
+SwiftNetMLPGroup<WIDTH>::SwiftNetMLPGroup(
 	queue q,
+	int n_models,
 	int input_width,
 	int output_width,
 	int n_hidden_layers,
 	Activation activation,
 	Activation output_activation,
-	int batch_size
+	int max_batch_size,
+	int training_batch_size
 ) :
-	m_inputs_width{ input_width },
-	m_net_width{ WIDTH },
-	m_output_width{ output_width },
+	m_q{ q },
+	m_n_models{ n_models },
 	m_n_hidden_layers{ n_hidden_layers },
+	m_output_width{ output_width },
+	m_max_batch_size{ max_batch_size },
 	m_activation{ activation },
 	m_output_activation{ output_activation },
-	m_batch_size{ batch_size }
+	m_training_batch_size{ training_batch_size }
 {
-	// Store provided parameters
-	m_q = q;
-	m_n_hidden_matrices = m_n_hidden_layers - 1;
+	if (input_width != WIDTH) {
+		throw std::runtime_error{"Grouped inference requires the input width to be equal to the network width."};
+	}
+	if (output_width % 16 != 0) {
+		throw std::runtime_error{"Grouped inference requires the output width to be a multiple of 16."};
+	}
 
-	// Allocate memory for various matrices
-	m_weightsT_matrices.allocate(m_net_width * m_inputs_width + (m_net_width * m_net_width) * m_n_hidden_matrices + m_net_width * m_output_width, m_q);
-	m_weights_matrices.allocate(m_net_width * m_inputs_width + (m_net_width * m_net_width) * m_n_hidden_matrices + m_net_width * m_output_width, m_q);
-	m_weights_matrices_inferences.allocate(m_net_width * m_inputs_width + (m_net_width * m_net_width) * m_n_hidden_matrices + m_net_width * m_output_width, m_q);
-	m_grads_matrices.allocate(m_net_width * m_inputs_width + (m_net_width * m_net_width) * m_n_hidden_matrices + m_net_width * m_output_width, m_q);
+	m_n_params = WIDTH * WIDTH * m_n_hidden_layers + WIDTH * m_output_width;
+	m_weights_matrices.allocate(m_n_params * m_n_models, m_q);
 
-	// Initialize constants and allocations
-	const int layer_length = WIDTH * m_batch_size;
-	m_alignment = SHMEM_SIZE;
+	m_chunk_models_host.resize((m_max_batch_size + BATCH_CHUNK - 1) / BATCH_CHUNK, -1);
+	m_chunk_models.allocate(m_chunk_models_host.size(), m_q);
 
-	// Allocate and initialize various memory buffers
-	m_forward = malloc_device<float>(m_batch_size * (m_inputs_width + m_output_width + WIDTH * m_n_hidden_layers), q);
+	if (m_training_batch_size > 0) {
+		if (m_training_batch_size % 64 != 0) {
+			throw std::runtime_error{"The training batch size must be a multiple of 64."};
+		}
+		const int n_rows = m_n_models * m_training_batch_size;
+		const int layer_length = WIDTH * n_rows;
+
+		// Model m owns the chunks of its training rows
+		std::vector<int> training_chunk_models(n_rows / BATCH_CHUNK);
+		for (int i = 0; i < training_chunk_models.size(); i++) {
+			training_chunk_models[i] = i / (m_training_batch_size / BATCH_CHUNK);
+		}
+		m_training_chunk_models.allocate(training_chunk_models.size(), m_q);
+		m_training_chunk_models.copy_from_host(training_chunk_models, m_q);
+
+		m_weightsT_matrices.allocate(m_n_params * m_n_models, m_q);
+		m_grads_matrices.allocate(m_n_params * m_n_models, m_q);
+		m_forward.allocate(layer_length * (m_n_hidden_layers + 1), m_q);
+		m_out_inter.allocate(layer_length * m_n_hidden_layers, m_q);
+		m_deltas_last_layer.allocate(layer_length, m_q);
+		m_output_weights.allocate(WIDTH * m_output_width * m_n_models, m_q);
+	}
+}
+
+template <int WIDTH>
+SwiftNetMLPGroup<WIDTH>::~SwiftNetMLPGroup() {
+
+}
+
+template <int WIDTH>
+int SwiftNetMLPGroup<WIDTH>::segment_alignment() {
+	return BATCH_CHUNK;
+}
 
-	m_shmem_size = m_batch_size * WIDTH * m_n_hidden_layers;
-	m_act_mem = sycl::aligned_alloc_device<bf16>(m_alignment, m_shmem_size, q);
-	m_act_mem_temp = sycl::aligned_alloc_device<float>(m_alignment, m_shmem_size, q);
+template <int WIDTH>
+DeviceMem<bf16>* SwiftNetMLPGroup<WIDTH>::get_weights_matrices() {
+	return &m_weights_matrices;
+}
 
-	m_A_forward = sycl::aligned_alloc_device<float>(m_alignment, layer_length, q);
-	m_B_forward = sycl::aligned_alloc_device<float>(m_alignment, m_output_width * WIDTH, q);
-	m_C_forward = sycl::aligned_alloc_device<float>(m_alignment, m_output_width * m_batch_size, q);
+template <int WIDTH>
+DeviceMem<bf16>* SwiftNetMLPGroup<WIDTH>::get_weightsT_matrices() {
+	return &m_weightsT_matrices;
+}
 
-	m_out_inter = malloc_device<float>(m_batch_size * WIDTH * (m_n_hidden_layers), q);
-	m_deltas_temp = sycl::aligned_alloc_device<float>(m_alignment, m_output_width * m_batch_size, q);
-	m_deltas.allocate(m_output_width * m_batch_size, q);
+template <int WIDTH>
+DeviceMem<float>* SwiftNetMLPGroup<WIDTH>::get_grads_matrices() {
+	return &m_grads_matrices;
+}
 
-	m_A_backward = sycl::aligned_alloc_device<float>(m_alignment, WIDTH * m_batch_size, q);
-	m_B_backward = sycl::aligned_alloc_device<float>(m_alignment, m_batch_size * m_output_width, q);
-	m_C_backward = sycl::aligned_alloc_device<float>(m_alignment, WIDTH * m_output_width, q);
+template <int WIDTH>
+int SwiftNetMLPGroup<WIDTH>::get_n_params_per_model() {
+	return m_n_params;
+}
 
-	m_A_backward_last_layer = sycl::aligned_alloc_device<float>(m_alignment, m_batch_size * m_output_width, q);
-	m_B_backward_last_layer = sycl::aligned_alloc_device<float>(m_alignment, m_output_width * WIDTH, q);
-	m_C_backward_last_layer = sycl::aligned_alloc_device<float>(m_alignment, WIDTH * m_batch_size, q);
-	m_D_backward_last_layer = sycl::aligned_alloc_device<float>(m_alignment, WIDTH * m_batch_size, q);
-	m_E_backward_last_layer = sycl::aligned_alloc_device<float>(m_alignment, m_batch_size * WIDTH, q);
-	m_F_backward_last_layer = sycl::aligned_alloc_device<float>(m_alignment, WIDTH * WIDTH, q);
+template <int WIDTH>
+int SwiftNetMLPGroup<WIDTH>::get_n_models() {
+	return m_n_models;
+}
 
-	m_A_dgemm = sycl::aligned_alloc_device<float>(m_alignment, m_batch_size * WIDTH, q);
-	m_B_dgemm = sycl::aligned_alloc_device<float>(m_alignment, m_batch_size * WIDTH, q);
-	m_C_dgemm = sycl::aligned_alloc_device<float>(m_alignment, WIDTH * WIDTH, q);
+template <int WIDTH>
+int SwiftNetMLPGroup<WIDTH>::get_n_hidden_layers() {
+	return m_n_hidden_layers;
 }
 
-template<int WIDTH>
-SwiftNetMLP<WIDTH>::~SwiftNetMLP() {
+template <int WIDTH>
+int SwiftNetMLPGroup<WIDTH>::get_output_width() {
+	return m_output_width;
+}
 
+template <int WIDTH>
+int SwiftNetMLPGroup<WIDTH>::get_training_batch_size() {
+	return m_training_batch_size;
 }
-/**
- * Get a pointer to the gradients matrices.
- *
- * @return A pointer to the gradients matrices.
- */
-template<int WIDTH>
-DeviceMem<bf16>* SwiftNetMLP<WIDTH>::get_grads_matrices() {
-	return &m_grads_matrices;
+
+template <int WIDTH>
+queue SwiftNetMLPGroup<WIDTH>::get_queue() {
+	return m_q;
 }
 
 /**
- * Get a pointer to the weights matrices.
- *
- * @return A pointer to the weights matrices.
+ * Regenerate the packed transposed weights of every model from its packed weights, for the backward pass.
  */
-template<int WIDTH>
-DeviceMem<bf16>* SwiftNetMLP<WIDTH>::get_weights_matrices() {
-	return &m_weights_matrices;
+template <int WIDTH>
+void SwiftNetMLPGroup<WIDTH>::update_transposed_weights() {
+	if (m_training_batch_size == 0) {
+		return;
+	}
+	auto p = m_weights_matrices.data();
+	auto pT = m_weightsT_matrices.data();
+	const int n_params = m_n_params;
+	const int output_width = m_output_width;
+	const int n_hidden_layers = m_n_hidden_layers;
+
+	m_q.parallel_for<>(range<1>(m_n_params * m_n_models), [=](id<1> idx) {
+		const int offset = (idx / n_params) * n_params;
+		const int unpacked_idx = idx % n_params;
+		pT[offset + toPackedWeightCoord(unpacked_idx, WIDTH, output_width, n_hidden_layers, true)] = p[offset + toPackedWeightCoord(unpacked_idx, WIDTH, output_width, n_hidden_layers, false)];
+		}).wait();
 }
 
 /**
- * Get a pointer to the transposed weights matrices.
+ * Copy the packed weights of a network into the slot of a model.
  *
- * @return A pointer to the transposed weights matrices.
+ * @param model   Index of the model in the group.
+ * @param network Network with the same shape as the models of the group.
  */
-template<int WIDTH>
-DeviceMem<bf16>* SwiftNetMLP<WIDTH>::get_weightsT_matrices() {
-	return &m_weightsT_matrices;
+template <int WIDTH>
+void SwiftNetMLPGroup<WIDTH>::set_model(int model, SwiftNetMLP<WIDTH>& network) {
+	if (model < 0 || model >= m_n_models) {
+		throw std::runtime_error{"Invalid model index."};
+	}
+	DeviceMem<bf16>* weights = network.get_weights_matrices();
+	if (weights->size() != m_n_params) {
+		throw std::runtime_error{"The network does not have the shape of the models of the group."};
+	}
+	m_q.memcpy(m_weights_matrices.data() + model * m_n_params, weights->data(), m_n_params * sizeof(bf16)).wait();
+	update_transposed_weights();
+	m_weights_version++;
 }
 
-/**
- * Initialize parameters for the neural network.
- * This function initializes the weights matrices with uniform random values.
- */
 template <int WIDTH>
-void SwiftNetMLP<WIDTH>::initialize_params() {
-	// Initialize weights matrices with uniform random values, you can choose a different initialization ( look in DeviceMem.cpp )
-	m_weights_matrices.initialize_uniform(0.01, m_weightsT_matrices, m_inputs_width, m_net_width, m_output_width, m_n_hidden_matrices, m_q);
-};
-
+void SwiftNetMLPGroup<WIDTH>::initialize_params() {
+	m_weights_matrices.initialize_uniform(m_q, 0.01);
+	update_transposed_weights();
+	m_weights_version++;
+}
 
 /**
- * Save the neural network parameters to a file.
+ * Evaluate every segment of the input with its model, in a single kernel launch.
  *
- * @param filename The name of the file to save the parameters to.
+ * @param input          The input data on the device, the segments one after the other.
+ * @param segment_models Model of every segment.
+ * @param segment_sizes  Number of rows of every segment, a multiple of segment_alignment().
+ * @param output         The output data on the device, in the order of the input.
  */
-template<int WIDTH>
-void SwiftNetMLP<WIDTH>::save_to_file(std::string filename) {
-	// Open the file for writing
-	std::ofstream file;
-	file.open(filename);
-
-	// Write parameters to the file
-	file << m_inputs_width << "\n";
-	file << m_net_width << "\n";
-	file << m_output_width << "\n";
-	file << m_n_hidden_layers << "\n";
-	file << m_n_hidden_matrices << "\n";
+template <int WIDTH>
+void SwiftNetMLPGroup<WIDTH>::inference(const DeviceMem<bf16>& input, const std::vector<int>& segment_models, const std::vector<int>& segment_sizes, DeviceMem<float>& output) {
+	if (segment_models.size() != segment_sizes.size()) {
+		throw std::runtime_error{"Every segment needs a model."};
+	}
 
-	// Write each value of the weights matrices to the file
-	for (int i = 0; i < m_weights_matrices.size(); i++) {
-		file << m_weights_matrices.data()[i] << "\n";
+	int n_chunks = 0;
+	for (int i = 0; i < segment_models.size(); i++) {
+		if (segment_models[i] < 0 || segment_models[i] >= m_n_models || segment_sizes[i] % BATCH_CHUNK != 0) {
+			throw std::runtime_error{"Invalid segment."};
+		}
+		if (n_chunks + segment_sizes[i] / BATCH_CHUNK > m_chunk_models_host.size()) {
+			throw std::runtime_error{"The segments exceed the maximum batch size of the group."};
+		}
+		std::fill_n(m_chunk_models_host.begin() + n_chunks, segment_sizes[i] / BATCH_CHUNK, segment_models[i]);
+		n_chunks += segment_sizes[i] / BATCH_CHUNK;
 	}
+	if (n_chunks == 0) {
+		return;
+	}
+	m_chunk_models.copy_from_host(m_chunk_models_host, n_chunks, m_q);
 
-	// Close the file
-	file.close();
-	return;
+	launch_forward(input.data(), m_chunk_models.data(), n_chunks, output.data(), nullptr);
 }
 
 /**
- * Load neural network parameters from a file.
+ * Launch the grouped forward kernel on n_chunks chunks of BATCH_CHUNK rows.
  *
- * @param filename The name of the file to load parameters from.
+ * @param input        Pointer to the input data.
+ * @param chunk_models Pointer to the model of every chunk.
+ * @param n_chunks     Number of chunks.
+ * @param output       Pointer to the output data.
+ * @param forward      Pointer to the storage of the activated hidden layers, nullptr in inference.
  */
-template<int WIDTH>
-void SwiftNetMLP<WIDTH>::load_from_file(std::string filename) {
-	// Open the file for reading
-	std::ifstream file;
-	file.open(filename);
-	std::string line;
-
-	// Read parameters from the file
-	file >> m_inputs_width;
-	file >> m_net_width;
-	file >> m_output_width;
-	file >> m_n_hidden_layers;
-	file >> m_n_hidden_matrices;
+template <int WIDTH>
+void SwiftNetMLPGroup<WIDTH>::launch_forward(const bf16* input, const int* chunk_models, int n_chunks, float* output, bf16* forward) {
+	const int N_ITERS = BATCH_CHUNK / TM;
+	const Activation output_activation = m_output_activation;
+	const int n_params = m_n_params;
+	const int output_width = m_output_width;
+	const uint32_t n_hidden_matmuls = m_n_hidden_layers - 1;
+	const int layer_length = WIDTH * n_chunks * BATCH_CHUNK;
+	auto weights = m_weights_matrices.data();
 
-	// Read each value from the file and set it as a bf16 value in weights matrices
-	for (int i = 0; i < m_weights_matrices.size(); i++) {
-		float x;
-		file >> x;
-		m_weights_matrices.data()[i] = bf16(x);
-	}
+	auto launch = [&](auto activation_constant) {
+		constexpr Activation activation = decltype(activation_constant)::value;
+		m_q.submit([&](handler& cgh) {
+			local_accessor<bf16> act_mem = local_accessor<bf16>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, cgh);
+			local_accessor<float> act_mem_temp = local_accessor<float>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, cgh);
 
-	// Close the file
-	file.close();
+			cgh.parallel_for(nd_range<1>(n_chunks * WG_SIZE, WG_SIZE), [=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]] {
+				kernel_swift_mlp_group<WIDTH, N_ITERS, activation>(item, output_activation, input, weights, chunk_models, forward, act_mem, act_mem_temp, output, n_params, output_width, n_hidden_matmuls, layer_length);
+				});
+			}).wait();
+	};
 
-	// Make the weights matrices transposed using the transposed weights matrices
-	m_weights_matrices.make_transposed(m_weightsT_matrices, m_inputs_width, m_net_width, m_output_width, m_n_hidden_matrices, m_q);
-	return;
+	switch (m_activation) {
+	case Activation::None:        launch(std::integral_constant<Activation, Activation::None>{}); break;
+	case Activation::Exponential: launch(std::integral_constant<Activation, Activation::Exponential>{}); break;
+	case Activation::Sigmoid:     launch(std::integral_constant<Activation, Activation::Sigmoid>{}); break;
+	case Activation::ReLU:        launch(std::integral_constant<Activation, Activation::ReLU>{}); break;
+	case Activation::LeakyReLU:   launch(std::integral_constant<Activation, Activation::LeakyReLU>{}); break;
+	case Activation::Squareplus:  launch(std::integral_constant<Activation, Activation::Squareplus>{}); break;
+	case Activation::Softplus:    launch(std::integral_constant<Activation, Activation::Softplus>{}); break;
+	case Activation::Tanh:        launch(std::integral_constant<Activation, Activation::Tanh>{}); break;
+	default: throw std::runtime_error{"Unsupported activation."};
+	}
 }
 
-
 /**
- * Free memory allocated on the device for various arrays.
+ * Forward pass of every model of the group on its training rows.
+ * The input and the activated hidden layers of all the models are stored for the backward pass.
  *
- * @param q The SYCL queue used for device operations.
+ * @param input  The input data on the device, training_batch_size rows per model.
+ * @param output The output data on the device.
  */
 template <int WIDTH>
-void SwiftNetMLP<WIDTH>::free_mem(queue q) {
-	// Free memory for arrays allocated using sycl::aligned_alloc_device
-	free(m_act_mem, q);
-	free(m_act_mem_temp, q);
-	free(m_out_inter, q);
-	free(m_deltas_temp, q);
-	free(m_A_forward, q);
-	free(m_B_forward, q);
-	free(m_C_forward, q);
-
-	// Free memory for DeviceMem<bf16> arrays using their free_mem member function
-	m_deltas.free_mem(q);
+void SwiftNetMLPGroup<WIDTH>::forward_pass(const DeviceMem<bf16>& input, DeviceMem<float>& output) {
+	if (m_training_batch_size == 0) {
+		throw std::runtime_error{"The group has no training batch size."};
+	}
+	const int n_rows = m_n_models * m_training_batch_size;
 
-	free(m_A_backward, q);
-	free(m_B_backward, q);
-	free(m_C_backward, q);
-	free(m_A_backward_last_layer, q);
-	free(m_B_backward_last_layer, q);
-	free(m_C_backward_last_layer, q);
-	free(m_D_backward_last_layer, q);
-	free(m_E_backward_last_layer, q);
-	free(m_F_backward_last_layer, q);
-	free(m_A_dgemm, q);
-	free(m_B_dgemm, q);
-	free(m_C_dgemm, q);
+	m_q.memcpy(m_forward.data(), input.data(), n_rows * WIDTH * sizeof(bf16)).wait();
+	launch_forward(input.data(), m_training_chunk_models.data(), n_rows / BATCH_CHUNK, output.data(), m_forward.data());
 }
 
-
 /**
- * Perform a forward pass of the SwiftNetMLP model.
+ * Backward pass of every model of the group on its training rows.
+ * The output layer is handled by strided oneMKL batches over the models, the hidden layers by a single launch
+ * of the fused backward kernel, and the weight gradients by one strided batch per layer. The gradients are summed
+ * over the training rows of each model, in the unpacked layout.
  *
- * @param input The input data on the device.
- * @param forward Pointer to the forward intermediate array.
- * @param act_mem Pointer to activation memory.
- * @param act_mem_temp Pointer to temporary activation memory.
- * @param A Temporary array A for matrix multiplication.
- * @param B Temporary array B for matrix multiplication.
- * @param C Temporary array C for matrix multiplication.
- * @param output The output data on the device.
+ * @param loss_grads The gradients of the loss with respect to the output, overwritten by the output deltas.
+ * @param output     The output of the forward pass (for the output activation).
  */
 template <int WIDTH>
-void SwiftNetMLP<WIDTH>::forward_pass(const DeviceMem<bf16>& input, float* forward, float* A, float* B, float* C, DeviceMem<float>& output) {
-	// Constants and dimensions
-	const int output_stride = WIDTH;
-	const int intermediate_output_size = m_batch_size * WIDTH * m_n_hidden_layers;
-	const int layer_length = WIDTH * m_batch_size;
-	const int n_hidden_matrices = m_n_hidden_matrices;
-	const int net_width = m_net_width;
-	const int inputs_width = m_inputs_width;
+void SwiftNetMLPGroup<WIDTH>::backward_pass(DeviceMem<bf16>& loss_grads, const DeviceMem<float>& output) {
+	const int batch_size = m_training_batch_size;
+	const int n_models = m_n_models;
+	const int n_rows = n_models * batch_size;
+	const int layer_length = WIDTH * n_rows;
+	const int n_params = m_n_params;
 	const int output_width = m_output_width;
+	const int n_hidden_layers = m_n_hidden_layers;
+	const uint32_t n_hidden_matmuls = m_n_hidden_layers - 1;
+	const int N_ITERS = BATCH_CHUNK / TM;
+	const Activation activation = m_activation;
+	const Activation output_activation = m_output_activation;
 
-	// Static assertion and assertion checks
-	static_assert(WIDTH % 16 == 0, "Width must be a multiple of 16.");
-	assert(m_batch_size % 64 == 0);
+	auto p_l = loss_grads.data();
+	auto p_out = output.data();
+	auto p_w = m_weights_matrices.data();
+	auto p_wT = m_weightsT_matrices.data();
+	auto p_g = m_grads_matrices.data();
+	auto p_f = m_forward.data();
+	auto p_d = m_out_inter.data();
+	auto p_c = m_deltas_last_layer.data();
+	auto p_wo = m_output_weights.data();
+	auto chunk_models = m_training_chunk_models.data();
+
+	m_q.parallel_for<>(range<1>(n_rows * output_width), [=](id<1> idx) {
+		elt_activation_bwd<bf16, float, bf16>(output_activation, p_l[idx], p_out[idx], p_l[idx]);
+		}).wait();
 
-	// Get a pointer to the weights matrices data
-	auto p = m_weights_matrices.data();
+	// Output layer gradients of all the models: G_m = F_m^T * D_m
+	oneapi::mkl::blas::row_major::gemm_batch(m_q, oneapi::mkl::transpose::trans, oneapi::mkl::transpose::nontrans,
+		WIDTH, output_width, batch_size, 1, p_f + n_hidden_layers * layer_length, WIDTH, batch_size * WIDTH, p_l, output_width, batch_size * output_width,
+		0, p_g + n_hidden_layers * WIDTH * WIDTH, output_width, n_params, n_models).wait();
 
-	// Perform forward pass based on activation function
-	switch (m_activation) {
-	case Activation::None:
-		mlp_swift_forward<WIDTH, Activation::None, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input.size(), output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size);
-		break;
-	case Activation::Exponential:
-		mlp_swift_forward<WIDTH, Activation::None, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input.size(), output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size);
-		break;
-	case Activation::Sigmoid:
-		mlp_swift_forward<WIDTH, Activation::Sigmoid, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input.size(), output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size);
-		break;
-	case Activation::ReLU:
-		mlp_swift_forward<WIDTH, Activation::ReLU, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input.size(), output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size);
-		break;
-	case Activation::LeakyReLU:
-		mlp_swift_forward<WIDTH, Activation::LeakyReLU, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input.size(), output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size);
-		break;
-	case Activation::Squareplus:
-		mlp_swift_forward<WIDTH, Activation::Squareplus, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input.size(), output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size);
-		break;
-	case Activation::Softplus:
-		mlp_swift_forward<WIDTH, Activation::Softplus, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input.size(), output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size);
-		break;
-	case Activation::Tanh:
-		mlp_swift_forward<WIDTH, Activation::Tanh, false>(m_q, m_output_activation, m_weights_matrices, input, forward + input.size(), output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size);
-		break;
-	default: return;
+	if (m_output_weights_version != m_weights_version) {
+		m_q.parallel_for<>(range<1>(WIDTH * output_width * n_models), [=](id<1> idx) {
+			const int model = idx / (WIDTH * output_width);
+			const int i = idx % (WIDTH * output_width);
+			p_wo[idx] = p_w[model * n_params + n_hidden_layers * WIDTH * WIDTH + toPackedLayoutCoord(i, WIDTH, output_width)];
+			}).wait();
+		m_output_weights_version = m_weights_version;
 	}
 
-	// Handle the case when output_width is greater than 16
-	if (m_output_width > 16) {
-		m_q.parallel_for<>(range<1>(m_output_width * m_net_width), [=](id<1> idx) {
-			B[idx] = (float)p[toPackedLayoutCoord(idx, net_width, output_width) + net_width * (inputs_width + n_hidden_matrices * net_width)];
-			});
+	// Deltas of the last hidden layer: D_m * W_m^T, then the activation
+	oneapi::mkl::blas::row_major::gemm_batch(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::trans,
+		batch_size, WIDTH, output_width, 1, p_l, output_width, batch_size * output_width, p_wo, output_width, WIDTH * output_width,
+		0, p_c, WIDTH, batch_size * WIDTH, n_models).wait();
 
-		oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
-			m_batch_size, m_output_width, WIDTH, 1, forward + (n_hidden_matrices + 1) * layer_length, WIDTH, B, m_output_width, 0, C, m_output_width);
+	m_q.parallel_for<>(range<1>(layer_length), [=](id<1> idx) {
+		elt_activation_bwd<float, bf16, bf16>(activation, p_c[idx], p_f[n_hidden_layers * layer_length + idx], p_d[n_hidden_matmuls * layer_length + idx]);
+		}).wait();
 
-		m_q.parallel_for<>(range<1>(m_output_width * m_batch_size), [=](id<1> idx) {
-			output.data()[idx] = C[idx];
-			forward[intermediate_output_size + input.size() + idx] = C[idx];
+	// Hidden layers of all the models in one launch
+	auto launch = [&](auto activation_constant) {
+		constexpr Activation ACTIVATION = decltype(activation_constant)::value;
+		m_q.submit([&](handler& h) {
+			local_accessor<bf16> deltas_layers = local_accessor<bf16>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
+			local_accessor<float> delta_temp = local_accessor<float>(range<1>(SHMEM_SIZE + BATCH_CHUNK * SKEW) * WIDTH / 64, h);
+			auto a = deltas_layers.get_pointer();
+			auto at = delta_temp.get_pointer();
+
+			h.parallel_for(nd_range<1>(n_rows * WG_SIZE / BATCH_CHUNK, WG_SIZE), [=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]] {
+				kernel_swiftnet_backward_group<WIDTH, N_ITERS, ACTIVATION>(item, a, at, chunk_models, p_wT, n_params, p_f, p_d, n_hidden_matmuls, n_rows);
+				});
 			}).wait();
+	};
+
+	if (n_hidden_matmuls > 0) {
+		switch (m_activation) {
+		case Activation::None:        launch(std::integral_constant<Activation, Activation::None>{}); break;
+		case Activation::ReLU:        launch(std::integral_constant<Activation, Activation::ReLU>{}); break;
+		case Activation::LeakyReLU:   launch(std::integral_constant<Activation, Activation::LeakyReLU>{}); break;
+		case Activation::Exponential: launch(std::integral_constant<Activation, Activation::Exponential>{}); break;
+		case Activation::Sigmoid:     launch(std::integral_constant<Activation, Activation::Sigmoid>{}); break;
+		case Activation::Tanh:        launch(std::integral_constant<Activation, Activation::Tanh>{}); break;
+		default: throw std::runtime_error{"Unsupported activation."};
+		}
+	}
+
+	// Gradients of the input and hidden matrices, one batch over the models per layer
+	for (int k = 0; k < n_hidden_layers; k++) {
+		oneapi::mkl::blas::row_major::gemm_batch(m_q, oneapi::mkl::transpose::trans, oneapi::mkl::transpose::nontrans,
+			WIDTH, WIDTH, batch_size, 1, p_f + k * layer_length, WIDTH, batch_size * WIDTH, p_d + k * layer_length, WIDTH, batch_size * WIDTH,
+			0, p_g + k * WIDTH * WIDTH, WIDTH, n_params, n_models).wait();
 	}
 }
 
 template <int WIDTH>
-void SwiftNetMLP<WIDTH>::inference(const DeviceMem<bf16>& input, float* forward, float* A, float* B, float* C, DeviceMem<float>& output) {
-
-	const int output_stride = WIDTH;
-	const int input_size = input.size();
-	const int layer_length = WIDTH * m_batch_size;
-	const int n_hidden_matrices = m_n_hidden_matrices;
-	const int net_width = m_net_width;
-	const int inputs_width = m_inputs_width;
-	const int output_width = m_output_width;
-
-	static_assert(WIDTH % 16 == 0, "Width must be a multiply of 16.");
-	assert(m_batch_size % 64 == 0);
-	auto p = m_weights_matrices.data();
+void SwiftNetMLPGroup<WIDTH>::free_mem(queue q) {
+	m_weights_matrices.free_mem(q);
+	m_chunk_models.free_mem(q);
+
+	if (m_training_batch_size > 0) {
+		m_training_chunk_models.free_mem(q);
+		m_weightsT_matrices.free_mem(q);
+		m_grads_matrices.free_mem(q);
+		m_forward.free_mem(q);
+		m_out_inter.free_mem(q);
+		m_deltas_last_layer.free_mem(q);
+		m_output_weights.free_mem(q);
+	}
+}
 
+/**
+ * Constructor of a network with per-layer widths.
+ *
+ * @param q                 SYCL queue for command submission.
+ * @param output_width      Width of the output, a multiple of TN.
+ * @param activation        Activation of the hidden layers.
+ * @param output_activation Activation of the output layer.
+ */
+template <int... WIDTHS>
+SwiftNetMLPVarWidth<WIDTHS...>::SwiftNetMLPVarWidth(queue q, int output_width, Activation activation, Activation output_activation) {
+	if (output_width % TN != 0) {
+		throw std::runtime_error{"The output width must be a multiple of " + std::to_string(TN) + "."};
+	}
+	m_q = q;
+	m_output_width = output_width;
+	m_activation = activation;
+	m_output_activation = output_activation;
+	m_weights_matrices.allocate(get_n_params(), q);
+	initialize_params();
+}
 
+template <int... WIDTHS>
+SwiftNetMLPVarWidth<WIDTHS...>::~SwiftNetMLPVarWidth() {
+}
 
-	switch (m_activation) {
-	case Activation::None:        mlp_swift_forward<WIDTH, Activation::None, true>(m_q, m_output_activation, m_weights_matrices, input, forward, output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size); break;
-	case Activation::Exponential: mlp_swift_forward<WIDTH, Activation::Exponential, true>(m_q, m_output_activation, m_weights_matrices, input, forward, output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size); break;
-	case Activation::Sigmoid:     mlp_swift_forward<WIDTH, Activation::Sigmoid, true>(m_q, m_output_activation, m_weights_matrices, input, forward, output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size); break;
-	case Activation::ReLU:        mlp_swift_forward<WIDTH, Activation::ReLU, true>(m_q, m_output_activation, m_weights_matrices, input, forward, output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size); break;
-	case Activation::LeakyReLU:   mlp_swift_forward<WIDTH, Activation::LeakyReLU, true>(m_q, m_output_activation, m_weights_matrices, input, forward, output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size); break;
-	case Activation::Squareplus:  mlp_swift_forward<WIDTH, Activation::Squareplus, true>(m_q, m_output_activation, m_weights_matrices, input, forward, output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size); break;
-	case Activation::Softplus:    mlp_swift_forward<WIDTH, Activation::Softplus, true>(m_q, m_output_activation, m_weights_matrices, input, forward, output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size); break;
-	case Activation::Tanh:        mlp_swift_forward<WIDTH, Activation::Tanh, true>(m_q, m_output_activation, m_weights_matrices, input, forward, output, output_stride, m_n_hidden_layers, m_inputs_width, m_output_width, m_batch_size); break;
-	default: throw std::runtime_error{"Unsupported activation."};
+/**
+ * Set the weights from fp32 matrices, packed to bf16 on the host.
+ *
+ * @param weights The matrices between consecutive widths followed by the output matrix, each one row-major with a
+ *                row per input.
+ */
+template <int... WIDTHS>
+void SwiftNetMLPVarWidth<WIDTHS...>::set_weights(const std::vector<float>& weights) {
+	if (weights.size() != get_n_params()) {
+		throw std::runtime_error{"Invalid number of weights."};
 	}
 
-	if (m_output_width > 16) {
-		m_q.parallel_for<>(range<1>(m_output_width * m_net_width), [=](id<1> idx) {
-			B[idx] = p[toPackedLayoutCoord(idx, net_width, output_width) + net_width * (inputs_width + n_hidden_matrices * net_width)];
-			});
+	std::vector<int> widths = get_widths();
+	widths.push_back(m_output_width);
+	std::vector<bf16> packed(weights.size());
+	int offset = 0;
+	for (int layer = 0; layer + 1 < widths.size(); layer++) {
+		const int rows = widths[layer];
+		const int cols = widths[layer + 1];
+		for (int idx = 0; idx < rows * cols; idx++) {
+			packed[offset + toPackedLayoutCoord(idx, rows, cols)] = (bf16)weights[offset + idx];
+		}
+		offset += rows * cols;
+	}
+	m_weights_matrices.copy_from_host(packed, m_q);
+}
 
-		oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
-			m_batch_size, m_output_width, WIDTH, 1, A, WIDTH, B, m_output_width, 0, output.data(), m_output_width);
+// Initialize every matrix with a uniform distribution scaled by its fan-in and fan-out
+template <int... WIDTHS>
+void SwiftNetMLPVarWidth<WIDTHS...>::initialize_params() {
+	std::vector<int> widths = get_widths();
+	widths.push_back(m_output_width);
+	std::vector<float> weights;
+	std::mt19937 rng(42);
+	for (int layer = 0; layer + 1 < widths.size(); layer++) {
+		std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		const float scale = std::sqrt(6.0f / (widths[layer] + widths[layer + 1]));
+		for (int idx = 0; idx < widths[layer] * widths[layer + 1]; idx++) {
+			weights.push_back(scale * distribution(rng));
+		}
 	}
+	set_weights(weights);
 }
 
 /**
- * Perform matrix multiplications and activation backpropagation for the last layer (beginning of the backward pass) .
+ * Inference of the network.
  *
- * @param grads The gradients on the device.
- * @param forward Pointer to the forward intermediate array.
- * @param loss The loss gradients on the device.
- * @param batch_size The batch size.
- * @param A Temporary array A for matrix multiplication.
- * @param B Temporary array B for matrix multiplication.
- * @param C Temporary array C for matrix multiplication.
- * @param D Temporary array D for activation backpropagation.
- * @param E Temporary array E for activation backpropagation.
- * @param F Temporary array F for matrix multiplication.
+ * @param input      The input data on the device, widths[0] values per row.
+ * @param output     The output data on the device, output_width values per row.
+ * @param batch_size Number of rows, a multiple of BATCH_CHUNK.
  */
-template <int WIDTH>
-void SwiftNetMLP<WIDTH>::dgemm_last_layer_backward(DeviceMem<bf16>& grads,
-	float* forward,
-	DeviceMem<bf16>& loss,
-	int batch_size,
-	float* A,
-	float* B,
-	float* C,
-	float* D,
-	float* E,
-	float* F) {
-
-	auto p_w = m_weightsT_matrices.data();
-	auto p_g = m_grads_matrices.data();
-	const int offset_w = m_n_hidden_matrices * m_net_width * m_net_width + m_net_width * m_inputs_width;
-	const int offset_g = m_inputs_width * m_net_width + (m_n_hidden_matrices - 1) * m_net_width * m_net_width;
-	const int offset_f = (m_inputs_width + (m_n_hidden_matrices - 1) * batch_size) * m_net_width;
+template <int... WIDTHS>
+void SwiftNetMLPVarWidth<WIDTHS...>::inference(const DeviceMem<bf16>& input, DeviceMem<float>& output, int batch_size) {
+	if (batch_size % BATCH_CHUNK != 0) {
+		throw std::runtime_error{"The batch size must be a multiple of " + std::to_string(BATCH_CHUNK) + "."};
+	}
+	const int N_ITERS = BATCH_CHUNK / TM;
+	constexpr int MAX_WIDTH = std::max({ WIDTHS... });
+	const Activation activation = m_activation;
+	const Activation output_activation = m_output_activation;
 	const int output_width = m_output_width;
-	const int net_width = m_net_width;
+	const bf16* p_input = input.data();
+	float* p_output = output.data();
+	auto weights = m_weights_matrices.data();
 
-	int i = 0;
-	int j = 0;
-	auto activation = m_activation;
+	m_q.submit([&](handler& cgh) {
+		local_accessor<bf16> act_mem = local_accessor<bf16>(range<1>(BATCH_CHUNK * (MAX_WIDTH + SKEW)), cgh);
+		local_accessor<float> act_mem_temp = local_accessor<float>(range<1>(BATCH_CHUNK * (MAX_WIDTH + SKEW)), cgh);
 
-	m_q.parallel_for<>(range<1>(grads.size()), [=](id<1> idx) {
-		A[idx] = (float)loss.data()[idx];
+		cgh.parallel_for(nd_range<1>(batch_size * WG_SIZE / BATCH_CHUNK, WG_SIZE), [=](nd_item<1> item) [[intel::reqd_sub_group_size(SG_SIZE)]] {
+			kernel_swift_mlp_var_width<N_ITERS, WIDTHS...>(item, activation, output_activation, p_input, weights, act_mem, act_mem_temp, p_output, output_width);
+			});
 		}).wait();
+}
 
-		m_q.parallel_for<>(range<1>(m_output_width * WIDTH), [=](id<1> idx) {
-			B[idx] = p_w[offset_w + toPackedLayoutCoord(idx, output_width, net_width)];
-			}).wait();
-
-			oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
-				batch_size, m_net_width, m_output_width, 1, A, m_output_width, B, m_net_width, 0, C, m_net_width);
-
-			m_q.parallel_for<>(range<1>(WIDTH * batch_size), [=](id<1> idx) {
-				int i = idx / batch_size;
-				int j = idx % batch_size;
-				D[i * batch_size + j] = elt_activation_ret<float>(activation, forward[offset_f + j * net_width + i]);
-				}).wait();
-
-				m_q.parallel_for<>(range<1>(m_net_width * batch_size), [=](id<1> idx) {
-					elt_activation_bwd<float, float, float>(activation, C[idx], forward[offset_f + idx], E[idx]);
-					loss.data()[idx] = (bf16)E[idx];
-					}).wait();
-
-
-					oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
-						m_net_width, m_net_width, batch_size, 1, D, batch_size, E, m_net_width, 0, F, m_net_width);
-
-					m_q.parallel_for<>(range<1>(m_net_width * m_net_width), [=](id<1> idx) {
-						p_g[idx + offset_g] = (float)F[idx];
-						}).wait();
+template <int... WIDTHS>
+std::vector<int> SwiftNetMLPVarWidth<WIDTHS...>::get_widths() const {
+	return { WIDTHS... };
+}
 
+template <int... WIDTHS>
+int SwiftNetMLPVarWidth<WIDTHS...>::get_n_params() const {
+	constexpr int widths[] = { WIDTHS... };
+	return N_HIDDEN_PARAMS + widths[sizeof...(WIDTHS) - 1] * m_output_width;
 }
 
+template <int... WIDTHS>
+void SwiftNetMLPVarWidth<WIDTHS...>::free_mem(queue q) {
+	m_weights_matrices.free_mem(q);
+}
 
 /**
- * Perform the backward pass of the neural network.
+ * Create a network with per-layer widths among the instantiated shapes.
  *
- * @param input The input data on the device.
- * @param grads The gradients on the device.
- * @param out_inter Intermediate array for storing outputs.
- * @param delta_temp Temporary array for deltas.
- * @param loss Loss array on the device.
- * @param A Temporary array A for activation backpropagation.
- * @param B Temporary array B for activation backpropagation.
- * @param C Temporary array C for matrix multiplication.
- * @param A_backward_last_layer Temporary array A for last layer backward pass.
- * @param B_backward_last_layer Temporary array B for last layer backward pass.
- * @param C_backward_last_layer Temporary array C for last layer backward pass.
- * @param D_backward_last_layer Temporary array D for last layer backward pass.
- * @param E_backward_last_layer Temporary array E for last layer backward pass.
- * @param F_backward_last_layer Temporary array F for last layer backward pass.
- * @param A_dgemm Temporary array A for DGEMM.
- * @param B_dgemm Temporary array B for DGEMM.
- * @param C_dgemm Temporary array C for DGEMM.
- * @param forward Pointer to the forward intermediate array.
+ * @param q                 SYCL queue for command submission.
+ * @param widths            Widths of the input and the hidden layers.
+ * @param output_width      Width of the output.
+ * @param activation        Activation of the hidden layers.
+ * @param output_activation Activation of the output layer.
+ * @return                  The network, to be deleted by the caller.
  */
-template <int WIDTH>
-void SwiftNetMLP<WIDTH>::backward_pass(const DeviceMem<bf16>& input,
-	DeviceMem<bf16>& grads,
-	float* out_inter,
-	float* delta_temp,
-	DeviceMem<bf16> loss,
-	float* A,
-	float* B,
-	float* C,
-	float* A_backward_last_layer,
-	float* B_backward_last_layer,
-	float* C_backward_last_layer,
-	float* D_backward_last_layer,
-	float* E_backward_last_layer,
-	float* F_backward_last_layer,
-	float* A_dgemm,
-	float* B_dgemm,
-	float* C_dgemm,
-	float* forward) {
-
-	int batch_size = m_batch_size;
-	auto p = m_grads_matrices.data();
-	int s = m_grads_matrices.size();
-	auto activation = m_activation;
-	auto output_activation = m_output_activation;
-	const int offset_grad = m_n_hidden_matrices * m_net_width * m_net_width + m_inputs_width * m_net_width;
-	const int offset_f = m_inputs_width * batch_size + m_n_hidden_matrices * m_net_width * batch_size;
-
-	const size_t alignment = 1024;
-
-	// Compute activation backpropagation using parallel_for
-	m_q.parallel_for<>(range<1>(WIDTH * batch_size), [=](id<1> idx) {
-		int i = idx / batch_size;
-		int j = idx % batch_size;
-		A[i * batch_size + j] = elt_activation_ret<float>(activation, forward[offset_f + j * WIDTH + i]);
-		}).wait();
-
-		// Compute output activation backpropagation using parallel_for and copy to loss array
-		m_q.parallel_for<>(range<1>(batch_size * m_output_width), [=](id<1> idx) {
-			elt_activation_bwd<bf16, float, float>(output_activation, grads.data()[idx], forward[offset_f + batch_size * WIDTH + idx], B[idx]);
-			loss.data()[idx] = (bf16)B[idx];
-			}).wait();
-
-			// Perform matrix multiplication using MKL BLAS
-			oneapi::mkl::blas::row_major::gemm(m_q, oneapi::mkl::transpose::nontrans, oneapi::mkl::transpose::nontrans,
-				m_net_width, m_output_width, batch_size, 1, A, batch_size, B, m_output_width, 0, C, m_output_width);
-
-			// Copy the result back to the gradients matrix
-			m_q.parallel_for<>(range<1>(m_net_width * m_output_width), [=](id<1> idx) {
-				p[idx + offset_grad] = (float)C[idx];
-				}).wait();
-
-				// Backpropagation through last layer using dgemm_last_layer_backward
-				dgemm_last_layer_backward(grads, forward, loss, batch_size, A_backward_last_layer, B_backward_last_layer, C_backward_last_layer, D_backward_last_layer, E_backward_last_layer, F_backward_last_layer);
-
-				// Choose appropriate mlp_swiftnet_backward based on activation
-				switch (m_activation) {
-				case Activation::None: mlp_swiftnet_backward<WIDTH, Activation::None>(m_q, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, A_dgemm, B_dgemm, C_dgemm, m_n_hidden_matrices, m_batch_size); break;
-				case Activation::ReLU: mlp_swiftnet_backward<WIDTH, Activation::ReLU>(m_q, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, A_dgemm, B_dgemm, C_dgemm, m_n_hidden_matrices, m_batch_size); break;
-				case Activation::LeakyReLU: mlp_swiftnet_backward<WIDTH, Activation::LeakyReLU>(m_q, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, A_dgemm, B_dgemm, C_dgemm, m_n_hidden_matrices, m_batch_size); break;
-				case Activation::Exponential: mlp_swiftnet_backward<WIDTH, Activation::Exponential>(m_q, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, A_dgemm, B_dgemm, C_dgemm, m_n_hidden_matrices, m_batch_size); break;
-				case Activation::Sigmoid: mlp_swiftnet_backward<WIDTH, Activation::Sigmoid>(m_q, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, A_dgemm, B_dgemm, C_dgemm, m_n_hidden_matrices, m_batch_size); break;
-				case Activation::Tanh: mlp_swiftnet_backward<WIDTH, Activation::Tanh>(m_q, m_weightsT_matrices, loss, m_grads_matrices, out_inter, delta_temp, forward, A_dgemm, B_dgemm, C_dgemm, m_n_hidden_matrices, m_batch_size); break;
-				default: return;
-				}
-
-				// Normalize gradients
-				m_q.parallel_for<>(range<1>(s), [=](id<1> idx) {
-					p[idx] /= batch_size;
-					}).wait();
+VarWidthNetwork* create_var_width_network(queue q, const std::vector<int>& widths, int output_width, Activation activation, Activation output_activation) {
+	if (widths == std::vector<int>{ 64, 32 }) return new SwiftNetMLPVarWidth<64, 32>(q, output_width, activation, output_activation);
+	if (widths == std::vector<int>{ 64, 64, 32 }) return new SwiftNetMLPVarWidth<64, 64, 32>(q, output_width, activation, output_activation);
+	if (widths == std::vector<int>{ 128, 64 }) return new SwiftNetMLPVarWidth<128, 64>(q, output_width, activation, output_activation);
+	if (widths == std::vector<int>{ 128, 64, 32 }) return new SwiftNetMLPVarWidth<128, 64, 32>(q, output_width, activation, output_activation);
+	if (widths == std::vector<int>{ 128, 128, 64, 32 }) return new SwiftNetMLPVarWidth<128, 128, 64, 32>(q, output_width, activation, output_activation);
+	throw std::runtime_error{"No network is instantiated with these widths."};
 }
 
 template class SwiftNetMLP<64>;
 template class SwiftNetMLP<128>;
+template class SwiftNetMLP<64, sycl::half>;
+template class SwiftNetMLP<128, sycl::half>;
+template class SwiftNetMLPGroup<64>;
+template class SwiftNetMLPGroup<128>;
+template class SwiftNetMLPVarWidth<64, 32>;
+template class SwiftNetMLPVarWidth<64, 64, 32>;
+template class SwiftNetMLPVarWidth<128, 64>;
+template class SwiftNetMLPVarWidth<128, 64, 32>;
+template class SwiftNetMLPVarWidth<128, 128, 64, 32>;
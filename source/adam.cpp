@@ -1,11 +1,19 @@
 #include "adam.h"
 #include <vector>
 
+// Number of consecutive parameters sharing the scale factors of the 8-bit moments
+#define ADAM_BLOCK_SIZE 256
+
 /**
  * Perform an Adam optimizer step for a single element.
+ * The fp32 master weight is updated and its packed bf16 or fp16 copies in the weights and the transposed weights
+ * are regenerated, so that the moments are updated once and both copies stay identical.
+ * The moments are updated in fp32 in place, the caller loads and stores them in their storage precision.
  *
- * @param idx Index of the element to process.
+ * @param idx Index of the element to process (unpacked layout).
  * @param n_elements Total number of elements.
+ * @param output_width Width of the output layer.
+ * @param n_hidden_layers Number of hidden layers in the network.
  * @param relative_weight_decay Relative weight decay coefficient.
  * @param absolute_weight_decay Absolute weight decay coefficient.
  * @param weight_clipping_magnitude Weight clipping magnitude.
@@ -18,14 +26,23 @@
  * @param lower_lr_bound Lower bound for the learning rate.
  * @param upper_lr_bound Upper bound for the learning rate.
  * @param l2_reg L2 regularization coefficient.
- * @param weights Pointer to weights (bf16 type).
- * @param gradients Pointer to gradients (bf16 type).
- * @param first_moments Pointer to first moments.
- * @param second_moments Pointer to second moments.
+ * @param master_weights Pointer to the fp32 master weights.
+ * @param weights Pointer to packed weights (type T).
+ * @param weightsT Pointer to packed transposed weights (type T).
+ * @param gradients Pointer to gradients (fp32 type).
+ * @param first_moment First moment of the element.
+ * @param second_moment Second moment of the element.
+ * @param master_ema_weights Pointer to the fp32 moving average of the weights.
+ * @param ema_weights Pointer to the packed moving average of the weights (nullptr when disabled).
+ * @param ema_decay Decay of the moving average.
  * @param WIDTH Width of the matrix (for matrix operations).
+ * @tparam T Element type of the weights of the network (bf16 or half).
  */
+template <typename T>
 void adam_step(id<1> idx,
 	const int n_elements,
+	int output_width,
+	int n_hidden_layers,
 	const float relative_weight_decay,
 	const float absolute_weight_decay,
 	const float weight_clipping_magnitude,
@@ -38,118 +55,145 @@ void adam_step(id<1> idx,
 	const float lower_lr_bound,
 	const float upper_lr_bound,
 	const float l2_reg,
-	bf16* weights,
-	const bf16* gradients,
-	float* first_moments,
-	float* second_moments,
+	float* master_weights,
+	T* weights,
+	T* weightsT,
+	const float* gradients,
+	float& first_moment,
+	float& second_moment,
+	float* master_ema_weights,
+	T* ema_weights,
+	const float ema_decay,
 	int WIDTH
 ) {
 
-	const bf16 weight = weights[idx];
-	bf16 gradient = gradients[idx] / loss_scale;
+	const float weight = master_weights[idx];
+	float gradient = gradients[idx] / loss_scale;
 
 	gradient += l2_reg * weight;
 
 	const float gradient_sq = gradient * gradient;
 
-	float first_moment = first_moments[idx] = beta1 * first_moments[idx] + (1 - beta1) * gradient;
-	const float second_moment = second_moments[idx] = beta2 * second_moments[idx] + (1 - beta2) * gradient_sq;
+	first_moment = beta1 * first_moment + (1 - beta1) * gradient;
+	second_moment = beta2 * second_moment + (1 - beta2) * gradient_sq;
 
 	const float effective_learning_rate = fminf(fmaxf(learning_rate / (sqrtf(second_moment) + epsilon), lower_lr_bound), upper_lr_bound);
 
-	float new_weight = effective_learning_rate * first_moment;
+	float new_weight = weight - effective_learning_rate * first_moment;
 
 	if (weight_clipping_magnitude != 0.0f) {
 		new_weight = clamp(new_weight, -weight_clipping_magnitude, weight_clipping_magnitude);
 	}
 
-	weights[idx] = (bf16)new_weight;
+	const int packed_idx = toPackedWeightCoord(idx, WIDTH, output_width, n_hidden_layers, false);
+	master_weights[idx] = new_weight;
+	weights[packed_idx] = (T)new_weight;
+	weightsT[toPackedWeightCoord(idx, WIDTH, output_width, n_hidden_layers, true)] = (T)new_weight;
+
+	if (ema_weights != nullptr) {
+		ema_step(idx, new_weight, ema_decay, master_ema_weights, ema_weights, packed_idx);
+	}
 }
 
 /**
- * Perform an Adam optimizer step for a single element for the transposed weight matrix.
+ * Constructor for the Adam optimizer.
  *
- * @param idx Index of the element to process.
- * @param n_elements Total number of elements.
- * @param relative_weight_decay Relative weight decay coefficient.
- * @param absolute_weight_decay Absolute weight decay coefficient.
- * @param weight_clipping_magnitude Weight clipping magnitude.
- * @param loss_scale Loss scale factor.
+ * @param output_rows Width of the output layer.
+ * @param n_hidden_layers Number of hidden layers in the network.
  * @param learning_rate Learning rate.
- * @param non_matrix_learning_rate_factor Non-matrix learning rate factor.
- * @param beta1 Beta1 coefficient for first moment.
- * @param beta2 Beta2 coefficient for second moment.
- * @param epsilon Small value to prevent division by zero.
- * @param lower_lr_bound Lower bound for the learning rate.
- * @param upper_lr_bound Upper bound for the learning rate.
  * @param l2_reg L2 regularization coefficient.
- * @param weights Pointer to weights (bf16 type).
- * @param gradients Pointer to gradients (bf16 type).
- * @param first_moments Pointer to first moments.
- * @param second_moments Pointer to second moments.
- * @param WIDTH Width of the matrix (for matrix operations).
  */
-void adam_stepT(id<1> idx,
-	const int n_elements,
-	const float relative_weight_decay,
-	const float absolute_weight_decay,
-	const float weight_clipping_magnitude,
-	const float loss_scale,
-	float learning_rate,
-	const float non_matrix_learning_rate_factor,
-	const float beta1,
-	const float beta2,
-	const float epsilon,
-	const float lower_lr_bound,
-	const float upper_lr_bound,
-	const float l2_reg,
-	bf16* weightsT,
-	const bf16* gradients,
-	float* first_moments,
-	float* second_moments,
-	int WIDTH
-) {
-	const int i = idx / WIDTH;
-	const int j = idx % WIDTH;
-
-	const int T_idx = WIDTH * j + i;
-
-	const bf16 weight = weightsT[T_idx];
-	bf16 gradient = gradients[T_idx] / loss_scale;
-
-	gradient += l2_reg * weight;
-
-	const float gradient_sq = gradient * gradient;
-
-	float first_moment = first_moments[T_idx] = beta1 * first_moments[T_idx] + (1 - beta1) * gradient;
-	const float second_moment = second_moments[T_idx] = beta2 * second_moments[T_idx] + (1 - beta2) * gradient_sq;
-
-	const float effective_learning_rate = fminf(fmaxf(learning_rate / (sqrtf(second_moment) + epsilon), lower_lr_bound), upper_lr_bound);
+AdamOptimizer::AdamOptimizer(int output_rows, int n_hidden_layers, float learning_rate, float l2_reg, MomentsPrecision moments_precision) {
+	m_output_rows = output_rows;
+	m_n_hidden_layers = n_hidden_layers;
+	m_learning_rate = learning_rate;
+	m_l2_reg = l2_reg;
+	m_moments_precision = moments_precision;
+}
 
-	float new_weight = effective_learning_rate * first_moment;
+/**
+ * Allocate the moments in their storage precision and zero them.
+ *
+ * With 8-bit moments, each block of ADAM_BLOCK_SIZE parameters stores its moments as int8 (first moment) and
+ * uint8 (square root of the second moment) fractions of the absolute maximum of the block, kept in fp32.
+ *
+ * @param q SYCL queue for parallel computation.
+ * @param n_elements Number of parameters.
+ */
+void AdamOptimizer::allocate_moments(queue q, int n_elements) {
+	m_n_moments = n_elements;
 
-	if (weight_clipping_magnitude != 0.0f) {
-		new_weight = clamp(new_weight, -weight_clipping_magnitude, weight_clipping_magnitude);
+	switch (m_moments_precision) {
+	case MomentsPrecision::Float:
+		m_first_moments.allocate(n_elements, q);
+		m_second_moments.allocate(n_elements, q);
+		m_first_moments.initialize_constant(0.0f, q);
+		m_second_moments.initialize_constant(0.0f, q);
+		break;
+	case MomentsPrecision::BFloat16:
+		m_first_moments_bf16.allocate(n_elements, q);
+		m_second_moments_bf16.allocate(n_elements, q);
+		m_first_moments_bf16.initialize_constant(bf16(0.0f), q);
+		m_second_moments_bf16.initialize_constant(bf16(0.0f), q);
+		break;
+	case MomentsPrecision::Int8Blockwise: {
+		const int n_blocks = (n_elements + ADAM_BLOCK_SIZE - 1) / ADAM_BLOCK_SIZE;
+		m_first_moments_int8.allocate(n_elements, q);
+		m_second_moments_uint8.allocate(n_elements, q);
+		m_first_moments_scales.allocate(n_blocks, q);
+		m_second_moments_scales.allocate(n_blocks, q);
+		m_first_moments_int8.initialize_constant(0, q);
+		m_second_moments_uint8.initialize_constant(0, q);
+		m_first_moments_scales.initialize_constant(0.0f, q);
+		m_second_moments_scales.initialize_constant(0.0f, q);
+		break;
+	}
 	}
+}
 
-	weightsT[T_idx] = (bf16)new_weight;
+/**
+ * Get the number of bytes of optimizer state per parameter, fp32 master weight included.
+ *
+ * @return 12 with fp32 moments, 8 with bf16 moments and about 6 with 8-bit moments.
+ */
+float AdamOptimizer::get_state_bytes_per_param() const {
+	float moments_bytes = 0.0f;
+	switch (m_moments_precision) {
+	case MomentsPrecision::Float:         moments_bytes = 2 * sizeof(float); break;
+	case MomentsPrecision::BFloat16:      moments_bytes = 2 * sizeof(bf16); break;
+	case MomentsPrecision::Int8Blockwise: moments_bytes = 2 * sizeof(uint8_t) + 2.0f * sizeof(float) / ADAM_BLOCK_SIZE; break;
+	}
+	return sizeof(float) + moments_bytes;
 }
 
 /**
  * Perform Adam optimizer steps on a batch of elements.
+ * The moments are allocated and zeroed at the first step. They are dequantized and requantized in the same pass
+ * as the update, with one work-group per block for the 8-bit moments.
  *
  * @param q SYCL queue for parallel computation.
  * @param loss_scale Loss scale factor.
- * @param weights Weights tensor (DeviceMem<bf16>).
- * @param weightsT Transposed weights tensor (DeviceMem<bf16>).
- * @param gradients Gradients tensor (DeviceMem<bf16>).
+ * @param weights Weights tensor (DeviceMem<bf16> or DeviceMem<sycl::half>).
+ * @param weightsT Transposed weights tensor, of the type of the weights.
+ * @param gradients Gradients tensor (DeviceMem<float>).
  * @param WIDTH Width of the matrix (for matrix operations).
  */
-void AdamOptimizer::step(queue q, float loss_scale, DeviceMem<bf16>& weights, DeviceMem<bf16>& weightsT, DeviceMem<bf16>& gradients, int WIDTH) {
+void AdamOptimizer::step(queue q, float loss_scale, DeviceMem<bf16>& weights, DeviceMem<bf16>& weightsT, DeviceMem<float>& gradients, int WIDTH) {
+	step_impl(q, loss_scale, weights, weightsT, gradients, WIDTH);
+}
+
+void AdamOptimizer::step(queue q, float loss_scale, DeviceMem<sycl::half>& weights, DeviceMem<sycl::half>& weightsT, DeviceMem<float>& gradients, int WIDTH) {
+	step_impl(q, loss_scale, weights, weightsT, gradients, WIDTH);
+}
+
+template <typename T>
+void AdamOptimizer::step_impl(queue q, float loss_scale, DeviceMem<T>& weights, DeviceMem<T>& weightsT, DeviceMem<float>& gradients, int WIDTH) {
 
 	const int n_elements = weights.size();
 	float learning_rate = m_learning_rate;
 	float l2_reg = m_l2_reg;
+	const int output_rows = m_output_rows;
+	const int n_hidden_layers = m_n_hidden_layers;
 	const float relative_weight_decay = 0.01f;
 	const float absolute_weight_decay = 0.01f;
 	const float weight_clipping_magnitude = 0.01f;
@@ -160,13 +204,27 @@ void AdamOptimizer::step(queue q, float loss_scale, DeviceMem<bf16>& weights, De
 	const float lower_lr_bound = 0.0001f;
 	const float upper_lr_bound = 0.1f;
 
-	auto first_moment = m_first_moments.data();
-	auto second_moment = m_second_moments.data();
+	if (m_n_moments != n_elements) {
+		allocate_moments(q, n_elements);
+	}
+
+	update_master_weights(q, weights, WIDTH, output_rows, n_hidden_layers);
 
+	auto master_weights = m_master_weights.data();
+	auto p_weights = weights.data();
+	auto p_weightsT = weightsT.data();
+	auto p_gradients = gradients.data();
+	const float* skip_flag = m_skip_flag;
+	auto master_ema_weights = m_master_ema_weights.data();
+	T* ema_weights = get_ema_weights<T>();
+	const float ema_decay = m_ema_decay;
 
-	q.parallel_for<>(range<1>(n_elements), [=](id<1> idx) {
-		adam_step(idx,
+	// Run the update of one element with the moments loaded in fp32
+	auto update = [=](int idx, float& first_moment, float& second_moment) {
+		adam_step(id<1>(idx),
 		n_elements,
+		output_rows,
+		n_hidden_layers,
 		relative_weight_decay,
 		absolute_weight_decay,
 		weight_clipping_magnitude,
@@ -179,34 +237,94 @@ void AdamOptimizer::step(queue q, float loss_scale, DeviceMem<bf16>& weights, De
 		lower_lr_bound,
 		upper_lr_bound,
 		l2_reg,
-		weights.data(),
-		gradients.data(),
+		master_weights,
+		p_weights,
+		p_weightsT,
+		p_gradients,
 		first_moment,
 		second_moment,
+		master_ema_weights,
+		ema_weights,
+		ema_decay,
 		WIDTH);
-		}).wait();
+	};
+
+	switch (m_moments_precision) {
+	case MomentsPrecision::Float: {
+		auto first_moments = m_first_moments.data();
+		auto second_moments = m_second_moments.data();
+
+		q.parallel_for<>(range<1>(n_elements), [=](id<1> idx) {
+			if (skip_flag != nullptr && *skip_flag != 0.0f) {
+				return;
+			}
+			float first_moment = first_moments[idx];
+			float second_moment = second_moments[idx];
+			update(idx, first_moment, second_moment);
+			first_moments[idx] = first_moment;
+			second_moments[idx] = second_moment;
+			}).wait();
+		break;
+	}
+	case MomentsPrecision::BFloat16: {
+		auto first_moments = m_first_moments_bf16.data();
+		auto second_moments = m_second_moments_bf16.data();
 
 		q.parallel_for<>(range<1>(n_elements), [=](id<1> idx) {
-			adam_stepT(idx,
-			n_elements,
-			relative_weight_decay,
-			absolute_weight_decay,
-			weight_clipping_magnitude,
-			loss_scale,
-			learning_rate,
-			non_matrix_learning_rate_factor,
-			beta1,
-			beta2,
-			epsilon,
-			lower_lr_bound,
-			upper_lr_bound,
-			l2_reg,
-			weightsT.data(),
-			gradients.data(),
-			first_moment,
-			second_moment,
-			WIDTH);
+			if (skip_flag != nullptr && *skip_flag != 0.0f) {
+				return;
+			}
+			float first_moment = first_moments[idx];
+			float second_moment = second_moments[idx];
+			update(idx, first_moment, second_moment);
+			first_moments[idx] = (bf16)first_moment;
+			second_moments[idx] = (bf16)second_moment;
 			}).wait();
+		break;
+	}
+	case MomentsPrecision::Int8Blockwise: {
+		auto first_moments = m_first_moments_int8.data();
+		auto second_moments = m_second_moments_uint8.data();
+		auto first_scales = m_first_moments_scales.data();
+		auto second_scales = m_second_moments_scales.data();
+		const int n_blocks = m_first_moments_scales.size();
+
+		q.parallel_for<>(nd_range<1>(n_blocks * ADAM_BLOCK_SIZE, ADAM_BLOCK_SIZE), [=](nd_item<1> item) {
+			// The flag is the same for the whole work-group, which can leave before the reductions
+			if (skip_flag != nullptr && *skip_flag != 0.0f) {
+				return;
+			}
+			const int idx = item.get_global_id(0);
+			const int block = item.get_group(0);
+			const bool valid = idx < n_elements;
+
+			// Dequantize, the second moment is stored as its square root to halve its dynamic range
+			float first_moment = 0.0f;
+			float second_moment = 0.0f;
+			if (valid) {
+				first_moment = first_moments[idx] * first_scales[block] / 127.0f;
+				const float second_moment_sqrt = second_moments[idx] * second_scales[block] / 255.0f;
+				second_moment = second_moment_sqrt * second_moment_sqrt;
+				update(idx, first_moment, second_moment);
+			}
+
+			// Requantize with the new absolute maximum of the block
+			const float second_moment_sqrt = sycl::sqrt(second_moment);
+			const float first_max = reduce_over_group(item.get_group(), sycl::fabs(first_moment), maximum<float>());
+			const float second_max = reduce_over_group(item.get_group(), second_moment_sqrt, maximum<float>());
+
+			if (valid) {
+				first_moments[idx] = (first_max > 0.0f) ? (int8_t)sycl::round(first_moment / first_max * 127.0f) : 0;
+				second_moments[idx] = (second_max > 0.0f) ? (uint8_t)sycl::round(second_moment_sqrt / second_max * 255.0f) : 0;
+			}
+			if (item.get_local_id(0) == 0) {
+				first_scales[block] = first_max;
+				second_scales[block] = second_max;
+			}
+			}).wait();
+		break;
+	}
+	}
 }
 
 /**
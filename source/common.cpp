@@ -73,3 +73,67 @@ bool isequalstring(const std::string& str1, const std::string& str2) {
     }
     return true;
 }
+
+
+/**
+ * Check if a layer is kept in the forward activation storage when checkpointing.
+ *
+ * Only every checkpoint_interval-th layer (starting from the input) is stored, plus the
+ * last two layers which are always needed to start the backward pass. With an interval
+ * of 1, every layer is stored.
+ *
+ * @param layer                 Index of the layer (0 is the input).
+ * @param checkpoint_interval   Number of layers between two stored layers.
+ * @param n_hidden_matrices     Number of hidden matrices of the network.
+ * @return                      True if the layer is stored, false otherwise.
+ */
+bool isCheckpointLayer(int layer, int checkpoint_interval, int n_hidden_matrices) {
+    return (layer % checkpoint_interval == 0) || (layer >= n_hidden_matrices);
+}
+
+
+/**
+ * Get the slot of a stored layer in the forward activation storage when checkpointing.
+ *
+ * The slot is the number of stored layers before the given one, so that the stored
+ * layers are contiguous. With an interval of 1, the slot is the layer index itself.
+ *
+ * @param layer                 Index of the layer (0 is the input).
+ * @param checkpoint_interval   Number of layers between two stored layers.
+ * @param n_hidden_matrices     Number of hidden matrices of the network.
+ * @return                      Slot of the layer in the forward activation storage.
+ */
+int checkpointSlot(int layer, int checkpoint_interval, int n_hidden_matrices) {
+    if (layer < n_hidden_matrices) {
+        return (layer + checkpoint_interval - 1) / checkpoint_interval;
+    }
+    return (n_hidden_matrices + checkpoint_interval - 1) / checkpoint_interval + layer - n_hidden_matrices;
+}
+
+
+/**
+ * Get the position of a weight in the packed weights from its position in the unpacked weights.
+ *
+ * The unpacked weights hold the matrices one after the other in row-major order, like the
+ * gradients: n_hidden_layers matrices of width x width and an output matrix of width x output_width.
+ * Each matrix keeps its offset in the packed weights, only its elements are interleaved.
+ *
+ * @param idx               Index in the unpacked weights.
+ * @param width             Width of the layers.
+ * @param output_width      Width of the output layer.
+ * @param n_hidden_layers   Number of width x width matrices before the output matrix.
+ * @param transposed        True for the packed transposed weights.
+ * @return                  Index in the packed (transposed) weights.
+ */
+int toPackedWeightCoord(int idx, int width, int output_width, int n_hidden_layers, bool transposed) {
+    const int matrix_number = idx / (width * width);
+    const int matrix_offset = idx % (width * width);
+    const int cols = (matrix_number < n_hidden_layers) ? width : output_width;
+
+    if (transposed) {
+        const int i = matrix_offset / cols;
+        const int j = matrix_offset % cols;
+        return matrix_number * width * width + toPackedLayoutCoord(j * width + i, cols, width);
+    }
+    return matrix_number * width * width + toPackedLayoutCoord(matrix_offset, width, cols);
+}
@@ -0,0 +1,49 @@
+#include "optimizer.h"
+
+/**
+ * Copy the packed bf16 or fp16 weights into the fp32 master weights if they have been reset.
+ *
+ * The master weights are allocated at the first call, they are then only written by the optimizer steps.
+ * The moving average of the weights, when enabled, restarts from the current weights.
+ *
+ * @param q               SYCL queue for parallel computation.
+ * @param weights         Packed weights of the network.
+ * @param WIDTH           Width of the weight matrices.
+ * @param output_width    Width of the output layer.
+ * @param n_hidden_layers Number of WIDTH x WIDTH matrices before the output matrix.
+ */
+template <typename T>
+void Optimizer::update_master_weights(queue q, DeviceMem<T>& weights, int WIDTH, int output_width, int n_hidden_layers) {
+	if (m_master_weights_valid) {
+		return;
+	}
+	if (m_master_weights.size() != weights.size()) {
+		if (m_master_weights.size() > 0) {
+			m_master_weights.free_mem(q);
+		}
+		m_master_weights.allocate(weights.size(), q);
+	}
+	if (m_ema_weights != nullptr && m_master_ema_weights.size() != weights.size()) {
+		if (m_master_ema_weights.size() > 0) {
+			m_master_ema_weights.free_mem(q);
+		}
+		m_master_ema_weights.allocate(weights.size(), q);
+	}
+
+	float* master_weights = m_master_weights.data();
+	T* p = weights.data();
+
+	q.parallel_for<>(range<1>(weights.size()), [=](id<1> idx) {
+		master_weights[idx] = (float)p[toPackedWeightCoord(idx, WIDTH, output_width, n_hidden_layers, false)];
+		}).wait();
+
+	if (m_ema_weights != nullptr) {
+		q.memcpy(m_master_ema_weights.data(), master_weights, weights.size() * sizeof(float));
+		q.memcpy(get_ema_weights<T>(), p, weights.size() * sizeof(T)).wait();
+	}
+
+	m_master_weights_valid = true;
+}
+
+template void Optimizer::update_master_weights<bf16>(queue, DeviceMem<bf16>&, int, int, int);
+template void Optimizer::update_master_weights<sycl::half>(queue, DeviceMem<sycl::half>&, int, int, int);